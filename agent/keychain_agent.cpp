@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/* keychain-agent serves keychain operations to processes of its own user over
+ * a Unix domain socket, see agent.h. It keeps the connection to the
+ * credentials storage open and caches passwords in memory for --ttl seconds.
+ */
+
+#include "agent.h"
+#include "agent_protocol.h"
+#include "basic_keychain.h"
+#include "locked_memory.h"
+#include "memory_cache.h"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+using AgentCache = keychain::BasicKeychain<keychain::OsBackend,
+                                           keychain::MemoryCache>;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int) { stopRequested = 1; }
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+    str.clear();
+}
+
+void printUsage(const char *program) {
+    std::fprintf(stderr,
+                 "Usage: %s [--socket PATH] [--ttl SECONDS]\n"
+                 "\n"
+                 "  --socket PATH    listen on PATH instead of the default\n"
+                 "                   socket (%s)\n"
+                 "  --ttl SECONDS    cache passwords for SECONDS (default "
+                 "300, 0 disables caching)\n",
+                 program,
+                 keychain::agentSocketPath().c_str());
+}
+
+void handle(AgentCache &keychain, keychain::agent::Request &request,
+            keychain::agent::Response &response) {
+    using keychain::agent::Op;
+
+    const keychain::Key key(request.package, request.service, request.user);
+    switch (request.op) {
+    case Op::GetPassword:
+        response.value = keychain.getPassword(key, response.error);
+        break;
+    case Op::SetPassword:
+        keychain.setPassword(key, request.value, response.error);
+        break;
+    case Op::DeletePassword:
+        keychain.deletePassword(key, response.error);
+        break;
+    case Op::HasPassword:
+        response.value = keychain.hasPassword(key, response.error) ? "1" : "";
+        break;
+    case Op::GetSecret: {
+        auto secret = keychain.getSecret(key, response.error);
+        response.value.assign(secret.begin(), secret.end());
+        keychain::detail::secureWipe(secret.data(), secret.size());
+        break;
+    }
+    case Op::SetSecret:
+        keychain.setSecret(
+            key,
+            reinterpret_cast<const unsigned char *>(request.value.data()),
+            request.value.size(),
+            response.error);
+        break;
+    default:
+        response.error.type = keychain::ErrorType::GenericError;
+        response.error.message =
+            keychain::ErrorMessage::literal("Unknown request.");
+        response.error.code = -1; // generic non-zero
+    }
+}
+
+void serve(AgentCache &keychain, int fd) {
+    // the socket's permissions already keep other users out, this also
+    // covers sockets in directories others can write to
+    if (keychain::agent::isSameUser(fd)) {
+        keychain::agent::Request request;
+        while (keychain::agent::receiveRequest(fd, request)) {
+            keychain::agent::Response response;
+            handle(keychain, request, response);
+            wipe(request.value);
+
+            const bool sent = keychain::agent::sendResponse(fd, response);
+            wipe(response.value);
+            if (!sent) {
+                break;
+            }
+        }
+        wipe(request.value);
+    }
+    close(fd);
+}
+
+bool isAgentListening(const sockaddr_un &address) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    const bool listening = connect(fd,
+                                   reinterpret_cast<const sockaddr *>(&address),
+                                   sizeof(address)) == 0;
+    close(fd);
+    return listening;
+}
+
+int listenOn(const std::string &path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    if (isAgentListening(address)) {
+        std::fprintf(stderr, "An agent is already listening on %s\n",
+                     path.c_str());
+        return -1;
+    }
+    unlink(path.c_str()); // left behind by an agent that did not shut down
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::perror("socket");
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // create the socket accessible to our user only
+    const mode_t previousMask = umask(0177);
+    const int bound = bind(fd,
+                           reinterpret_cast<const sockaddr *>(&address),
+                           sizeof(address));
+    umask(previousMask);
+
+    if (bound != 0 || listen(fd, SOMAXCONN) != 0) {
+        std::fprintf(stderr, "Cannot listen on %s: %s\n", path.c_str(),
+                     std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! \brief Create the per-user directory of the default socket path
+void createSocketDirectory(const std::string &path) {
+    const auto slash = path.rfind('/');
+    if (slash == std::string::npos || slash == 0) {
+        return;
+    }
+    // an existing directory is fine, bind reports anything else
+    mkdir(path.substr(0, slash).c_str(), 0700);
+}
+
+void installSignalHandlers() {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop; // no SA_RESTART, accept returns EINTR
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::signal(SIGPIPE, SIG_IGN);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string socketPath = keychain::agentSocketPath();
+    long ttl = 300;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--ttl" && i + 1 < argc) {
+            char *end = nullptr;
+            ttl = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || ttl < 0) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            printUsage(argv[0]);
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    createSocketDirectory(socketPath);
+    const int listenFd = listenOn(socketPath);
+    if (listenFd < 0) {
+        return EXIT_FAILURE;
+    }
+    installSignalHandlers();
+
+    // shared by all connections, MemoryCache and OsBackend are thread-safe.
+    // Never deleted, as detached connection threads may still use it on exit.
+    auto *agentKeychain = new AgentCache{
+        keychain::OsBackend{},
+        keychain::MemoryCache{std::chrono::seconds(ttl)},
+        keychain::NoInstrumentation{}};
+
+    while (!stopRequested) {
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::perror("accept");
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        std::thread(serve, std::ref(*agentKeychain), fd).detach();
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_BENCH_HDR_HISTOGRAM_H_
+#define XPLATFORM_KEYCHAIN_BENCH_HDR_HISTOGRAM_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include "keychain/stats.h"
+
+/*! \brief A high dynamic range histogram of latencies
+ *
+ * keychain's own LatencyHistogram, but with buckets of 1/1024 of their value,
+ * i.e. three significant decimal digits, and a range of about an hour.
+ *
+ * Not thread-safe. Record per thread and add() the results.
+ */
+using HdrHistogram = keychain::BasicLatencyHistogram<10, 41>;
+
+//! \brief Write one line of the .hgrm format
+inline void printPercentileLine(std::FILE *out, std::int64_t value,
+                                double percentile, std::uint64_t count,
+                                double scale) {
+    const double fraction = percentile / 100;
+    if (fraction < 1) {
+        std::fprintf(out,
+                     "%12.3f %14.12f %10llu %14.2f\n",
+                     value / scale,
+                     fraction,
+                     static_cast<unsigned long long>(count),
+                     1 / (1 - fraction));
+    } else {
+        std::fprintf(out,
+                     "%12.3f %14.12f %10llu\n",
+                     value / scale,
+                     fraction,
+                     static_cast<unsigned long long>(count));
+    }
+}
+
+//! \brief The standard deviation of the latencies, from their buckets' middle
+inline double stdDeviation(const HdrHistogram &histogram) {
+    if (histogram.count() == 0) {
+        return 0;
+    }
+
+    const double mean = static_cast<double>(histogram.mean().count());
+    double squares = 0;
+    std::int64_t lower = 0;
+    for (std::size_t i = 0; i < HdrHistogram::BucketCount; ++i) {
+        const std::int64_t limit = HdrHistogram::bucketLimit(i).count();
+        if (histogram.bucket(i) != 0) {
+            const double deviation = (lower + limit) / 2.0 - mean;
+            squares += deviation * deviation * histogram.bucket(i);
+        }
+        lower = limit + 1;
+    }
+    return std::sqrt(squares / histogram.count());
+}
+
+/*! \brief Write the percentile distribution in HdrHistogram's .hgrm format,
+ *         with values in nanoseconds divided by `scale`
+ */
+inline void writePercentiles(std::FILE *out, const HdrHistogram &histogram,
+                             double scale) {
+    std::fprintf(out,
+                 "%12s %14s %10s %14s\n\n",
+                 "Value",
+                 "Percentile",
+                 "TotalCount",
+                 "1/(1-Percentile)");
+
+    // five lines for each halving of the distance to 100%
+    const std::uint64_t total = histogram.count();
+    std::uint64_t seen = 0;
+    double next = 0;
+    for (std::size_t i = 0; i < HdrHistogram::BucketCount && seen < total;
+         ++i) {
+        if (histogram.bucket(i) == 0) {
+            continue;
+        }
+        seen += histogram.bucket(i);
+        const double reached = 100.0 * seen / total;
+        const std::int64_t value = HdrHistogram::bucketLimit(i).count();
+        while (next < 100 && reached >= next) {
+            printPercentileLine(out, value, next, seen, scale);
+            if (seen == total) {
+                break;
+            }
+            const double halvings =
+                std::floor(std::log2(100 / (100 - next))) + 1;
+            next += 100 / (5 * std::pow(2, halvings));
+        }
+    }
+
+    const std::int64_t max = histogram.percentile(100).count();
+    printPercentileLine(out, max, 100, total, scale);
+    std::fprintf(out,
+                 "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n"
+                 "#[Max     = %12.3f, Total count    = %12llu]\n",
+                 histogram.mean().count() / scale,
+                 stdDeviation(histogram) / scale,
+                 max / scale,
+                 static_cast<unsigned long long>(total));
+}
+
+#endif
@@ -0,0 +1,427 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* keychain-bench measures the latency and throughput of keychain operations.
+ *
+ * For each combination of thread count, secret size and collection size
+ * (the number of other items in the keychain), each thread sets, gets and
+ * deletes `--iterations` passwords of its own, and calls isAvailable as
+ * often. Every operation is timed individually. Results are written as JSON,
+ * to compare builds against each other.
+ *
+ * On Linux, keychain-bench runs against a private dbus-daemon and
+ * gnome-keyring-daemon, or the Secret Service given by --service, unless
+ * --external is given, see SecretServiceFixture. Elsewhere it uses the user's
+ * credentials storage.
+ */
+
+#include "keychain/keychain.h"
+
+#ifdef KEYCHAIN_LINUX
+#include "secret_service_fixture.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const char *const Package = "com.example.keychain-bench";
+
+struct Options {
+    std::vector<std::size_t> threads{1, 4};
+    std::vector<std::size_t> secretSizes{16, 4096};
+    std::vector<std::size_t> collectionSizes{0, 1000};
+    std::size_t iterations = 200;
+    std::string output; // stdout if empty
+    bool external = false;
+    std::vector<std::string> service; // gnome-keyring-daemon if empty
+};
+
+enum class Phase { Set, Get, IsAvailable, Delete };
+
+const char *phaseName(Phase phase) {
+    switch (phase) {
+    case Phase::Set:
+        return "set";
+    case Phase::Get:
+        return "get";
+    case Phase::IsAvailable:
+        return "isAvailable";
+    case Phase::Delete:
+        return "delete";
+    }
+    return "unknown";
+}
+
+struct Result {
+    Phase phase;
+    std::size_t threads;
+    std::size_t secretSize;
+    std::size_t collectionSize;
+    std::size_t errors;
+    double seconds;                   // wall time of the whole phase
+    std::vector<std::int64_t> latency; // ns, sorted
+};
+
+//! \brief Nearest-rank percentile of sorted samples
+std::int64_t percentile(const std::vector<std::int64_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    const auto rank = static_cast<std::size_t>(p * sorted.size() + 0.999999);
+    return sorted[std::min(std::max<std::size_t>(rank, 1), sorted.size()) -
+                  1];
+}
+
+//! \brief Run one phase on `threads` threads, starting them simultaneously
+Result runPhase(Phase phase, std::size_t threads, std::size_t iterations,
+                const std::string &secret) {
+    std::vector<std::vector<keychain::Key>> keys(threads);
+    for (std::size_t t = 0; t < threads; ++t) {
+        for (std::size_t i = 0; i < iterations; ++i) {
+            keys[t].emplace_back(Package,
+                                 "bench",
+                                 "thread" + std::to_string(t) + "-" +
+                                     std::to_string(i));
+        }
+    }
+
+    std::vector<std::vector<std::int64_t>> latencies(threads);
+    std::vector<std::size_t> errors(threads, 0);
+    std::mutex mutex;
+    std::condition_variable released;
+    bool go = false;
+
+    auto work = [&](std::size_t t) {
+        auto &samples = latencies[t];
+        samples.reserve(iterations);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            released.wait(lock, [&] { return go; });
+        }
+
+        keychain::Error err;
+        for (const auto &key : keys[t]) {
+            const auto begin = std::chrono::steady_clock::now();
+            switch (phase) {
+            case Phase::Set:
+                keychain::setPassword(key, secret, err);
+                break;
+            case Phase::Get:
+                keychain::getPassword(key, err);
+                break;
+            case Phase::IsAvailable:
+                keychain::isAvailable(err);
+                break;
+            case Phase::Delete:
+                keychain::deletePassword(key, err);
+                break;
+            }
+            const auto end = std::chrono::steady_clock::now();
+            samples.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end -
+                                                                     begin)
+                    .count());
+            if (err) {
+                ++errors[t];
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(work, t);
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        go = true;
+    }
+    released.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    Result result{phase, threads, secret.size(), 0, 0,
+                  std::chrono::duration<double>(end - begin).count(), {}};
+    for (std::size_t t = 0; t < threads; ++t) {
+        result.errors += errors[t];
+        result.latency.insert(result.latency.end(),
+                              latencies[t].begin(),
+                              latencies[t].end());
+    }
+    std::sort(result.latency.begin(), result.latency.end());
+    return result;
+}
+
+//! \brief Grow or shrink the collection of filler items to `size`
+void resizeCollection(std::size_t &current, std::size_t size) {
+    keychain::Error err;
+    for (; current < size; ++current) {
+        keychain::setPassword(
+            keychain::Key(Package, "filler", std::to_string(current)),
+            "filler",
+            err);
+    }
+    for (; current > size; --current) {
+        keychain::deletePassword(
+            keychain::Key(Package, "filler", std::to_string(current - 1)),
+            err);
+    }
+}
+
+const char *platformName() {
+#if defined(KEYCHAIN_LINUX)
+    return "linux";
+#elif defined(KEYCHAIN_MACOS)
+    return "macos";
+#else
+    return "windows";
+#endif
+}
+
+//! \brief Whether the benchmark runs against a private Secret Service
+bool isHermetic(const Options &options) {
+#ifdef KEYCHAIN_LINUX
+    return !options.external;
+#else
+    (void)options;
+    return false;
+#endif
+}
+
+void writeList(std::ostream &out, const std::vector<std::size_t> &values) {
+    out << '[';
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        out << (i ? ", " : "") << values[i];
+    }
+    out << ']';
+}
+
+void writeJson(std::ostream &out, const Options &options,
+               const std::vector<Result> &results) {
+    out << "{\n"
+        << "  \"benchmark\": \"keychain-bench\",\n"
+        << "  \"platform\": \"" << platformName() << "\",\n"
+        << "  \"hermetic\": " << (isHermetic(options) ? "true" : "false")
+        << ",\n"
+        << "  \"iterations\": " << options.iterations << ",\n"
+        << "  \"threads\": ";
+    writeList(out, options.threads);
+    out << ",\n  \"secret_sizes\": ";
+    writeList(out, options.secretSizes);
+    out << ",\n  \"collection_sizes\": ";
+    writeList(out, options.collectionSizes);
+    out << ",\n  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        const auto &l = r.latency;
+        out << (i ? "," : "") << "\n    {"
+            << "\"operation\": \"" << phaseName(r.phase) << "\", "
+            << "\"threads\": " << r.threads << ", "
+            << "\"secret_size\": " << r.secretSize << ", "
+            << "\"collection_size\": " << r.collectionSize << ", "
+            << "\"samples\": " << l.size() << ", "
+            << "\"errors\": " << r.errors << ", "
+            << "\"throughput_ops_per_sec\": " << std::fixed
+            << std::setprecision(1)
+            << (r.seconds > 0 ? l.size() / r.seconds : 0) << ", "
+            << "\"latency_ns\": {"
+            << "\"min\": " << (l.empty() ? 0 : l.front()) << ", "
+            << "\"p50\": " << percentile(l, 0.5) << ", "
+            << "\"p99\": " << percentile(l, 0.99) << ", "
+            << "\"p999\": " << percentile(l, 0.999) << ", "
+            << "\"max\": " << (l.empty() ? 0 : l.back()) << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+void printSummary(const Result &r) {
+    std::fprintf(stderr,
+                 "%-12s threads=%-3zu size=%-6zu items=%-7zu "
+                 "p50=%9.1fus p99=%9.1fus p999=%9.1fus %9.1f ops/s%s\n",
+                 phaseName(r.phase),
+                 r.threads,
+                 r.secretSize,
+                 r.collectionSize,
+                 percentile(r.latency, 0.5) / 1e3,
+                 percentile(r.latency, 0.99) / 1e3,
+                 percentile(r.latency, 0.999) / 1e3,
+                 r.seconds > 0 ? r.latency.size() / r.seconds : 0,
+                 r.errors ? " (errors)" : "");
+}
+
+bool parseList(const char *arg, std::vector<std::size_t> &values) {
+    values.clear();
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        char *end = nullptr;
+        const unsigned long value = std::strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0') {
+            return false;
+        }
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+void printUsage(const char *program) {
+    std::fprintf(
+        stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  --threads N,...            thread counts (default 1,4)\n"
+        "  --secret-sizes N,...       secret sizes in bytes (default 16,4096)\n"
+        "  --collection-sizes N,...   number of other items in the keychain\n"
+        "                             (default 0,1000)\n"
+        "  --iterations N             operations per thread and phase "
+        "(default 200)\n"
+        "  --output FILE              write JSON to FILE instead of stdout\n"
+        "  --external                 use the session's Secret Service instead "
+        "of a\n"
+        "                             private one (Linux)\n"
+        "  --service COMMAND          run COMMAND as the private Secret "
+        "Service instead\n"
+        "                             of gnome-keyring-daemon, e.g. "
+        "keychain-mock-secret-service\n",
+        program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool valid = true;
+        if (arg == "--threads" && value) {
+            valid = parseList(argv[++i], options.threads);
+        } else if (arg == "--secret-sizes" && value) {
+            valid = parseList(argv[++i], options.secretSizes);
+        } else if (arg == "--collection-sizes" && value) {
+            valid = parseList(argv[++i], options.collectionSizes);
+        } else if (arg == "--iterations" && value) {
+            options.iterations = std::strtoul(argv[++i], nullptr, 10);
+            valid = options.iterations > 0;
+        } else if (arg == "--output" && value) {
+            options.output = argv[++i];
+        } else if (arg == "--external") {
+            options.external = true;
+        } else if (arg == "--service" && value) {
+            std::stringstream command(argv[++i]);
+            std::string word;
+            while (command >> word) {
+                options.service.push_back(word);
+            }
+            valid = !options.service.empty();
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            printUsage(argv[0]);
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+#ifdef KEYCHAIN_LINUX
+    // must be up before the first keychain operation connects to the bus
+    std::unique_ptr<SecretServiceFixture> fixture;
+    if (!options.external) {
+        fixture.reset(new SecretServiceFixture(options.service));
+        std::string error;
+        if (!fixture->start(error)) {
+            std::fprintf(stderr, "Cannot start the Secret Service: %s\n",
+                         error.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+#endif
+
+    keychain::Error err;
+    if (!keychain::isAvailable(err)) {
+        std::fprintf(stderr, "The keychain is not available: %s\n",
+                     err.message.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::size_t> collectionSizes = options.collectionSizes;
+    std::sort(collectionSizes.begin(), collectionSizes.end());
+
+    std::vector<Result> results;
+    std::size_t collectionSize = 0;
+    for (const std::size_t size : collectionSizes) {
+        resizeCollection(collectionSize, size);
+        for (const std::size_t threads : options.threads) {
+            for (const std::size_t secretSize : options.secretSizes) {
+                std::string secret(secretSize, '\0');
+                for (std::size_t i = 0; i < secretSize; ++i) {
+                    secret[i] = static_cast<char>('a' + i % 26);
+                }
+
+                for (const Phase phase : {Phase::Set,
+                                          Phase::Get,
+                                          Phase::IsAvailable,
+                                          Phase::Delete}) {
+                    results.push_back(runPhase(
+                        phase, threads, options.iterations, secret));
+                    results.back().collectionSize = size;
+                    printSummary(results.back());
+                }
+            }
+        }
+    }
+    resizeCollection(collectionSize, 0);
+
+    if (options.output.empty()) {
+        writeJson(std::cout, options, results);
+    } else {
+        std::ofstream out(options.output);
+        writeJson(out, options, results);
+        if (!out) {
+            std::fprintf(stderr, "Cannot write %s\n", options.output.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
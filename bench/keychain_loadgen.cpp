@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* keychain-loadgen drives the keychain with a constant or Poisson arrival
+ * rate, to find out how much load a credentials storage sustains and at which
+ * latency.
+ *
+ * Operations are scheduled open-loop: each of the worker threads has its own
+ * schedule, and the latency of an operation is measured from the time it was
+ * scheduled for, not from the time a worker became free to send it. A
+ * storage that cannot keep up with the rate thus shows growing latencies
+ * instead of silently lowering the rate (coordinated omission).
+ */
+
+#include "hdr_histogram.h"
+#include "keychain/agent.h"
+#include "keychain/basic_keychain.h"
+#include "keychain/keychain.h"
+#include "keychain/memory_cache.h"
+
+#ifdef KEYCHAIN_LINUX
+#include "keychain/keyring_cache.h"
+#include "secret_service_fixture.h"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char *const Package = "com.example.keychain-loadgen";
+
+enum Operation { Get, Set, Delete, OperationCount };
+
+const char *const OperationNames[OperationCount] = {"get", "set", "delete"};
+
+struct Options {
+    double rate = 100; // operations per second
+    double duration = 30;
+    double warmup = 5;
+    std::size_t threads = 4;
+    std::size_t keys = 1000;
+    double zipf = 0; // exponent, uniform if 0
+    std::size_t secretSize = 32;
+    std::array<double, OperationCount> mix{{90, 9, 1}};
+    bool poisson = false;
+    std::string backend = "os";
+    std::chrono::seconds cacheTtl = std::chrono::minutes(5);
+    std::string hgrmPrefix;
+    bool hermetic = false;
+    std::vector<std::string> service;
+};
+
+//! \brief The keychain under load, one of the compiled-in backends
+class Target {
+  public:
+    virtual ~Target() = default;
+
+    virtual void get(const keychain::Key &key, keychain::Error &err) = 0;
+    virtual void set(const keychain::Key &key, const std::string &secret,
+                     keychain::Error &err) = 0;
+    virtual void remove(const keychain::Key &key, keychain::Error &err) = 0;
+};
+
+template <typename Keychain> class KeychainTarget : public Target {
+  public:
+    explicit KeychainTarget(Keychain keychain)
+        : _keychain(std::move(keychain)) {}
+
+    void get(const keychain::Key &key, keychain::Error &err) override {
+        _keychain.getPassword(key, err);
+    }
+
+    void set(const keychain::Key &key, const std::string &secret,
+             keychain::Error &err) override {
+        _keychain.setPassword(key, secret, err);
+    }
+
+    void remove(const keychain::Key &key, keychain::Error &err) override {
+        _keychain.deletePassword(key, err);
+    }
+
+  private:
+    Keychain _keychain;
+};
+
+template <typename Keychain>
+std::unique_ptr<Target> makeTarget(Keychain keychain) {
+    return std::unique_ptr<Target>(
+        new KeychainTarget<Keychain>(std::move(keychain)));
+}
+
+std::unique_ptr<Target> makeTarget(const Options &options) {
+    using namespace keychain;
+    if (options.backend == "os") {
+        return makeTarget(DefaultKeychain());
+    } else if (options.backend == "memory-cache") {
+        return makeTarget(BasicKeychain<OsBackend, MemoryCache>{
+            OsBackend{}, MemoryCache(options.cacheTtl), NoInstrumentation{}});
+    }
+#ifndef KEYCHAIN_WINDOWS
+    if (options.backend == "agent") {
+        return makeTarget(AgentKeychain());
+    }
+#endif
+#ifdef KEYCHAIN_LINUX
+    if (options.backend == "keyring-cache") {
+        return makeTarget(KeyringCachedKeychain{
+            OsBackend{},
+            KeyringTieredCache(MemoryCache(options.cacheTtl),
+                               KeyringCache(options.cacheTtl)),
+            NoInstrumentation{}});
+    }
+#endif
+    return nullptr;
+}
+
+//! \brief Picks keys uniformly or by a Zipf distribution
+class KeyChooser {
+  public:
+    KeyChooser(std::size_t keys, double exponent) : _keys(keys) {
+        if (exponent > 0) {
+            _cdf.reserve(keys);
+            double sum = 0;
+            for (std::size_t i = 1; i <= keys; ++i) {
+                sum += 1 / std::pow(static_cast<double>(i), exponent);
+                _cdf.push_back(sum);
+            }
+            for (double &p : _cdf) {
+                p /= sum;
+            }
+        }
+    }
+
+    std::size_t operator()(std::mt19937_64 &random) const {
+        if (_cdf.empty()) {
+            return std::uniform_int_distribution<std::size_t>(0, _keys - 1)(
+                random);
+        }
+        const double p = std::uniform_real_distribution<double>()(random);
+        const auto it = std::lower_bound(_cdf.begin(), _cdf.end(), p);
+        return std::min<std::size_t>(it - _cdf.begin(), _keys - 1);
+    }
+
+  private:
+    std::size_t _keys;
+    std::vector<double> _cdf;
+};
+
+keychain::Key keyOf(std::size_t index) {
+    return keychain::Key(Package, "loadgen", "key" + std::to_string(index));
+}
+
+struct WorkerResult {
+    std::array<HdrHistogram, OperationCount> latency;
+    std::array<std::int64_t, OperationCount> errors{};
+    std::array<std::int64_t, OperationCount> notFound{};
+    Clock::duration maxLag{};
+};
+
+void work(Target &target, const Options &options, const KeyChooser &chooser,
+          const std::string &secret, std::size_t index, Clock::time_point start,
+          WorkerResult &result) {
+    std::mt19937_64 random(index + 1);
+    std::discrete_distribution<int> pickOperation(options.mix.begin(),
+                                                  options.mix.end());
+
+    // each worker takes an equal share of the rate, staggered
+    const double interval = options.threads / options.rate;
+    std::exponential_distribution<double> poisson(1 / interval);
+    const auto toDuration = [](double seconds) {
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(seconds));
+    };
+
+    const auto measureFrom = start + toDuration(options.warmup);
+    const auto end = measureFrom + toDuration(options.duration);
+    auto intended = start + toDuration(index / options.rate);
+
+    keychain::Error err;
+    while (intended < end) {
+        std::this_thread::sleep_until(intended);
+        const auto sent = Clock::now();
+
+        const int operation = pickOperation(random);
+        const keychain::Key key = keyOf(chooser(random));
+        switch (operation) {
+        case Get:
+            target.get(key, err);
+            break;
+        case Set:
+            target.set(key, secret, err);
+            break;
+        default:
+            target.remove(key, err);
+            break;
+        }
+        const auto done = Clock::now();
+
+        if (intended >= measureFrom) {
+            // from the scheduled time, which may have passed long ago
+            result.latency[operation].record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    done - intended));
+            result.maxLag = std::max(result.maxLag, sent - intended);
+            if (err.type == keychain::ErrorType::NotFound) {
+                ++result.notFound[operation];
+            } else if (err) {
+                ++result.errors[operation];
+            }
+        }
+
+        intended += toDuration(options.poisson ? poisson(random) : interval);
+    }
+}
+
+bool parseMix(const std::string &arg,
+              std::array<double, OperationCount> &mix) {
+    mix.fill(0);
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        const auto separator = item.find('=');
+        const std::string name = item.substr(0, separator);
+        const auto it = std::find(
+            std::begin(OperationNames), std::end(OperationNames), name);
+        if (separator == std::string::npos || it == std::end(OperationNames)) {
+            return false;
+        }
+        mix[it - std::begin(OperationNames)] =
+            std::strtod(item.c_str() + separator + 1, nullptr);
+    }
+    return mix[Get] + mix[Set] + mix[Delete] > 0;
+}
+
+void printUsage(const char *program) {
+    std::fprintf(
+        stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  --rate N            operations per second (default 100)\n"
+        "  --duration S        seconds to measure (default 30)\n"
+        "  --warmup S          seconds to run before measuring (default 5)\n"
+        "  --threads N         worker threads (default 4)\n"
+        "  --poisson           Poisson arrivals instead of a constant rate\n"
+        "  --mix get=N,...     weights of get, set and delete "
+        "(default get=90,set=9,delete=1)\n"
+        "  --keys N            number of distinct keys (default 1000)\n"
+        "  --zipf S            pick keys by a Zipf distribution with exponent "
+        "S\n"
+        "                      instead of uniformly\n"
+        "  --secret-size N     bytes per secret (default 32)\n"
+        "  --backend NAME      os, memory-cache, keyring-cache (Linux) or "
+        "agent\n"
+        "                      (not on Windows), default os\n"
+        "  --cache-ttl S       time to live of cached passwords (default "
+        "300)\n"
+        "  --hgrm PREFIX       write histograms to PREFIX.<operation>.hgrm\n"
+        "  --private           use a private gnome-keyring-daemon (Linux)\n"
+        "  --service COMMAND   use a private COMMAND as Secret Service "
+        "(Linux)\n",
+        program);
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        const bool hasValue = value != nullptr;
+        if (arg == "--poisson") {
+            options.poisson = true;
+        } else if (arg == "--private") {
+            options.hermetic = true;
+        } else if (!hasValue) {
+            return false;
+        } else if (arg == "--rate") {
+            options.rate = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--duration") {
+            options.duration = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--warmup") {
+            options.warmup = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--threads") {
+            options.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--mix") {
+            if (!parseMix(argv[++i], options.mix)) {
+                return false;
+            }
+        } else if (arg == "--keys") {
+            options.keys = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--zipf") {
+            options.zipf = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--secret-size") {
+            options.secretSize = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--backend") {
+            options.backend = argv[++i];
+        } else if (arg == "--cache-ttl") {
+            options.cacheTtl =
+                std::chrono::seconds(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--hgrm") {
+            options.hgrmPrefix = argv[++i];
+        } else if (arg == "--service") {
+            std::stringstream command(argv[++i]);
+            std::string word;
+            while (command >> word) {
+                options.service.push_back(word);
+            }
+            options.hermetic = true;
+        } else {
+            return false;
+        }
+    }
+    return options.rate > 0 && options.duration > 0 && options.warmup >= 0 &&
+           options.threads > 0 && options.keys > 0 && options.zipf >= 0;
+}
+
+double milliseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void printResults(const Options &options, const WorkerResult &total,
+                  double seconds) {
+    std::int64_t operations = 0;
+    for (const auto &histogram : total.latency) {
+        operations += histogram.count();
+    }
+
+    std::printf("%.1f operations/s scheduled, %.1f completed, schedule lag "
+                "up to %.3f ms\n\n",
+                options.rate,
+                operations / seconds,
+                std::chrono::duration<double, std::milli>(total.maxLag)
+                    .count());
+    std::printf("%-9s %9s %7s %9s %10s %10s %10s %10s %10s %10s %10s\n",
+                "operation",
+                "count",
+                "errors",
+                "not found",
+                "mean",
+                "p50",
+                "p90",
+                "p99",
+                "p99.9",
+                "p99.99",
+                "max (ms)");
+
+    for (int op = 0; op < OperationCount; ++op) {
+        const HdrHistogram &latency = total.latency[op];
+        std::printf("%-9s %9lld %7lld %9lld %10.3f %10.3f %10.3f %10.3f "
+                    "%10.3f %10.3f %10.3f\n",
+                    OperationNames[op],
+                    static_cast<long long>(latency.count()),
+                    static_cast<long long>(total.errors[op]),
+                    static_cast<long long>(total.notFound[op]),
+                    milliseconds(latency.mean()),
+                    milliseconds(latency.percentile(50)),
+                    milliseconds(latency.percentile(90)),
+                    milliseconds(latency.percentile(99)),
+                    milliseconds(latency.percentile(99.9)),
+                    milliseconds(latency.percentile(99.99)),
+                    milliseconds(latency.percentile(100)));
+
+        if (!options.hgrmPrefix.empty() && latency.count() > 0) {
+            const std::string path =
+                options.hgrmPrefix + "." + OperationNames[op] + ".hgrm";
+            if (std::FILE *file = std::fopen(path.c_str(), "w")) {
+                writePercentiles(file, latency, 1e6); // in ms
+                std::fclose(file);
+            } else {
+                std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+#ifdef KEYCHAIN_LINUX
+    std::unique_ptr<SecretServiceFixture> fixture;
+    if (options.hermetic) {
+        fixture.reset(new SecretServiceFixture(options.service));
+        std::string error;
+        if (!fixture->start(error)) {
+            std::fprintf(stderr, "Cannot start the Secret Service: %s\n",
+                         error.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+#endif
+
+    std::unique_ptr<Target> target = makeTarget(options);
+    if (!target) {
+        std::fprintf(stderr, "Unknown backend: %s\n", options.backend.c_str());
+        return EXIT_FAILURE;
+    }
+
+    const std::string secret(options.secretSize, 's');
+    keychain::Error err;
+    for (std::size_t i = 0; i < options.keys; ++i) {
+        target->set(keyOf(i), secret, err);
+        if (err) {
+            std::fprintf(stderr, "Cannot store a password: %s\n",
+                         err.message.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    const KeyChooser chooser(options.keys, options.zipf);
+    std::vector<WorkerResult> results(options.threads);
+    std::vector<std::thread> workers;
+    const auto start = Clock::now() + std::chrono::milliseconds(10);
+    for (std::size_t t = 0; t < options.threads; ++t) {
+        workers.emplace_back(work,
+                             std::ref(*target),
+                             std::cref(options),
+                             std::cref(chooser),
+                             std::cref(secret),
+                             t,
+                             start,
+                             std::ref(results[t]));
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    WorkerResult total;
+    for (const auto &result : results) {
+        for (int op = 0; op < OperationCount; ++op) {
+            total.latency[op].add(result.latency[op]);
+            total.errors[op] += result.errors[op];
+            total.notFound[op] += result.notFound[op];
+        }
+        total.maxLag = std::max(total.maxLag, result.maxLag);
+    }
+    printResults(options, total, options.duration);
+
+    for (std::size_t i = 0; i < options.keys; ++i) {
+        target->remove(keyOf(i), err);
+    }
+    return EXIT_SUCCESS;
+}
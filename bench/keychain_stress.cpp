@@ -0,0 +1,950 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* keychain-stress runs get, set and delete from several threads in several
+ * processes at once, to find races and leaks that the single-threaded tests
+ * cannot show.
+ *
+ * Each worker thread owns some keys and shares others with all threads of all
+ * processes. A read of an own key must return what the thread wrote last
+ * (read-your-writes). A read of a shared key must return nothing or an intact
+ * value, and never a value older than one the thread already saw from the
+ * same writer for that key.
+ *
+ * The run is split into phases, one per entry of the thread list, so that the
+ * report shows how throughput scales with the number of threads. Each process
+ * samples its resident memory and, on Linux, its number of live GObjects. The
+ * values at the end of the first and of the last phase, when no operation is
+ * in flight, are compared to detect leaks.
+ */
+
+#include "keychain/keychain.h"
+
+#ifdef KEYCHAIN_LINUX
+#include "secret_service_fixture.h"
+
+#include <glib-object.h>
+#endif
+
+#ifdef KEYCHAIN_MACOS
+#include <mach/mach.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+// the phases of all processes are scheduled on the same clock
+using Clock = std::chrono::system_clock;
+
+const char *const Package = "com.example.keychain-stress";
+const char *const Service = "stress";
+
+// time between phases for stragglers to finish and for sampling
+constexpr auto PhaseGap = std::chrono::seconds(1);
+
+// time for the worker processes to start up
+constexpr auto StartupDelay = std::chrono::seconds(1);
+
+// violations reported in detail, per process
+constexpr int MaxReportedViolations = 10;
+
+enum Operation { Get, Set, Delete, OperationCount };
+
+const char *const OperationNames[OperationCount] = {"get", "set", "delete"};
+
+struct Options {
+    std::vector<std::size_t> threads{1, 2, 4, 8};
+    std::size_t processes = 1;
+    double duration = 10; // seconds per phase
+    std::array<double, OperationCount> mix{{60, 30, 10}};
+    std::size_t keys = 16;       // per thread
+    std::size_t sharedKeys = 16; // shared by all threads of all processes
+    double shared = 50;          // percent of operations on shared keys
+    double sampleInterval = 1;
+    std::string csv;
+    long long maxObjectGrowth = 0;
+    double maxRssGrowth = -1; // MiB, unlimited if negative
+    bool hermetic = false;
+    std::vector<std::string> service;
+
+    // for worker processes only
+    long worker = -1;
+    long long startAt = 0; // milliseconds since the epoch
+};
+
+Clock::duration toDuration(double seconds) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(seconds));
+}
+
+std::size_t residentBytes() {
+#if defined(KEYCHAIN_LINUX)
+    long pages = 0;
+    if (std::FILE *statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        std::fclose(statm);
+    }
+    return static_cast<std::size_t>(pages) * sysconf(_SC_PAGESIZE);
+#elif defined(KEYCHAIN_MACOS)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(),
+                  MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info),
+                  &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+#else
+    return 0;
+#endif
+}
+
+#ifdef KEYCHAIN_LINUX
+long long countInstances(GType type) {
+    long long count = g_type_get_instance_count(type);
+    guint size = 0;
+    GType *children = g_type_children(type, &size);
+    for (guint i = 0; i < size; ++i) {
+        count += countInstances(children[i]);
+    }
+    g_free(children);
+    return count;
+}
+#endif
+
+//! \brief The number of live GObjects, or -1 if they are not counted
+long long liveObjects() {
+#ifdef KEYCHAIN_LINUX
+    // GLib only counts them with GOBJECT_DEBUG=instance-count
+    const char *debug = std::getenv("GOBJECT_DEBUG");
+    if (debug != nullptr && std::strstr(debug, "instance-count") != nullptr) {
+        return countInstances(G_TYPE_OBJECT);
+    }
+#endif
+    return -1;
+}
+
+//! \brief Prints a sample of the process's memory periodically
+class Sampler {
+  public:
+    Sampler(Clock::time_point start, double interval)
+        : _thread([this, start, interval] { run(start, interval); }) {}
+
+    ~Sampler() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _wakeup.notify_one();
+        _thread.join();
+    }
+
+    static void print(Clock::time_point start) {
+        std::printf("sample %.3f %zu %lld\n",
+                    std::chrono::duration<double>(Clock::now() - start).count(),
+                    residentBytes(),
+                    liveObjects());
+        std::fflush(stdout);
+    }
+
+  private:
+    void run(Clock::time_point start, double interval) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto next = start;
+        while (!_wakeup.wait_until(lock, next, [this] { return _stopped; })) {
+            print(start);
+            next += toDuration(interval);
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    bool _stopped = false;
+    std::thread _thread; // last, it uses the members above
+};
+
+std::uint32_t checksum(const char *data, std::size_t size) {
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//! \brief A password identifying its writer, with a checksum
+std::string makeValue(long process, std::size_t slot,
+                      std::uint64_t sequence) {
+    char value[96];
+    const int size = std::snprintf(
+        value, sizeof(value), "%ld:%zu:%" PRIu64, process, slot, sequence);
+    std::snprintf(value + size,
+                  sizeof(value) - size,
+                  ":%08" PRIx32,
+                  checksum(value, size));
+    return value;
+}
+
+//! \brief Parse a value made by makeValue, false if it is not intact
+bool parseValue(const std::string &value, long &process, std::size_t &slot,
+                std::uint64_t &sequence) {
+    unsigned long long number = 0;
+    if (std::sscanf(value.c_str(), "%ld:%zu:%llu", &process, &slot, &number) !=
+        3) {
+        return false;
+    }
+    sequence = number;
+    return value == makeValue(process, slot, sequence);
+}
+
+//! \brief What a thread last did to one of its own keys
+struct Expected {
+    bool known = false; // false until the key's state was observed
+    bool present = false;
+    std::string value;
+};
+
+//! \brief A worker thread's state, kept across phases
+struct Slot {
+    std::vector<keychain::Key> own;
+    std::vector<Expected> expected;
+    std::uint64_t sequence = 0;
+    // the latest sequence number seen per shared key and writer
+    std::map<std::tuple<std::size_t, long, std::size_t>, std::uint64_t> seen;
+    std::mt19937_64 random;
+};
+
+struct Counts {
+    std::uint64_t operations = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t violations = 0;
+};
+
+class Worker {
+  public:
+    Worker(const Options &options, long process)
+        : _options(options), _process(process), _slots(maxThreads(options)) {
+        for (std::size_t k = 0; k < options.sharedKeys; ++k) {
+            _shared.emplace_back(
+                Package, Service, "shared-" + std::to_string(k));
+        }
+        for (std::size_t index = 0; index < _slots.size(); ++index) {
+            Slot &slot = _slots[index];
+            for (std::size_t k = 0; k < options.keys; ++k) {
+                slot.own.emplace_back(Package,
+                                      Service,
+                                      "p" + std::to_string(process) + "-t" +
+                                          std::to_string(index) + "-k" +
+                                          std::to_string(k));
+            }
+            slot.expected.resize(options.keys);
+            slot.random.seed((static_cast<std::uint64_t>(process) << 32) +
+                             index + 1);
+        }
+    }
+
+    //! \brief Run the phases, printing their results
+    void run(Clock::time_point start) {
+        Sampler sampler(start, _options.sampleInterval);
+
+        auto phaseStart = start;
+        for (std::size_t phase = 0; phase < _options.threads.size(); ++phase) {
+            std::this_thread::sleep_until(phaseStart);
+            const std::size_t threads = _options.threads[phase];
+            const auto began = Clock::now();
+            const auto end = phaseStart + toDuration(_options.duration);
+
+            std::vector<Counts> counts(threads);
+            std::vector<std::thread> workers;
+            for (std::size_t index = 0; index < threads; ++index) {
+                workers.emplace_back(
+                    &Worker::work, this, index, end, std::ref(counts[index]));
+            }
+            for (auto &worker : workers) {
+                worker.join();
+            }
+
+            const double elapsed =
+                std::chrono::duration<double>(Clock::now() - began).count();
+            Counts total;
+            for (const Counts &count : counts) {
+                total.operations += count.operations;
+                total.errors += count.errors;
+                total.violations += count.violations;
+            }
+            // nothing is in flight, so the values are comparable
+            std::printf("phase %zu %zu %" PRIu64 " %" PRIu64 " %" PRIu64
+                        " %.6f %zu %lld\n",
+                        phase,
+                        threads,
+                        total.operations,
+                        total.errors,
+                        total.violations,
+                        elapsed,
+                        residentBytes(),
+                        liveObjects());
+            std::fflush(stdout);
+
+            phaseStart = end + PhaseGap;
+        }
+    }
+
+    void cleanUp() {
+        keychain::Error err;
+        for (const Slot &slot : _slots) {
+            for (const auto &key : slot.own) {
+                keychain::deletePassword(key, err);
+            }
+        }
+        if (_process == 0) {
+            for (const auto &key : _shared) {
+                keychain::deletePassword(key, err);
+            }
+        }
+    }
+
+  private:
+    static std::size_t maxThreads(const Options &options) {
+        return *std::max_element(options.threads.begin(),
+                                 options.threads.end());
+    }
+
+    void work(std::size_t index, Clock::time_point end, Counts &counts) {
+        Slot &slot = _slots[index];
+        std::discrete_distribution<int> pickOperation(_options.mix.begin(),
+                                                      _options.mix.end());
+        std::bernoulli_distribution pickShared(_options.shared / 100);
+
+        while (Clock::now() < end) {
+            const int operation = pickOperation(slot.random);
+            if (_options.sharedKeys > 0 && pickShared(slot.random)) {
+                const auto k = std::uniform_int_distribution<std::size_t>(
+                    0, _options.sharedKeys - 1)(slot.random);
+                runShared(operation, index, k, counts);
+            } else {
+                const auto k = std::uniform_int_distribution<std::size_t>(
+                    0, _options.keys - 1)(slot.random);
+                runOwn(operation, index, k, counts);
+            }
+            ++counts.operations;
+        }
+    }
+
+    void runOwn(int operation, std::size_t index, std::size_t k,
+                Counts &counts) {
+        Slot &slot = _slots[index];
+        const keychain::Key &key = slot.own[k];
+        Expected &expected = slot.expected[k];
+        keychain::Error err;
+
+        if (operation == Get) {
+            const std::string value = keychain::getPassword(key, err);
+            if (err && err.type != keychain::ErrorType::NotFound) {
+                ++counts.errors;
+                return;
+            }
+            const bool present = !err;
+            if (expected.known &&
+                (present != expected.present ||
+                 (present && value != expected.value))) {
+                violation(counts,
+                          index,
+                          "get",
+                          key,
+                          present ? value : "not found",
+                          expected.present ? expected.value : "not found");
+            }
+            expected.known = true;
+            expected.present = present;
+            expected.value = value;
+        } else if (operation == Set) {
+            const std::string value =
+                makeValue(_process, index, ++slot.sequence);
+            keychain::setPassword(key, value, err);
+            if (err) {
+                ++counts.errors;
+                expected.known = false; // it may have been stored anyway
+                return;
+            }
+            expected.known = true;
+            expected.present = true;
+            expected.value = value;
+        } else {
+            keychain::deletePassword(key, err);
+            if (err && err.type != keychain::ErrorType::NotFound) {
+                ++counts.errors;
+                expected.known = false;
+                return;
+            }
+            const bool deleted = !err;
+            if (expected.known && deleted != expected.present) {
+                violation(counts,
+                          index,
+                          "delete",
+                          key,
+                          deleted ? "deleted" : "not found",
+                          expected.present ? "deleted" : "not found");
+            }
+            expected.known = true;
+            expected.present = false;
+            expected.value.clear();
+        }
+    }
+
+    void runShared(int operation, std::size_t index, std::size_t k,
+                   Counts &counts) {
+        Slot &slot = _slots[index];
+        const keychain::Key &key = _shared[k];
+        keychain::Error err;
+
+        if (operation == Get) {
+            const std::string value = keychain::getPassword(key, err);
+            if (err.type == keychain::ErrorType::NotFound) {
+                return;
+            } else if (err) {
+                ++counts.errors;
+                return;
+            }
+            long process = 0;
+            std::size_t writer = 0;
+            std::uint64_t sequence = 0;
+            if (!parseValue(value, process, writer, sequence)) {
+                violation(counts, index, "get", key, value, "an intact value");
+                return;
+            }
+            std::uint64_t &latest =
+                slot.seen[std::make_tuple(k, process, writer)];
+            if (sequence < latest) {
+                violation(counts,
+                          index,
+                          "get",
+                          key,
+                          value,
+                          makeValue(process, writer, latest) + " or newer");
+            } else {
+                latest = sequence;
+            }
+        } else if (operation == Set) {
+            const std::uint64_t sequence = ++slot.sequence;
+            keychain::setPassword(
+                key, makeValue(_process, index, sequence), err);
+            if (err) {
+                ++counts.errors;
+                return;
+            }
+            // the thread's own older writes must not reappear either
+            slot.seen[std::make_tuple(k, _process, index)] = sequence;
+        } else {
+            keychain::deletePassword(key, err);
+            if (err && err.type != keychain::ErrorType::NotFound) {
+                ++counts.errors;
+            }
+        }
+    }
+
+    void violation(Counts &counts, std::size_t index, const char *operation,
+                   const keychain::Key &key, const std::string &actual,
+                   const std::string &expected) {
+        ++counts.violations;
+        if (_reported++ < MaxReportedViolations) {
+            std::fprintf(stderr,
+                         "process %ld, thread %zu: %s of %s returned %s, "
+                         "expected %s\n",
+                         _process,
+                         index,
+                         operation,
+                         key.user().c_str(),
+                         actual.c_str(),
+                         expected.c_str());
+        }
+    }
+
+    const Options &_options;
+    const long _process;
+    std::vector<keychain::Key> _shared;
+    std::vector<Slot> _slots;
+    std::atomic<int> _reported{0};
+};
+
+//! \brief A phase's results as printed by one worker process
+struct PhaseResult {
+    std::size_t threads = 0;
+    std::uint64_t operations = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t violations = 0;
+    double elapsed = 0;
+    std::size_t resident = 0;
+    long long objects = -1;
+};
+
+struct Sample {
+    double seconds;
+    std::size_t resident;
+    long long objects;
+};
+
+struct Process {
+    pid_t pid = -1;
+    int output = -1;
+    std::string buffer;
+    std::vector<PhaseResult> phases;
+    std::vector<Sample> samples;
+    int status = 0;
+};
+
+void parseLine(const std::string &line, Process &process) {
+    PhaseResult phase;
+    std::size_t index = 0;
+    unsigned long long operations = 0;
+    unsigned long long errors = 0;
+    unsigned long long violations = 0;
+    Sample sample{};
+    if (std::sscanf(line.c_str(),
+                    "phase %zu %zu %llu %llu %llu %lf %zu %lld",
+                    &index,
+                    &phase.threads,
+                    &operations,
+                    &errors,
+                    &violations,
+                    &phase.elapsed,
+                    &phase.resident,
+                    &phase.objects) == 8) {
+        phase.operations = operations;
+        phase.errors = errors;
+        phase.violations = violations;
+        process.phases.push_back(phase);
+    } else if (std::sscanf(line.c_str(),
+                           "sample %lf %zu %lld",
+                           &sample.seconds,
+                           &sample.resident,
+                           &sample.objects) == 3) {
+        process.samples.push_back(sample);
+    }
+}
+
+//! \brief Read the output of all processes until they close it
+void collect(std::vector<Process> &processes) {
+    std::size_t open = processes.size();
+    while (open > 0) {
+        std::vector<pollfd> fds;
+        for (const Process &process : processes) {
+            fds.push_back(pollfd{process.output, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            std::perror("poll");
+            return;
+        }
+
+        for (std::size_t i = 0; i < processes.size(); ++i) {
+            Process &process = processes[i];
+            if (process.output < 0 || fds[i].revents == 0) {
+                continue;
+            }
+            char buffer[4096];
+            const ssize_t size = read(process.output, buffer, sizeof(buffer));
+            if (size <= 0) {
+                close(process.output);
+                process.output = -1;
+                --open;
+                continue;
+            }
+            process.buffer.append(buffer, size);
+            std::size_t newline;
+            while ((newline = process.buffer.find('\n')) != std::string::npos) {
+                parseLine(process.buffer.substr(0, newline), process);
+                process.buffer.erase(0, newline + 1);
+            }
+        }
+    }
+}
+
+bool spawnWorker(char *argv[], int argc, long index, long long startAt,
+                 Process &process) {
+    std::vector<std::string> args(argv, argv + argc);
+    args.push_back("--worker");
+    args.push_back(std::to_string(index));
+    args.push_back("--start-at");
+    args.push_back(std::to_string(startAt));
+    std::vector<char *> workerArgv;
+    for (auto &arg : args) {
+        workerArgv.push_back(&arg[0]);
+    }
+    workerArgv.push_back(nullptr);
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        return false;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    const int rc = posix_spawnp(
+        &process.pid, argv[0], &actions, nullptr, workerArgv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (rc != 0) {
+        std::fprintf(stderr, "Cannot start %s: %s\n", argv[0], strerror(rc));
+        close(fds[0]);
+        return false;
+    }
+    process.output = fds[0];
+    return true;
+}
+
+void writeCsv(const std::string &path, const std::vector<Process> &processes) {
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+        return;
+    }
+    std::fprintf(file, "process,seconds,resident_bytes,gobjects\n");
+    for (std::size_t p = 0; p < processes.size(); ++p) {
+        for (const Sample &sample : processes[p].samples) {
+            std::fprintf(file,
+                         "%zu,%.3f,%zu,%lld\n",
+                         p,
+                         sample.seconds,
+                         sample.resident,
+                         sample.objects);
+        }
+    }
+    std::fclose(file);
+}
+
+//! \brief Print the results, returning false if the run failed
+bool report(const Options &options, const std::vector<Process> &processes) {
+    bool passed = true;
+    for (std::size_t p = 0; p < processes.size(); ++p) {
+        const Process &process = processes[p];
+        if (!WIFEXITED(process.status) ||
+            WEXITSTATUS(process.status) != EXIT_SUCCESS ||
+            process.phases.size() != options.threads.size()) {
+            std::fprintf(stderr, "Process %zu failed\n", p);
+            return false;
+        }
+    }
+
+    std::printf("%5s %7s %9s %12s %8s %10s %8s %11s %10s\n",
+                "phase",
+                "threads",
+                "processes",
+                "operations/s",
+                "speedup",
+                "violations",
+                "errors",
+                "memory (MiB)",
+                "gobjects");
+    double baseline = 0;
+    for (std::size_t phase = 0; phase < options.threads.size(); ++phase) {
+        PhaseResult total;
+        total.objects = 0;
+        double throughput = 0;
+        for (const Process &process : processes) {
+            const PhaseResult &result = process.phases[phase];
+            throughput += result.operations / result.elapsed;
+            total.errors += result.errors;
+            total.violations += result.violations;
+            total.resident += result.resident;
+            total.objects = result.objects < 0 || total.objects < 0
+                                ? -1
+                                : total.objects + result.objects;
+        }
+        if (phase == 0) {
+            baseline = throughput;
+        }
+        std::printf("%5zu %7zu %9zu %12.1f %7.2fx %10" PRIu64 " %8" PRIu64
+                    " %11.1f %10s\n",
+                    phase,
+                    options.threads[phase],
+                    processes.size(),
+                    throughput,
+                    baseline > 0 ? throughput / baseline : 0,
+                    total.violations,
+                    total.errors,
+                    total.resident / (1024.0 * 1024.0),
+                    total.objects < 0 ? "n/a"
+                                      : std::to_string(total.objects).c_str());
+        passed = passed && total.violations == 0;
+    }
+
+    // growth from the end of the first phase, when all connections and
+    // caches are set up, to the end of the last one
+    std::printf("\n");
+    for (std::size_t p = 0; p < processes.size(); ++p) {
+        const PhaseResult &first = processes[p].phases.front();
+        const PhaseResult &last = processes[p].phases.back();
+        const double rssGrowth =
+            (static_cast<double>(last.resident) - first.resident) /
+            (1024.0 * 1024.0);
+        const long long objectGrowth = last.objects - first.objects;
+        std::printf("process %zu: memory %+.1f MiB", p, rssGrowth);
+        if (first.objects >= 0) {
+            std::printf(", gobjects %+lld", objectGrowth);
+        }
+        std::printf(" since the first phase\n");
+
+        if (first.objects >= 0 && objectGrowth > options.maxObjectGrowth) {
+            std::printf("process %zu: gobjects grew by more than %lld\n",
+                        p,
+                        options.maxObjectGrowth);
+            passed = false;
+        }
+        if (options.maxRssGrowth >= 0 && rssGrowth > options.maxRssGrowth) {
+            std::printf("process %zu: memory grew by more than %.1f MiB\n",
+                        p,
+                        options.maxRssGrowth);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+bool parseList(const std::string &arg, std::vector<std::size_t> &list) {
+    list.clear();
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        const std::size_t value = std::strtoul(item.c_str(), nullptr, 10);
+        if (value == 0) {
+            return false;
+        }
+        list.push_back(value);
+    }
+    return !list.empty();
+}
+
+bool parseMix(const std::string &arg,
+              std::array<double, OperationCount> &mix) {
+    mix.fill(0);
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        const auto separator = item.find('=');
+        const std::string name = item.substr(0, separator);
+        const auto it = std::find(
+            std::begin(OperationNames), std::end(OperationNames), name);
+        if (separator == std::string::npos || it == std::end(OperationNames)) {
+            return false;
+        }
+        mix[it - std::begin(OperationNames)] =
+            std::strtod(item.c_str() + separator + 1, nullptr);
+    }
+    return mix[Get] + mix[Set] + mix[Delete] > 0;
+}
+
+void printUsage(const char *program) {
+    std::fprintf(
+        stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  --threads N,...       thread counts, one phase each "
+        "(default 1,2,4,8)\n"
+        "  --processes N         processes running the phases at once "
+        "(default 1)\n"
+        "  --duration S          seconds per phase (default 10)\n"
+        "  --mix get=N,...       weights of get, set and delete "
+        "(default get=60,set=30,delete=10)\n"
+        "  --keys N              own keys per thread (default 16)\n"
+        "  --shared-keys N       keys shared by all threads (default 16)\n"
+        "  --shared P            percent of operations on shared keys "
+        "(default 50)\n"
+        "  --sample-interval S   seconds between memory samples "
+        "(default 1)\n"
+        "  --csv PATH            write the memory samples to PATH\n"
+        "  --max-object-growth N fail if a process's live GObjects grow by "
+        "more\n"
+        "                        than N between the first and last phase "
+        "(Linux,\n"
+        "                        default 0)\n"
+        "  --max-rss-growth MIB  fail if a process's resident memory grows "
+        "by more\n"
+        "                        than MIB between the first and last phase\n"
+        "  --private             use a private gnome-keyring-daemon (Linux)\n"
+        "  --service COMMAND     use a private COMMAND as Secret Service "
+        "(Linux)\n"
+        "\n"
+        "For a soak test, repeat a thread count, e.g. --threads 8,8,8,8 "
+        "--duration 600.\n",
+        program);
+}
+
+bool parseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+        const bool hasValue = value != nullptr;
+        if (arg == "--private") {
+            options.hermetic = true;
+        } else if (!hasValue) {
+            return false;
+        } else if (arg == "--threads") {
+            if (!parseList(argv[++i], options.threads)) {
+                return false;
+            }
+        } else if (arg == "--processes") {
+            options.processes = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--duration") {
+            options.duration = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--mix") {
+            if (!parseMix(argv[++i], options.mix)) {
+                return false;
+            }
+        } else if (arg == "--keys") {
+            options.keys = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--shared-keys") {
+            options.sharedKeys = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--shared") {
+            options.shared = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--sample-interval") {
+            options.sampleInterval = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--csv") {
+            options.csv = argv[++i];
+        } else if (arg == "--max-object-growth") {
+            options.maxObjectGrowth = std::strtoll(argv[++i], nullptr, 10);
+        } else if (arg == "--max-rss-growth") {
+            options.maxRssGrowth = std::strtod(argv[++i], nullptr);
+        } else if (arg == "--service") {
+            std::stringstream command(argv[++i]);
+            std::string word;
+            while (command >> word) {
+                options.service.push_back(word);
+            }
+            options.hermetic = true;
+        } else if (arg == "--worker") {
+            options.worker = std::strtol(argv[++i], nullptr, 10);
+        } else if (arg == "--start-at") {
+            options.startAt = std::strtoll(argv[++i], nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return options.processes > 0 && options.duration > 0 &&
+           options.keys > 0 && options.shared >= 0 && options.shared <= 100 &&
+           options.sampleInterval > 0;
+}
+
+int runWorker(const Options &options) {
+    const Clock::time_point start{std::chrono::milliseconds(options.startAt)};
+    Worker worker(options, options.worker);
+    worker.run(start);
+    worker.cleanUp();
+    return EXIT_SUCCESS;
+}
+
+int runProcesses(const Options &options, int argc, char *argv[]) {
+    // makes GLib count the live instances of each type in the workers
+    std::string debug = "instance-count";
+    if (const char *value = std::getenv("GOBJECT_DEBUG")) {
+        debug = std::string(value) + "," + debug;
+    }
+    setenv("GOBJECT_DEBUG", debug.c_str(), 1);
+
+    const auto start = Clock::now() + StartupDelay;
+    const long long startAt =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            start.time_since_epoch())
+            .count();
+
+    std::vector<Process> processes(options.processes);
+    bool started = true;
+    for (std::size_t p = 0; p < processes.size() && started; ++p) {
+        started = spawnWorker(argv, argc, p, startAt, processes[p]);
+    }
+    collect(processes);
+    for (Process &process : processes) {
+        if (process.pid > 0) {
+            waitpid(process.pid, &process.status, 0);
+        }
+    }
+    if (!started) {
+        return EXIT_FAILURE;
+    }
+
+    if (!options.csv.empty()) {
+        writeCsv(options.csv, processes);
+    }
+    return report(options, processes) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (options.worker >= 0) {
+        return runWorker(options);
+    }
+
+#ifdef KEYCHAIN_LINUX
+    std::unique_ptr<SecretServiceFixture> fixture;
+    if (options.hermetic) {
+        fixture.reset(new SecretServiceFixture(options.service));
+        std::string error;
+        if (!fixture->start(error)) {
+            std::fprintf(stderr, "Cannot start the Secret Service: %s\n",
+                         error.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+#endif
+
+    return runProcesses(options, argc, argv);
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "secret_service_fixture.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <ftw.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+extern char **environ;
+
+namespace {
+
+const char *const BusConfig =
+    "<!DOCTYPE busconfig PUBLIC "
+    "\"-//freedesktop//DTD D-Bus Bus Configuration 1.0//EN\"\n"
+    " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+    "<busconfig>\n"
+    "  <type>session</type>\n"
+    "  <listen>unix:path=%s/bus</listen>\n"
+    "  <policy context=\"default\">\n"
+    "    <allow send_destination=\"*\" eavesdrop=\"true\"/>\n"
+    "    <allow eavesdrop=\"true\"/>\n"
+    "    <allow own=\"*\"/>\n"
+    "  </policy>\n"
+    "</busconfig>\n";
+
+// the password of the fixture's login keyring
+const char *const KeyringPassword = "keychain-bench";
+
+constexpr auto StartupTimeout = std::chrono::seconds(10);
+
+//! \brief Spawn argv with envp, feeding input to its stdin if not null
+pid_t spawn(const std::vector<std::string> &args, char **envp,
+            const char *input, std::string &error) {
+    std::vector<char *> argv;
+    for (const auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    int fds[2] = {-1, -1};
+    // stdout is reserved for the benchmark's results
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, STDERR_FILENO, STDOUT_FILENO);
+    if (input) {
+        if (pipe(fds) != 0) {
+            error = "Cannot create a pipe: " +
+                    std::string(std::strerror(errno));
+            posix_spawn_file_actions_destroy(&actions);
+            return -1;
+        }
+        posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+    }
+
+    pid_t pid = -1;
+    const int rc =
+        posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), envp);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (input) {
+        close(fds[0]);
+        if (rc == 0 &&
+            write(fds[1], input, std::strlen(input)) < 0) { // best effort
+            std::perror("write");
+        }
+        close(fds[1]);
+    }
+
+    if (rc != 0) {
+        error = "Cannot start " + args[0] + ": " + std::strerror(rc);
+        return -1;
+    }
+    return pid;
+}
+
+void terminate(pid_t &pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+}
+
+int removeEntry(const char *path, const struct stat *, int, struct FTW *) {
+    return std::remove(path);
+}
+
+//! \brief Connect to the bus at address once it is listening
+GDBusConnection *connect(const std::string &address,
+                         std::chrono::steady_clock::time_point deadline,
+                         std::string &error) {
+    GError *gerror = nullptr;
+    for (;;) {
+        GDBusConnection *connection = g_dbus_connection_new_for_address_sync(
+            address.c_str(),
+            static_cast<GDBusConnectionFlags>(
+                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+            nullptr,
+            nullptr,
+            &gerror);
+        if (connection) {
+            return connection;
+        } else if (std::chrono::steady_clock::now() >= deadline) {
+            error = "Cannot connect to " + address + ": " + gerror->message;
+            g_error_free(gerror);
+            return nullptr;
+        }
+        g_clear_error(&gerror);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+}
+
+//! \brief Wait until name is owned on the bus
+bool waitForName(GDBusConnection *connection, const char *name,
+                 std::chrono::steady_clock::time_point deadline,
+                 std::string &error) {
+    GError *gerror = nullptr;
+    while (std::chrono::steady_clock::now() < deadline) {
+        GVariant *reply =
+            g_dbus_connection_call_sync(connection,
+                                        "org.freedesktop.DBus",
+                                        "/org/freedesktop/DBus",
+                                        "org.freedesktop.DBus",
+                                        "NameHasOwner",
+                                        g_variant_new("(s)", name),
+                                        G_VARIANT_TYPE("(b)"),
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        nullptr,
+                                        &gerror);
+        g_clear_error(&gerror);
+
+        gboolean owned = FALSE;
+        if (reply) {
+            g_variant_get(reply, "(b)", &owned);
+            g_variant_unref(reply);
+        }
+        if (owned) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    error = std::string("Timed out waiting for ") + name;
+    return false;
+}
+
+} // namespace
+
+SecretServiceFixture::SecretServiceFixture(std::vector<std::string> command)
+    : _command(std::move(command)) {}
+
+SecretServiceFixture::~SecretServiceFixture() { stop(); }
+
+bool SecretServiceFixture::start(std::string &error) {
+    char directory[] = "/tmp/keychain-bench-XXXXXX";
+    if (!mkdtemp(directory)) {
+        error = "Cannot create a temporary directory: " +
+                std::string(std::strerror(errno));
+        return false;
+    }
+    _directory = directory;
+    _address = "unix:path=" + _directory + "/bus";
+
+    const std::string configPath = _directory + "/bus.conf";
+    {
+        std::vector<char> config(std::strlen(BusConfig) + _directory.size());
+        std::snprintf(config.data(),
+                      config.size(),
+                      BusConfig,
+                      _directory.c_str());
+        std::ofstream(configPath) << config.data();
+    }
+
+    _busPid = spawn({"dbus-daemon", "--nofork", "--config-file=" + configPath},
+                    environ,
+                    nullptr,
+                    error);
+    if (_busPid < 0) {
+        return false;
+    }
+
+    // the keyring daemon needs the bus to be listening already
+    const auto deadline = std::chrono::steady_clock::now() + StartupTimeout;
+    GDBusConnection *connection = connect(_address, deadline, error);
+    if (!connection) {
+        return false;
+    }
+
+    // keep gnome-keyring away from the user's keyrings and session
+    setenv("DBUS_SESSION_BUS_ADDRESS", _address.c_str(), 1);
+    std::vector<std::string> variables;
+    for (char **variable = environ; *variable; ++variable) {
+        const std::string entry = *variable;
+        if (entry.compare(0, 5, "HOME=") != 0 &&
+            entry.compare(0, 14, "XDG_DATA_HOME=") != 0 &&
+            entry.compare(0, 16, "XDG_RUNTIME_DIR=") != 0) {
+            variables.push_back(entry);
+        }
+    }
+    variables.push_back("HOME=" + _directory);
+    variables.push_back("XDG_DATA_HOME=" + _directory + "/data");
+    variables.push_back("XDG_RUNTIME_DIR=" + _directory);
+
+    std::vector<char *> envp;
+    for (auto &variable : variables) {
+        envp.push_back(&variable[0]);
+    }
+    envp.push_back(nullptr);
+
+    if (_command.empty()) {
+        _keyringPid = spawn({"gnome-keyring-daemon",
+                             "--foreground",
+                             "--unlock",
+                             "--components=secrets"},
+                            envp.data(),
+                            KeyringPassword,
+                            error);
+    } else {
+        _keyringPid = spawn(_command, envp.data(), nullptr, error);
+    }
+    const bool started =
+        _keyringPid > 0 &&
+        waitForName(connection, "org.freedesktop.secrets", deadline, error);
+    g_object_unref(connection);
+    return started;
+}
+
+void SecretServiceFixture::stop() {
+    terminate(_keyringPid);
+    terminate(_busPid);
+    if (!_directory.empty()) {
+        nftw(_directory.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+        _directory.clear();
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_BENCH_SECRET_SERVICE_FIXTURE_H_
+#define XPLATFORM_KEYCHAIN_BENCH_SECRET_SERVICE_FIXTURE_H_
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+/*! \brief A private Secret Service for benchmarks
+ *
+ * Runs a dbus-daemon and gnome-keyring-daemon of its own in a temporary
+ * directory, with an unlocked login keyring, and points
+ * DBUS_SESSION_BUS_ADDRESS of this process at the private bus. Results thus
+ * do not depend on the user's session, their keyring's contents or on
+ * whether it is unlocked. Another implementation of the Secret Service, such
+ * as test/mock_secret_service.cpp, can be run instead of gnome-keyring.
+ *
+ * Must be started before the first keychain operation of the process. Both
+ * daemons are stopped and the directory is removed on destruction.
+ */
+class SecretServiceFixture {
+  public:
+    //! \brief Use gnome-keyring-daemon
+    SecretServiceFixture() = default;
+
+    //! \brief Run `command` instead of gnome-keyring-daemon
+    explicit SecretServiceFixture(std::vector<std::string> command);
+
+    ~SecretServiceFixture();
+
+    SecretServiceFixture(const SecretServiceFixture &) = delete;
+    SecretServiceFixture &operator=(const SecretServiceFixture &) = delete;
+
+    //! \brief Start the daemons, returning false with a message on failure
+    bool start(std::string &error);
+
+    const std::string &address() const { return _address; }
+
+  private:
+    void stop();
+
+    std::vector<std::string> _command;
+    std::string _directory;
+    std::string _address;
+    pid_t _busPid = -1;
+    pid_t _keyringPid = -1;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_AGENT_H_
+#define XPLATFORM_KEYCHAIN_AGENT_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "basic_keychain.h"
+#include "keychain.h"
+#include "stats.h"
+
+/*! \brief Access to the credentials storage through keychain-agent
+ *
+ * keychain-agent is a daemon holding a warm connection to the credentials
+ * storage and a cache of passwords. It serves requests over a Unix domain
+ * socket, and only to processes of its own user. A short-lived process thus
+ * retrieves a password with a single local round trip, instead of connecting
+ * to the storage and looking the password up itself.
+ *
+ * Not available on Windows.
+ */
+namespace keychain {
+
+/*! \brief A Backend forwarding operations to keychain-agent
+ *
+ * Each operation connects to the agent's socket, see agentSocketPath. If no
+ * agent is listening there, or the process listening does not run as the
+ * same user, the operation falls back to OsBackend. Metadata is not served by
+ * the agent, so getMetadata, getAllMetadata and isAvailable always use
+ * OsBackend.
+ */
+class AgentBackend {
+  public:
+    //! \brief Use the socket at agentSocketPath()
+    AgentBackend();
+    explicit AgentBackend(std::string socketPath);
+
+    std::string getPassword(const Key &key, Error &err);
+    void withPassword(const Key &key, PasswordViewCallback callback,
+                      void *context, Error &err);
+    void setPassword(const Key &key, const std::string &password, Error &err);
+    std::vector<unsigned char> getSecret(const Key &key, Error &err);
+    void setSecret(const Key &key, const unsigned char *data, std::size_t size,
+                   Error &err);
+    void deletePassword(const Key &key, Error &err);
+    bool hasPassword(const Key &key, Error &err);
+    Metadata getMetadata(const Key &key, Error &err);
+    std::vector<Metadata> getAllMetadata(const std::string &package,
+                                         Error &err);
+    bool isAvailable(Error &err);
+
+  private:
+    std::string _socketPath;
+};
+
+/*! \brief The path of keychain-agent's socket
+ *
+ * Taken from $KEYCHAIN_AGENT_SOCKET if set, otherwise keychain-agent.sock in
+ * $XDG_RUNTIME_DIR, or in /tmp/keychain-agent-<uid> if that is not set either.
+ */
+std::string agentSocketPath();
+
+//! \brief A keychain using keychain-agent, recording into stats()
+using AgentKeychain = BasicKeychain<AgentBackend,
+                                    NoCache,
+                                    StatsInstrumentation<StatsBackend::Agent>>;
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_ASYNC_H_
+#define XPLATFORM_KEYCHAIN_ASYNC_H_
+
+#include <functional>
+#include <string>
+
+#include "keychain.h"
+
+/*! \brief Asynchronous keychain operations
+ *
+ * These functions return immediately and invoke a callback once the operation
+ * has finished. On Linux, they are libsecret's asynchronous calls, dispatched
+ * on a single thread running a private GMainContext, so any number of them
+ * can be in flight at once. macOS and Windows lack an asynchronous API, so the
+ * operations are run one after the other on a single worker thread instead.
+ * Either way, no thread is parked per operation. The operations are recorded
+ * into stats(), traced and watched just like the free functions.
+ *
+ * The callback is invoked on that dispatching thread and thus must not block.
+ * See CompletionQueue for receiving the results on a thread of your own, and
+ * coroutine.h for awaiting them in C++20 coroutines.
+ */
+namespace keychain {
+
+/*! \brief Receives the result of an asynchronous operation
+ *
+ * The value is only set by getPasswordAsync.
+ */
+using AsyncCallback = std::function<void(std::string value, Error err)>;
+
+//! \brief Start keychain::getPassword
+void getPasswordAsync(const Key &key, AsyncCallback callback);
+
+//! \brief Start keychain::setPassword
+void setPasswordAsync(const Key &key, const std::string &password,
+                      AsyncCallback callback);
+
+//! \brief Start keychain::deletePassword
+void deletePasswordAsync(const Key &key, AsyncCallback callback);
+
+} // namespace keychain
+
+#endif
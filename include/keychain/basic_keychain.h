@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_BASIC_KEYCHAIN_H_
+#define XPLATFORM_KEYCHAIN_BASIC_KEYCHAIN_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "keychain.h"
+
+/*! \brief A keychain composed of compile-time policies
+ *
+ * `BasicKeychain<Backend, CachePolicy, Instrumentation>` provides the same
+ * operations as the free functions in keychain.h. Each operation is forwarded
+ * to the Backend, consulting the CachePolicy and reporting to the
+ * Instrumentation on the way. All policies are plain template parameters, so
+ * there is no virtual dispatch, and policies that do nothing (NoCache,
+ * NoInstrumentation) are inlined away entirely.
+ *
+ * The free functions are an instantiation of OsBackend without caching, which
+ * records into keychain::stats() (see stats.h). DefaultKeychain is the same
+ * without any instrumentation.
+ *
+ * A Backend provides the Key based operations of keychain.h as (possibly
+ * static) member functions:
+ *
+ *     std::string getPassword(const Key &, Error &);
+ *     void withPassword(const Key &, PasswordViewCallback, void *, Error &);
+ *     void setPassword(const Key &, const std::string &, Error &);
+ *     std::vector<unsigned char> getSecret(const Key &, Error &);
+ *     void setSecret(const Key &, const unsigned char *, std::size_t,
+ *                    Error &);
+ *     void deletePassword(const Key &, Error &);
+ *     bool hasPassword(const Key &, Error &);
+ *     Metadata getMetadata(const Key &, Error &);
+ *     std::vector<Metadata> getAllMetadata(const std::string &, Error &);
+ *     bool isAvailable(Error &);
+ *
+ * A CachePolicy caches passwords, see NoCache for the members it provides.
+ * An Instrumentation observes each operation, see NoInstrumentation.
+ */
+namespace keychain {
+
+//! \brief The operations of a keychain, as reported to an Instrumentation
+enum class Operation {
+    GetPassword = 0,
+    WithPassword,
+    SetPassword,
+    GetSecret,
+    SetSecret,
+    DeletePassword,
+    HasPassword,
+    GetMetadata,
+    GetAllMetadata,
+    IsAvailable,
+};
+
+//! \brief The number of values of Operation
+constexpr std::size_t OperationCount = 10;
+
+//! \brief The name of the function implementing an Operation
+inline const char *operationName(Operation operation) noexcept {
+    static const char *const names[OperationCount] = {
+        "getPassword",
+        "withPassword",
+        "setPassword",
+        "getSecret",
+        "setSecret",
+        "deletePassword",
+        "hasPassword",
+        "getMetadata",
+        "getAllMetadata",
+        "isAvailable",
+    };
+    return names[static_cast<std::size_t>(operation)];
+}
+
+namespace detail {
+
+//! \brief Whether service names an item holding a chunk, see chunked.h
+bool isChunkService(const std::string &service);
+
+} // namespace detail
+
+/*! \brief The backend calling into the operating system's credentials storage
+ *
+ * This is what the free functions of keychain.h use. It is implemented by each
+ * platform.
+ */
+struct OsBackend {
+    static std::string getPassword(const Key &key, Error &err);
+    static void withPassword(const Key &key, PasswordViewCallback callback,
+                             void *context, Error &err);
+    static void setPassword(const Key &key, const std::string &password,
+                            Error &err);
+    static std::vector<unsigned char> getSecret(const Key &key, Error &err);
+    static void setSecret(const Key &key, const unsigned char *data,
+                          std::size_t size, Error &err);
+    static void deletePassword(const Key &key, Error &err);
+    static bool hasPassword(const Key &key, Error &err);
+    static Metadata getMetadata(const Key &key, Error &err);
+    static std::vector<Metadata> getAllMetadata(const std::string &package,
+                                                Error &err);
+    static bool isAvailable(Error &err);
+};
+
+/*! \brief A CachePolicy that does not cache
+ *
+ * If `enabled` is false, BasicKeychain does not call any other member of the
+ * policy. Otherwise:
+ * - `lookup` assigns a cached password and returns true, or returns false if
+ *   there is none.
+ * - `store` is called with each password retrieved from the backend.
+ * - `invalidate` is called after each write to or deletion of a password,
+ *   whether successful or not.
+ *
+ * Only passwords are cached. Binary secrets and metadata are always retrieved
+ * from the backend.
+ */
+struct NoCache {
+    static constexpr bool enabled = false;
+
+    bool lookup(const Key &, std::string &) noexcept { return false; }
+    void store(const Key &, const std::string &) noexcept {}
+    void invalidate(const Key &) noexcept {}
+};
+
+/*! \brief A CachePolicy consulting a second cache if the first one misses
+ *
+ * Passwords found in L2 are stored in L1. Stores and invalidations go to
+ * both, so either cache alone never answers with a password that was changed
+ * through this keychain.
+ */
+template <typename L1, typename L2> class TieredCache {
+  public:
+    static constexpr bool enabled = true;
+
+    TieredCache() = default;
+    TieredCache(L1 l1, L2 l2) : _l1(std::move(l1)), _l2(std::move(l2)) {}
+
+    L1 &l1() noexcept { return _l1; }
+    L2 &l2() noexcept { return _l2; }
+
+    bool lookup(const Key &key, std::string &password) {
+        if (_l1.lookup(key, password)) {
+            return true;
+        } else if (_l2.lookup(key, password)) {
+            _l1.store(key, password);
+            return true;
+        }
+        return false;
+    }
+
+    void store(const Key &key, const std::string &password) {
+        _l1.store(key, password);
+        _l2.store(key, password);
+    }
+
+    void invalidate(const Key &key) {
+        // the shared tier first, so L1 cannot be refilled with a stale value
+        _l2.invalidate(key);
+        _l1.invalidate(key);
+    }
+
+  private:
+    L1 _l1;
+    L2 _l2;
+};
+
+/*! \brief An Instrumentation that does not observe anything
+ *
+ * `begin` is called before each operation, with the operation's key or a null
+ * pointer for operations not taking a key. The Span it returns is passed to
+ * `end` along with the operation's result once the operation has finished,
+ * including when it is answered from the cache. If a callback passed to
+ * withPassword throws, `end` is called with the Error as it was at that point.
+ */
+struct NoInstrumentation {
+    struct Span {};
+
+    Span begin(Operation, const Key *) noexcept { return Span{}; }
+    void end(const Span &, const Error &) noexcept {}
+};
+
+/*! \brief A keychain composed of a Backend, a CachePolicy and an
+ *         Instrumentation
+ *
+ * The policies are held by value. A BasicKeychain is as thread-safe as its
+ * policies are; OsBackend, NoCache and NoInstrumentation are stateless.
+ */
+template <typename Backend = OsBackend, typename CachePolicy = NoCache,
+          typename Instrumentation = NoInstrumentation>
+class BasicKeychain {
+  public:
+    BasicKeychain() = default;
+    BasicKeychain(Backend backend, CachePolicy cache,
+                  Instrumentation instrumentation)
+        : _backend(std::move(backend)), _cache(std::move(cache)),
+          _instrumentation(std::move(instrumentation)) {}
+
+    Backend &backend() noexcept { return _backend; }
+    CachePolicy &cache() noexcept { return _cache; }
+    Instrumentation &instrumentation() noexcept { return _instrumentation; }
+
+    //! \brief See keychain::getPassword
+    std::string getPassword(const Key &key, Error &err) {
+        Scope scope(_instrumentation, Operation::GetPassword, &key, err);
+        std::string password;
+        if (CachePolicy::enabled && _cache.lookup(key, password)) {
+            err = Error{};
+            return password;
+        }
+        password = _backend.getPassword(key, err);
+        if (CachePolicy::enabled && !err) {
+            _cache.store(key, password);
+        }
+        return password;
+    }
+
+    //! \brief See keychain::withPassword
+    void withPassword(const Key &key, PasswordViewCallback callback,
+                      void *context, Error &err) {
+        Scope scope(_instrumentation, Operation::WithPassword, &key, err);
+        if (!CachePolicy::enabled) {
+            _backend.withPassword(key, callback, context, err);
+            return;
+        }
+
+        std::string cached;
+        if (_cache.lookup(key, cached)) {
+            err = Error{};
+            callback(cached.data(), cached.size(), context);
+            return;
+        }
+
+        // populate the cache on the way to the caller's callback
+        struct Forward {
+            CachePolicy &cache;
+            const Key &key;
+            PasswordViewCallback callback;
+            void *context;
+        } forward{_cache, key, callback, context};
+
+        _backend.withPassword(
+            key,
+            [](const char *data, std::size_t size, void *forwardContext) {
+                auto &f = *static_cast<Forward *>(forwardContext);
+                f.cache.store(f.key, std::string(data, size));
+                f.callback(data, size, f.context);
+            },
+            &forward,
+            err);
+    }
+
+    //! \overload
+    template <typename Callback>
+    void withPassword(const Key &key, Callback &&callback, Error &err) {
+        using CallbackType = typename std::remove_reference<Callback>::type;
+        withPassword(
+            key,
+            [](const char *data, std::size_t size, void *context) {
+                (*static_cast<CallbackType *>(context))(data, size);
+            },
+            const_cast<void *>(static_cast<const void *>(&callback)),
+            err);
+    }
+
+    //! \brief See keychain::setPassword
+    void setPassword(const Key &key, const std::string &password, Error &err) {
+        Scope scope(_instrumentation, Operation::SetPassword, &key, err);
+        _backend.setPassword(key, password, err);
+        if (CachePolicy::enabled) {
+            _cache.invalidate(key);
+        }
+    }
+
+    //! \brief See keychain::getSecret
+    std::vector<unsigned char> getSecret(const Key &key, Error &err) {
+        Scope scope(_instrumentation, Operation::GetSecret, &key, err);
+        return _backend.getSecret(key, err);
+    }
+
+    //! \brief See keychain::setSecret
+    void setSecret(const Key &key, const unsigned char *data, std::size_t size,
+                   Error &err) {
+        Scope scope(_instrumentation, Operation::SetSecret, &key, err);
+        _backend.setSecret(key, data, size, err);
+        if (CachePolicy::enabled) {
+            _cache.invalidate(key);
+        }
+    }
+
+    //! \brief See keychain::deletePassword
+    void deletePassword(const Key &key, Error &err) {
+        Scope scope(_instrumentation, Operation::DeletePassword, &key, err);
+        _backend.deletePassword(key, err);
+        if (CachePolicy::enabled) {
+            _cache.invalidate(key);
+        }
+    }
+
+    //! \brief See keychain::hasPassword
+    bool hasPassword(const Key &key, Error &err) {
+        Scope scope(_instrumentation, Operation::HasPassword, &key, err);
+        std::string cached;
+        if (CachePolicy::enabled && _cache.lookup(key, cached)) {
+            err = Error{};
+            return true;
+        }
+        return _backend.hasPassword(key, err);
+    }
+
+    //! \brief See keychain::getMetadata
+    Metadata getMetadata(const Key &key, Error &err) {
+        Scope scope(_instrumentation, Operation::GetMetadata, &key, err);
+        return _backend.getMetadata(key, err);
+    }
+
+    //! \brief See keychain::getAllMetadata
+    std::vector<Metadata> getAllMetadata(const std::string &package,
+                                         Error &err) {
+        Scope scope(_instrumentation, Operation::GetAllMetadata, nullptr, err);
+        auto all = _backend.getAllMetadata(package, err);
+        // the chunks of chunked secrets are listed by their manifest only
+        all.erase(std::remove_if(all.begin(),
+                                 all.end(),
+                                 [](const Metadata &metadata) {
+                                     return detail::isChunkService(
+                                         metadata.service);
+                                 }),
+                  all.end());
+        return all;
+    }
+
+    //! \brief See keychain::isAvailable
+    bool isAvailable(Error &err) {
+        Scope scope(_instrumentation, Operation::IsAvailable, nullptr, err);
+        return _backend.isAvailable(err);
+    }
+
+    /*! \brief An operation whose backend call finishes asynchronously
+     *
+     * For backends with an asynchronous API, see beginAsync. The operation is
+     * reported to the Instrumentation until finish() is called, which updates
+     * the CachePolicy the way the blocking operation would. The cache is not
+     * consulted beforehand, so the backend is always called.
+     */
+    class AsyncOperation {
+      public:
+        /*! \brief Report the end of the operation
+         *
+         * The password is only used by Operation::GetPassword. Must be called
+         * exactly once.
+         */
+        void finish(const Key &key, const std::string &password,
+                    const Error &err) {
+            if (CachePolicy::enabled) {
+                if (_operation != Operation::GetPassword) {
+                    _keychain->_cache.invalidate(key);
+                } else if (!err) {
+                    _keychain->_cache.store(key, password);
+                }
+            }
+            _keychain->_instrumentation.end(_span, err);
+        }
+
+      private:
+        friend class BasicKeychain;
+
+        AsyncOperation(BasicKeychain &keychain, Operation operation,
+                       const Key &key)
+            : _keychain(&keychain), _operation(operation),
+              _span(keychain._instrumentation.begin(operation, &key)) {}
+
+        BasicKeychain *_keychain;
+        Operation _operation;
+        typename Instrumentation::Span _span;
+    };
+
+    /*! \brief Begin getPassword, setPassword or deletePassword of a backend
+     *          call that finishes asynchronously
+     *
+     * This is how the asynchronous operations of async.h report to the same
+     * Instrumentation and CachePolicy as the blocking ones. The keychain must
+     * outlive the operation.
+     */
+    AsyncOperation beginAsync(Operation operation, const Key &key) {
+        return AsyncOperation(*this, operation, key);
+    }
+
+  private:
+    //! \brief Reports an operation to the Instrumentation until destroyed
+    class Scope {
+      public:
+        Scope(Instrumentation &instrumentation, Operation operation,
+              const Key *key, const Error &err)
+            : _instrumentation(instrumentation),
+              _span(instrumentation.begin(operation, key)), _err(err) {}
+        ~Scope() { _instrumentation.end(_span, _err); }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+      private:
+        Instrumentation &_instrumentation;
+        typename Instrumentation::Span _span;
+        const Error &_err;
+    };
+
+    Backend _backend;
+    CachePolicy _cache;
+    Instrumentation _instrumentation;
+};
+
+//! \brief The keychain of the free functions of keychain.h, without stats
+using DefaultKeychain = BasicKeychain<OsBackend, NoCache, NoInstrumentation>;
+
+} // namespace keychain
+
+#endif
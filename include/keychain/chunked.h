@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_CHUNKED_H_
+#define XPLATFORM_KEYCHAIN_CHUNKED_H_
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "keychain.h"
+
+/*! \brief Storage for secrets too large to be handled in one piece
+ *
+ * A chunked secret is split into several items, each holding one chunk. They
+ * are stored with the same `package` and `user` and a service name derived
+ * from `service`. A manifest stored under (`package`, `service`, `user`) itself
+ * records the number of chunks, the total size and a checksum of the secret.
+ *
+ * Chunks are written under a new, random generation before the manifest is
+ * updated, and the chunks of the previous generation are deleted afterwards.
+ * Concurrent writers therefore never mix their chunks: the last manifest
+ * written wins, and the chunks of the other writers are left behind. A reader
+ * started before a write completes may fail with a GenericError because the
+ * chunks of the manifest it read are gone; reading again yields the new
+ * secret. Reading and writing keeps only a few chunks in memory at a time, no
+ * matter how large the secret is.
+ */
+namespace keychain {
+
+/*! \brief The default size of a chunk in bytes
+ *
+ * Credential Manager limits a credential to 2560 bytes, so the chunks are
+ * considerably smaller on Windows.
+ */
+#ifdef KEYCHAIN_WINDOWS
+constexpr std::size_t DefaultChunkSize = 2048;
+#else
+constexpr std::size_t DefaultChunkSize = 64 * 1024;
+#endif
+
+/*! \brief Callback providing the data of a chunked secret to write
+ *
+ * The callback copies at most `capacity` bytes to `buffer` and returns the
+ * number of bytes copied. Returning 0 indicates the end of the secret.
+ */
+using ChunkSource =
+    std::function<std::size_t(unsigned char *buffer, std::size_t capacity)>;
+
+/*! \brief Callback consuming the data of a chunked secret that is read
+ *
+ * The data is only valid for the duration of the call.
+ */
+using ChunkSink =
+    std::function<void(const unsigned char *data, std::size_t size)>;
+
+/*! \brief Insert or update a chunked secret
+ *
+ * Chunks are written concurrently while the next chunk is obtained from
+ * `source`. An existing chunked secret is replaced and its chunks are deleted
+ * once the new secret was stored successfully.
+ *
+ * \param package, service, user Used to identify the secret to set
+ * \param source Callback providing the secret
+ * \param err Output parameter communicating success or error details
+ * \param chunkSize The maximum size of a single chunk in bytes
+ */
+void setChunkedSecret(const std::string &package, const std::string &service,
+                      const std::string &user, const ChunkSource &source,
+                      Error &err, std::size_t chunkSize = DefaultChunkSize);
+
+/*! \brief Insert or update a chunked secret
+ *
+ * \param package, service, user Used to identify the secret to set
+ * \param data, size The new secret
+ * \param err Output parameter communicating success or error details
+ * \param chunkSize The maximum size of a single chunk in bytes
+ */
+void setChunkedSecret(const std::string &package, const std::string &service,
+                      const std::string &user, const unsigned char *data,
+                      std::size_t size, Error &err,
+                      std::size_t chunkSize = DefaultChunkSize);
+
+/*! \brief Retrieve a chunked secret
+ *
+ * Chunks are handed to `sink` one at a time while the next chunk is being
+ * retrieved. The checksum can only be verified after the last chunk was read,
+ * so callers must discard the data passed to `sink` if err indicates an error.
+ *
+ * \param package, service, user Used to identify the secret to get
+ * \param sink Callback consuming the secret
+ * \param err Output parameter communicating success or error details
+ */
+void readChunkedSecret(const std::string &package, const std::string &service,
+                       const std::string &user, const ChunkSink &sink,
+                       Error &err);
+
+/*! \brief Delete a chunked secret including all of its chunks
+ *
+ * Trying to delete a secret that does not exist will result in a NotFound
+ * error.
+ *
+ * \param package, service, user Used to identify the secret to delete
+ * \param err Output parameter communicating success or error details
+ */
+void deleteChunkedSecret(const std::string &package, const std::string &service,
+                         const std::string &user, Error &err);
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_COMPLETION_QUEUE_H_
+#define XPLATFORM_KEYCHAIN_COMPLETION_QUEUE_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "keychain.h"
+
+namespace keychain {
+
+/*! \brief Integrates keychain operations into an event loop
+ *
+ * Operations started on a CompletionQueue return immediately. Once an
+ * operation has finished, its result is queued and the queue's fd() becomes
+ * readable. The event loop polls fd() and calls drain(), which invokes the
+ * callbacks of all finished operations on the calling thread.
+ *
+ * On Linux, fd() is an eventfd and the operations are libsecret's asynchronous
+ * calls, so any number of them can be in flight without a thread blocking on
+ * each of them. On macOS, fd() is the read end of a pipe. On Windows, fd() is
+ * an event handle suitable for WaitForMultipleObjects. Both lack an
+ * asynchronous API, so the operations are run one after the other on a single
+ * worker thread.
+ *
+ * A CompletionQueue must only be drained from one thread at a time. Starting
+ * operations is thread-safe. Callbacks of operations that have not been
+ * drained when the queue is destroyed are never invoked.
+ */
+class CompletionQueue {
+  public:
+#ifdef KEYCHAIN_WINDOWS
+    using Handle = void *;
+#else
+    using Handle = int;
+#endif
+
+    //! \brief Receives the result of getPassword
+    using PasswordCallback =
+        std::function<void(std::string password, const Error &err)>;
+
+    //! \brief Receives the result of setPassword and deletePassword
+    using Callback = std::function<void(const Error &err)>;
+
+    /*! \brief Create a queue
+     *
+     * \param err Output parameter communicating success or error details, e.g.
+     *            if the eventfd could not be created
+     */
+    explicit CompletionQueue(Error &err);
+    ~CompletionQueue();
+
+    CompletionQueue(const CompletionQueue &) = delete;
+    CompletionQueue &operator=(const CompletionQueue &) = delete;
+
+    //! \brief The handle to poll for readability
+    Handle fd() const noexcept;
+
+    /*! \brief Invoke the callbacks of all finished operations
+     *
+     * Never blocks. The callbacks must not throw.
+     *
+     * \return The number of callbacks invoked
+     */
+    std::size_t drain();
+
+    //! \brief The number of operations whose callbacks have not been invoked
+    std::size_t pending() const noexcept;
+
+    //! \brief Start keychain::getPassword
+    void getPassword(const Key &key, PasswordCallback callback);
+
+    //! \brief Start keychain::setPassword
+    void setPassword(const Key &key, const std::string &password,
+                     Callback callback);
+
+    //! \brief Start keychain::deletePassword
+    void deletePassword(const Key &key, Callback callback);
+
+  private:
+    struct State;
+    std::shared_ptr<State> _state;
+};
+
+} // namespace keychain
+
+#endif
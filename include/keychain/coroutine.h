@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_COROUTINE_H_
+#define XPLATFORM_KEYCHAIN_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine) || __cpp_impl_coroutine < 201902L
+#error "keychain/coroutine.h requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "async.h"
+#include "keychain.h"
+
+/*! \brief Awaitable keychain operations for C++20 coroutines
+ *
+ *     auto password = co_await keychain::get(key);
+ *     if (!password) { ... password.error() ... }
+ *
+ * Awaiting suspends the coroutine while the operation is in flight, see
+ * async.h, so thousands of operations can be awaited concurrently without a
+ * thread per operation.
+ *
+ * The coroutine is resumed on the thread that completed the operation, which
+ * is shared by all asynchronous operations. Coroutines that go on to block
+ * should first hop back to an executor of their own.
+ */
+namespace keychain {
+
+namespace detail {
+
+//! \brief Stores an operation's result and resumes the awaiting coroutine
+class AwaitableBase {
+  public:
+    bool await_ready() const noexcept { return false; }
+
+  protected:
+    explicit AwaitableBase(Key key) : _key(std::move(key)) {}
+
+    ~AwaitableBase() { wipeValue(); }
+
+    AwaitableBase(const AwaitableBase &) = delete;
+    AwaitableBase &operator=(const AwaitableBase &) = delete;
+
+    AsyncCallback resumeWith(std::coroutine_handle<> handle) {
+        // the coroutine and thus *this may be gone once it has been resumed
+        return [this, handle](std::string value, Error err) {
+            wipeValue(); // the password passed to setPasswordAsync
+            _value = std::move(value);
+            _error = std::move(err);
+            handle.resume();
+        };
+    }
+
+    //! \brief Overwrite _value in a way the compiler cannot elide
+    void wipeValue() noexcept {
+        volatile char *p = _value.data();
+        for (std::size_t i = 0; i < _value.size(); ++i) {
+            p[i] = 0;
+        }
+    }
+
+    Key _key;
+    std::string _value; // the password to set, or the one retrieved
+    Error _error;
+};
+
+} // namespace detail
+
+//! \brief Awaits keychain::getPassword
+class PasswordAwaitable : public detail::AwaitableBase {
+  public:
+    explicit PasswordAwaitable(Key key) : AwaitableBase(std::move(key)) {}
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        getPasswordAsync(_key, resumeWith(handle));
+    }
+
+    Result<std::string> await_resume() {
+        return Result<std::string>(std::move(_value), std::move(_error));
+    }
+};
+
+//! \brief Awaits keychain::setPassword or keychain::deletePassword
+class StatusAwaitable : public detail::AwaitableBase {
+  public:
+    //! \brief Awaits setting password, or deleting the password if null
+    StatusAwaitable(Key key, const std::string *password)
+        : AwaitableBase(std::move(key)), _set(password != nullptr) {
+        if (_set) {
+            _value = *password;
+        }
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        if (_set) {
+            setPasswordAsync(_key, _value, resumeWith(handle));
+        } else {
+            deletePasswordAsync(_key, resumeWith(handle));
+        }
+    }
+
+    Error await_resume() { return std::move(_error); }
+
+  private:
+    bool _set;
+};
+
+//! \brief Retrieve a password, see keychain::getPassword
+inline PasswordAwaitable get(const Key &key) { return PasswordAwaitable(key); }
+
+//! \overload
+inline PasswordAwaitable get(const std::string &package,
+                             const std::string &service,
+                             const std::string &user) {
+    return PasswordAwaitable(Key(package, service, user));
+}
+
+//! \brief Insert or update a password, see keychain::setPassword
+inline StatusAwaitable set(const Key &key, const std::string &password) {
+    return StatusAwaitable(key, &password);
+}
+
+//! \brief Delete a password, see keychain::deletePassword
+inline StatusAwaitable remove(const Key &key) {
+    return StatusAwaitable(key, nullptr);
+}
+
+} // namespace keychain
+
+#endif
@@ -25,12 +25,25 @@
 #ifndef XPLATFORM_KEYCHAIN_WRAPPER_H_
 #define XPLATFORM_KEYCHAIN_WRAPPER_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 /*! \brief A thin wrapper to provide cross-platform access to the operating
  *         system's credentials storage.
  *
- * keychain provides the functions getPassword, setPassword, and deletePassword.
+ * keychain provides the functions getPassword, setPassword, deletePassword, and
+ * hasPassword.
  *
  * All of these functions require three input parameters to identify the
  * credential that should be retrieved or manipulated: `package`, `service`, and
@@ -40,18 +53,81 @@
  * identifiers, the reverse domain name format is recommended for the `package`
  * parameter in order to correspond with conventions.
  *
+ * Each of these functions also has an overload accepting a precomputed
+ * `keychain::Key` instead of the three identifiers.
+ *
  * In addition, each function expects an instance of `keychain::Error` as an
  * output parameter to indicate success or failure. Note that previous states of
  * the Error are ignored and potentially overwritten.
  *
- * Also note that all three functions are blocking (potentially indefinitely)
+ * Also note that all of these functions are blocking (potentially indefinitely)
  * for example if the OS prompts the user to unlock their credentials storage.
+ *
+ * On Linux, keychain cannot be used in a child process forked after the parent
+ * connected to the Secret Service, since GIO's D-Bus thread does not survive
+ * fork(). Opening a new connection in the child does not help, as it relies
+ * on the same thread. In such a child, all functions fail with
+ * ErrorType::Unavailable right away. Processes that fork workers should do so
+ * before using keychain, or leave keychain to a process of its own, such as
+ * keychain-agent (see AgentBackend and SnapshotKeychain).
  */
 namespace keychain {
 
 struct Error;
 
+/*! \brief A precomputed handle identifying a password
+ *
+ * Constructing a Key performs all the work of mangling `package`, `service`,
+ * and `user` for the OS API up front, such as building the libsecret schema,
+ * label and attribute table, or the Windows target name. Passing the same Key
+ * to repeated calls thus avoids any heap allocation before calling into the
+ * OS.
+ *
+ * Copying a Key shares the precomputed state.
+ */
+class Key {
+  public:
+    Key(const std::string &package, const std::string &service,
+        const std::string &user);
+
+    const std::string &package() const noexcept { return _package; }
+    const std::string &service() const noexcept { return _service; }
+    const std::string &user() const noexcept { return _user; }
+
+    /*! \brief A hash of the identifiers
+     *
+     * The hash is stable across processes and builds, so it can be used to
+     * correlate keys in logs or traces without revealing the identifiers.
+     */
+    std::uint64_t hash() const noexcept { return _hash; }
+
+    bool operator==(const Key &other) const noexcept {
+        return _hash == other._hash && _package == other._package &&
+               _service == other._service && _user == other._user;
+    }
+    bool operator!=(const Key &other) const noexcept {
+        return !(*this == other);
+    }
+
+    //! \brief The OS-specific precomputed state, defined by each platform
+    struct Native;
+    const Native &native() const noexcept { return *_native; }
+
+  private:
+    //! \brief Precompute the OS-specific state; implemented by each platform
+    static std::shared_ptr<const Native> makeNative(const Key &key);
+
+    std::string _package;
+    std::string _service;
+    std::string _user;
+    std::uint64_t _hash;
+    std::shared_ptr<const Native> _native;
+};
+
 /*! \brief Retrieve a password
+ *
+ * On Linux, an item holding a binary secret stored with setSecret is not
+ * returned as a password but fails with a GenericError; use getSecret instead.
  *
  * \param package, service, user Used to identify the password to get
  * \param err Output parameter communicating success or error details
@@ -61,6 +137,66 @@ struct Error;
 std::string getPassword(const std::string &package, const std::string &service,
                         const std::string &user, Error &err);
 
+//! \overload
+std::string getPassword(const Key &key, Error &err);
+
+/*! \brief Callback receiving a read-only view of a password
+ *
+ * \param data, size The password; only valid for the duration of the call
+ * \param context The context passed to withPassword
+ */
+using PasswordViewCallback = void (*)(const char *data, std::size_t size,
+                                      void *context);
+
+/*! \brief Access a password without copying it
+ *
+ * The callback is only invoked if the function was successful. It is handed a
+ * view of the buffer the OS returned the password in, which is wiped and freed
+ * as soon as the callback returns. On Linux that buffer is allocated from
+ * libsecret's non-pageable memory, so the password never reaches swap. Windows
+ * wipes the buffer as well, while on macOS the buffer is released unchanged.
+ * As with getPassword, binary secrets fail with a GenericError on Linux.
+ *
+ * \param package, service, user Used to identify the password to access
+ * \param callback Invoked with a view of the password
+ * \param context Passed to the callback as-is
+ * \param err Output parameter communicating success or error details
+ */
+void withPassword(const std::string &package, const std::string &service,
+                  const std::string &user, PasswordViewCallback callback,
+                  void *context, Error &err);
+
+//! \overload
+void withPassword(const Key &key, PasswordViewCallback callback, void *context,
+                  Error &err);
+
+/*! \brief Access a password without copying it
+ *
+ * Convenience overload accepting any callable with the signature
+ * `void(const char *data, std::size_t size)`, such as a lambda. The callable
+ * is invoked directly, without being wrapped into a std::function.
+ */
+template <typename Callback>
+void withPassword(const Key &key, Callback &&callback, Error &err) {
+    using CallbackType = typename std::remove_reference<Callback>::type;
+    withPassword(
+        key,
+        [](const char *data, std::size_t size, void *context) {
+            (*static_cast<CallbackType *>(context))(data, size);
+        },
+        const_cast<void *>(static_cast<const void *>(&callback)),
+        err);
+}
+
+//! \overload
+template <typename Callback>
+void withPassword(const std::string &package, const std::string &service,
+                  const std::string &user, Callback &&callback, Error &err) {
+    withPassword(Key(package, service, user),
+                 std::forward<Callback>(callback),
+                 err);
+}
+
 /*! \brief Insert or update a password
  *
  * Existing passwords will be overwritten.
@@ -73,6 +209,46 @@ void setPassword(const std::string &package, const std::string &service,
                  const std::string &user, const std::string &password,
                  Error &err);
 
+//! \overload
+void setPassword(const Key &key, const std::string &password, Error &err);
+
+/*! \brief Retrieve a binary secret
+ *
+ * Unlike getPassword, the secret is returned as raw bytes and may contain
+ * embedded NUL characters. Secrets stored with setSecret should be retrieved
+ * with this function.
+ *
+ * \param package, service, user Used to identify the secret to get
+ * \param err Output parameter communicating success or error details
+ *
+ * \return The secret, if the function was successful
+ */
+std::vector<unsigned char> getSecret(const std::string &package,
+                                     const std::string &service,
+                                     const std::string &user, Error &err);
+
+//! \overload
+std::vector<unsigned char> getSecret(const Key &key, Error &err);
+
+/*! \brief Insert or update a binary secret
+ *
+ * Existing passwords or secrets will be overwritten. Unlike setPassword, the
+ * secret is stored as-is without being treated as text. On Linux it is stored
+ * with the content type "application/octet-stream". Use deletePassword to
+ * delete the secret.
+ *
+ * \param package, service, user Used to identify the secret to set
+ * \param data, size The new secret
+ * \param err Output parameter communicating success or error details
+ */
+void setSecret(const std::string &package, const std::string &service,
+               const std::string &user, const unsigned char *data,
+               std::size_t size, Error &err);
+
+//! \overload
+void setSecret(const Key &key, const unsigned char *data, std::size_t size,
+               Error &err);
+
 /*! \brief Insert or update a password
  *
  * Trying to delete a password that does not exist will result in a NotFound
@@ -84,6 +260,90 @@ void setPassword(const std::string &package, const std::string &service,
 void deletePassword(const std::string &package, const std::string &service,
                     const std::string &user, Error &err);
 
+//! \overload
+void deletePassword(const Key &key, Error &err);
+
+/*! \brief Check if a password exists
+ *
+ * Unlike getPassword, this function does not retrieve the password itself. On
+ * Linux and macOS only the item's attributes are queried, so neither a secret
+ * is transferred nor an unlock prompt is triggered. On Windows the credential
+ * is read and discarded right away since Credential Manager provides no
+ * attribute-only lookup.
+ *
+ * A password that does not exist is not considered an error: the function
+ * returns false and err indicates success.
+ *
+ * \param package, service, user Used to identify the password to check
+ * \param err Output parameter communicating success or error details
+ *
+ * \return true if the password exists, false otherwise
+ */
+bool hasPassword(const std::string &package, const std::string &service,
+                 const std::string &user, Error &err);
+
+//! \overload
+bool hasPassword(const Key &key, Error &err);
+
+/*! \brief Information about a stored password, excluding the password itself
+ */
+struct Metadata {
+    //! \brief The service the password belongs to
+    std::string service;
+
+    //! \brief The user the password belongs to
+    std::string user;
+
+    //! \brief The label shown for the item by the OS credential manager
+    std::string label;
+
+    /*! \brief The time the item was created
+     *
+     * Credential Manager on Windows only tracks the time of the last write, so
+     * `created` equals `modified` there.
+     */
+    std::chrono::system_clock::time_point created;
+
+    //! \brief The time the item was last modified
+    std::chrono::system_clock::time_point modified;
+
+    /*! \brief Additional attributes the OS stores with the item
+     *
+     * The available attributes and their names differ across platforms.
+     */
+    std::map<std::string, std::string> attributes;
+};
+
+/*! \brief Retrieve information about a password without the password itself
+ *
+ * Like hasPassword, this function neither transfers the password nor triggers
+ * an unlock prompt on Linux and macOS.
+ *
+ * \param package, service, user Used to identify the password
+ * \param err Output parameter communicating success or error details
+ *
+ * \return The password's metadata, if the function was successful
+ */
+Metadata getMetadata(const std::string &package, const std::string &service,
+                     const std::string &user, Error &err);
+
+//! \overload
+Metadata getMetadata(const Key &key, Error &err);
+
+/*! \brief Retrieve information about all passwords of a package
+ *
+ * This is a single search for all passwords stored with `package`, which is
+ * considerably cheaper than looking up each password on its own. Finding no
+ * passwords at all is not an error. A chunked secret (see chunked.h) is listed
+ * once, by its manifest, but not by the items holding its chunks.
+ *
+ * \param package Used to identify the passwords
+ * \param err Output parameter communicating success or error details
+ *
+ * \return The metadata of all passwords found, in no particular order
+ */
+std::vector<Metadata> getAllMetadata(const std::string &package, Error &err);
+
 /*! \brief Check if the keychain is available
  *
  * This function checks whether the platform's credential store is available
@@ -108,6 +368,267 @@ enum class ErrorType {
     AccessDenied,         // macOS only
 };
 
+/*! \brief The message of an Error
+ *
+ * Setting a message must not cost a heap allocation on paths that are hit
+ * frequently, such as a password that is not found. Hence, a message can be
+ * - a string literal, which is referred to instead of being copied,
+ * - deferred, i.e. only formatted from a native error code or error object
+ *   once the message is accessed, or
+ * - an ordinary string.
+ *
+ * ErrorMessage provides the read-only interface of `std::string` and converts
+ * implicitly to `const std::string &`. A deferred message is formatted once,
+ * on first access; concurrently accessing the same message from multiple
+ * threads is safe, like for a `const std::string`.
+ */
+class ErrorMessage {
+  public:
+    using size_type = std::string::size_type;
+    using const_iterator = const char *;
+
+    //! \brief Formats a message from a native error code
+    using Formatter = std::string (*)(int code);
+
+    /*! \brief Operations on a native error object owned by an ErrorMessage
+     *
+     * Instances must have static storage duration.
+     */
+    struct NativeError {
+        std::string (*format)(const void *error);
+        void *(*copy)(const void *error);
+        void (*release)(void *error);
+    };
+
+    ErrorMessage() noexcept {}
+    ErrorMessage(std::string message) : _message(std::move(message)) {}
+    ErrorMessage(const char *message) : _message(message) {}
+
+    ErrorMessage(const ErrorMessage &other)
+        : _literal(other._literal), _formatter(other._formatter),
+          _code(other._code), _native(other._native),
+          _nativeError(other._native != nullptr
+                           ? other._native->copy(other._nativeError)
+                           : nullptr),
+          _message(other._message) {}
+
+    ErrorMessage(ErrorMessage &&other) noexcept
+        : _literal(other._literal), _formatter(other._formatter),
+          _code(other._code), _native(other._native),
+          _nativeError(other._nativeError),
+          _message(std::move(other._message)),
+          _formatted(other._formatted.exchange(nullptr)) {
+        other.forget();
+    }
+
+    ErrorMessage &operator=(const ErrorMessage &other) {
+        if (this != &other) {
+            *this = ErrorMessage(other);
+        }
+        return *this;
+    }
+
+    ErrorMessage &operator=(ErrorMessage &&other) noexcept {
+        if (this != &other) {
+            release();
+            _literal = other._literal;
+            _formatter = other._formatter;
+            _code = other._code;
+            _native = other._native;
+            _nativeError = other._nativeError;
+            _message = std::move(other._message);
+            _formatted.store(other._formatted.exchange(nullptr));
+            other.forget();
+        }
+        return *this;
+    }
+
+    ~ErrorMessage() { release(); }
+
+    //! \brief Refer to a string with static storage duration without copying
+    static ErrorMessage literal(const char *message) noexcept {
+        ErrorMessage result;
+        result._literal = message;
+        return result;
+    }
+
+    //! \brief Defer formatting the message until it is accessed
+    static ErrorMessage deferred(Formatter formatter, int code) noexcept {
+        ErrorMessage result;
+        result._formatter = formatter;
+        result._code = code;
+        return result;
+    }
+
+    /*! \brief Take ownership of a native error object, deferring formatting
+     *
+     * `error` is released with `native.release` along with the message.
+     */
+    static ErrorMessage deferred(const NativeError &native,
+                                 void *error) noexcept {
+        ErrorMessage result;
+        result._native = &native;
+        result._nativeError = error;
+        return result;
+    }
+
+    const std::string &str() const {
+        if (_literal == nullptr && _formatter == nullptr &&
+            _native == nullptr) {
+            return _message;
+        }
+
+        const std::string *formatted =
+            _formatted.load(std::memory_order_acquire);
+        if (formatted == nullptr) {
+            std::unique_ptr<const std::string> made(new std::string(format()));
+            if (_formatted.compare_exchange_strong(formatted,
+                                                   made.get(),
+                                                   std::memory_order_acq_rel,
+                                                   std::memory_order_acquire)) {
+                formatted = made.release();
+            } // else another thread was first, formatted now points to its
+        }
+        return *formatted;
+    }
+
+    operator const std::string &() const { return str(); }
+
+    const char *c_str() const {
+        return _literal != nullptr ? _literal : str().c_str();
+    }
+    const char *data() const { return c_str(); }
+
+    size_type size() const {
+        return _literal != nullptr ? std::strlen(_literal) : str().size();
+    }
+    size_type length() const { return size(); }
+    bool empty() const { return c_str()[0] == '\0'; }
+
+    const_iterator begin() const { return c_str(); }
+    const_iterator end() const { return c_str() + size(); }
+    char operator[](size_type pos) const { return c_str()[pos]; }
+
+    std::string substr(size_type pos = 0,
+                       size_type count = std::string::npos) const {
+        return str().substr(pos, count);
+    }
+
+    //! \brief See std::string::find, taking the same arguments
+    template <typename... Args> size_type find(Args &&...args) const {
+        return str().find(std::forward<Args>(args)...);
+    }
+
+    //! \brief See std::string::rfind, taking the same arguments
+    template <typename... Args> size_type rfind(Args &&...args) const {
+        return str().rfind(std::forward<Args>(args)...);
+    }
+
+    //! \brief See std::string::compare, taking the same arguments
+    template <typename... Args> int compare(Args &&...args) const {
+        return str().compare(std::forward<Args>(args)...);
+    }
+
+    //! \brief Append to the message, turning it into an ordinary string
+    ErrorMessage &operator+=(const std::string &rhs) {
+        return *this = ErrorMessage(str() + rhs);
+    }
+
+    friend std::string operator+(const ErrorMessage &lhs,
+                                 const ErrorMessage &rhs) {
+        return lhs.str() + rhs.str();
+    }
+    friend std::string operator+(const ErrorMessage &lhs,
+                                 const std::string &rhs) {
+        return lhs.str() + rhs;
+    }
+    friend std::string operator+(const std::string &lhs,
+                                 const ErrorMessage &rhs) {
+        return lhs + rhs.str();
+    }
+    friend std::string operator+(const ErrorMessage &lhs, const char *rhs) {
+        return lhs.str() + rhs;
+    }
+    friend std::string operator+(const char *lhs, const ErrorMessage &rhs) {
+        return lhs + rhs.str();
+    }
+    friend std::string operator+(const ErrorMessage &lhs, char rhs) {
+        return lhs.str() + rhs;
+    }
+    friend std::string operator+(char lhs, const ErrorMessage &rhs) {
+        return lhs + rhs.str();
+    }
+
+    friend bool operator==(const ErrorMessage &lhs, const ErrorMessage &rhs) {
+        return lhs.str() == rhs.str();
+    }
+    friend bool operator==(const ErrorMessage &lhs, const std::string &rhs) {
+        return lhs.str() == rhs;
+    }
+    friend bool operator==(const std::string &lhs, const ErrorMessage &rhs) {
+        return lhs == rhs.str();
+    }
+    friend bool operator==(const ErrorMessage &lhs, const char *rhs) {
+        return std::strcmp(lhs.c_str(), rhs) == 0;
+    }
+    friend bool operator==(const char *lhs, const ErrorMessage &rhs) {
+        return rhs == lhs;
+    }
+    template <typename T>
+    friend bool operator!=(const ErrorMessage &lhs, const T &rhs) {
+        return !(lhs == rhs);
+    }
+    template <typename T,
+              typename = typename std::enable_if<
+                  !std::is_same<T, ErrorMessage>::value>::type>
+    friend bool operator!=(const T &lhs, const ErrorMessage &rhs) {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream &operator<<(std::ostream &os,
+                                    const ErrorMessage &message) {
+        return os << message.c_str();
+    }
+
+  private:
+    std::string format() const {
+        if (_literal != nullptr) {
+            return _literal;
+        } else if (_formatter != nullptr) {
+            return _formatter(_code);
+        }
+        return _native->format(_nativeError);
+    }
+
+    void release() noexcept {
+        delete _formatted.exchange(nullptr);
+        if (_native != nullptr) {
+            _native->release(_nativeError);
+        }
+        forget();
+    }
+
+    //! \brief Reset to an empty message without releasing anything
+    void forget() noexcept {
+        _literal = nullptr;
+        _formatter = nullptr;
+        _code = 0;
+        _native = nullptr;
+        _nativeError = nullptr;
+        _message.clear();
+    }
+
+    const char *_literal = nullptr;
+    Formatter _formatter = nullptr;
+    int _code = 0;
+    const NativeError *_native = nullptr;
+    void *_nativeError = nullptr;
+    std::string _message;
+
+    //! \brief A literal or deferred message, once it was formatted
+    mutable std::atomic<const std::string *> _formatted{nullptr};
+};
+
 /*! \brief A struct to collect error information
  *
  * An instance of this struct is used as an output parameter to indicate success
@@ -128,7 +649,7 @@ struct Error {
      *
      * In most cases this message is obtained from the operating system.
      */
-    std::string message;
+    ErrorMessage message;
 
     /*! \brief The "native" error code set by the operating system
      *
@@ -140,6 +661,60 @@ struct Error {
     operator bool() const { return ErrorType::NoError != type; }
 };
 
+/*! \brief Either the result of a successful call or the error that occurred
+ *
+ * An alternative to the output parameter `keychain::Error`. Unlike
+ * `std::expected`, accessing the value of a failed call does not throw but
+ * yields a default-constructed value.
+ */
+template <typename T> class Result {
+  public:
+    Result(T value, Error error)
+        : _value(std::move(value)), _error(std::move(error)) {}
+
+    bool has_value() const noexcept { return !_error; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    T &value() & noexcept { return _value; }
+    const T &value() const & noexcept { return _value; }
+    T &&value() && noexcept { return std::move(_value); }
+
+    T &operator*() & noexcept { return _value; }
+    const T &operator*() const & noexcept { return _value; }
+    T *operator->() noexcept { return &_value; }
+    const T *operator->() const noexcept { return &_value; }
+
+    const Error &error() const noexcept { return _error; }
+
+  private:
+    T _value;
+    Error _error;
+};
+
+/*! \brief Retrieve a password
+ *
+ * Same as the overload taking an Error output parameter, but returning a
+ * Result instead.
+ *
+ * \param package, service, user Used to identify the password to get
+ *
+ * \return The password or the error that occurred
+ */
+Result<std::string> getPassword(const std::string &package,
+                                const std::string &service,
+                                const std::string &user);
+
+//! \overload
+Result<std::string> getPassword(const Key &key);
+
 } // namespace keychain
 
+namespace std {
+template <> struct hash<keychain::Key> {
+    std::size_t operator()(const keychain::Key &key) const noexcept {
+        return static_cast<std::size_t>(key.hash());
+    }
+};
+} // namespace std
+
 #endif
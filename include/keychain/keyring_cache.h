@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_KEYRING_CACHE_H_
+#define XPLATFORM_KEYCHAIN_KEYRING_CACHE_H_
+
+#include <chrono>
+#include <string>
+
+#include "basic_keychain.h"
+#include "keychain.h"
+#include "memory_cache.h"
+
+namespace keychain {
+
+/*! \brief A CachePolicy keeping passwords in the kernel's user keyring
+ *
+ * Entries are "user" keys in the user keyring (@u), with a timeout enforced
+ * by the kernel. They are thus shared by all processes of the same user, and
+ * a process missing in its own cache can retrieve a password with a system
+ * call instead of a round trip to the credentials storage. Like the
+ * credentials storage, the user keyring is accessible to any process of the
+ * user, but not to other users.
+ *
+ * Passwords that are empty or longer than 32767 bytes are not cached, and
+ * neither are keys whose description would exceed the kernel's limit.
+ *
+ * A password read before a write, but stored after the write's invalidation,
+ * would be stale for the whole TTL, in all processes. Hence, invalidate leaves
+ * a tombstone in the keyring for 30 seconds, during which the key's passwords
+ * are not cached, in any process. Reads taking longer than that, e.g. while
+ * the user is prompted to unlock the collection, can still cache a stale
+ * password.
+ *
+ * The free functions of keychain.h, including the asynchronous ones,
+ * invalidate entries on each write as well. Writes bypassing both, e.g. by
+ * other programs or through a BasicKeychain with OsBackend and another
+ * CachePolicy, leave a stale password cached for up to the TTL.
+ *
+ * Linux only.
+ */
+class KeyringCache {
+  public:
+    static constexpr bool enabled = true;
+
+    explicit KeyringCache(
+        std::chrono::seconds ttl = std::chrono::minutes(5)) noexcept;
+
+    bool lookup(const Key &key, std::string &password);
+    void store(const Key &key, const std::string &password);
+    void invalidate(const Key &key);
+
+  private:
+    std::chrono::seconds _ttl;
+};
+
+//! \brief MemoryCache backed by KeyringCache
+using KeyringTieredCache = TieredCache<MemoryCache, KeyringCache>;
+
+//! \brief A keychain caching in process memory and in the user keyring
+using KeyringCachedKeychain =
+    BasicKeychain<OsBackend, KeyringTieredCache, NoInstrumentation>;
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_MEMORY_CACHE_H_
+#define XPLATFORM_KEYCHAIN_MEMORY_CACHE_H_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "keychain.h"
+
+namespace keychain {
+
+/*! \brief A CachePolicy keeping passwords in process memory
+ *
+ * Passwords are held in SecureStrings, i.e. in locked memory that is wiped
+ * when an entry is dropped. Entries expire after a fixed time to live, so
+ * changes made by other processes are picked up eventually.
+ *
+ * Copies of a MemoryCache share the same entries. All members are
+ * thread-safe.
+ */
+class MemoryCache {
+  public:
+    static constexpr bool enabled = true;
+
+    explicit MemoryCache(
+        std::chrono::steady_clock::duration ttl = std::chrono::minutes(5));
+
+    bool lookup(const Key &key, std::string &password);
+    void store(const Key &key, const std::string &password);
+    void invalidate(const Key &key);
+
+    //! \brief Drop all entries
+    void clear();
+
+    //! \brief The number of entries, including expired ones not dropped yet
+    std::size_t size() const;
+
+  private:
+    struct State;
+    std::shared_ptr<State> _state;
+};
+
+} // namespace keychain
+
+#endif
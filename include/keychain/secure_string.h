@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_SECURE_STRING_H_
+#define XPLATFORM_KEYCHAIN_SECURE_STRING_H_
+
+#include <cstddef>
+#include <string>
+
+#include "keychain.h"
+
+namespace keychain {
+
+/*! \brief A string kept in locked memory that is wiped when freed
+ *
+ * The memory is taken from a process-wide pool of slabs that are locked into
+ * RAM (mlock or VirtualLock) once when the slab is created and that are
+ * surrounded by inaccessible guard pages. Strings are served from per-size-
+ * class free lists, so allocating a SecureString takes constant time and does
+ * not require a syscall unless the pool needs to grow. Strings exceeding the
+ * largest size class get a locked, guarded mapping of their own.
+ *
+ * The guard pages only fence each slab as a whole. The strings within a slab
+ * are adjacent, so writing past the end of one corrupts its neighbour rather
+ * than faulting.
+ *
+ * Note that locking memory may fail if the process exceeds its limit for
+ * locked memory. The memory is used nonetheless, which can be observed via
+ * securePoolStats.
+ *
+ * Like std::string, allocation failures are reported by std::bad_alloc.
+ */
+class SecureString {
+  public:
+    SecureString() noexcept = default;
+
+    //! \brief Create a zero-filled string of `size` characters
+    explicit SecureString(std::size_t size);
+
+    //! \brief Create a string holding a copy of `size` characters at `data`
+    SecureString(const char *data, std::size_t size);
+
+    ~SecureString();
+
+    SecureString(SecureString &&other) noexcept;
+    SecureString &operator=(SecureString &&other) noexcept;
+
+    SecureString(const SecureString &) = delete;
+    SecureString &operator=(const SecureString &) = delete;
+
+    //! \brief Replace the content with a copy of `size` characters at `data`
+    void assign(const char *data, std::size_t size);
+
+    //! \brief Wipe and release the content
+    void clear() noexcept;
+
+    char *data() noexcept { return _data; }
+    const char *data() const noexcept { return _data ? _data : ""; }
+
+    //! \brief The content, terminated by a null character
+    const char *c_str() const noexcept { return data(); }
+
+    std::size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+
+  private:
+    char *_data = nullptr;
+    std::size_t _size = 0;
+    std::size_t _capacity = 0;
+};
+
+//! \brief Usage of the pool backing SecureString
+struct SecurePoolStats {
+    //! \brief Bytes mapped for the pool, excluding guard pages
+    std::size_t reservedBytes = 0;
+
+    //! \brief Reserved bytes that are locked into RAM
+    std::size_t lockedBytes = 0;
+
+    //! \brief Bytes currently handed out to SecureStrings
+    std::size_t usedBytes = 0;
+
+    //! \brief The number of SecureStrings currently holding memory
+    std::size_t allocations = 0;
+};
+
+//! \brief Get a snapshot of the pool's usage
+SecurePoolStats securePoolStats();
+
+/*! \brief Retrieve a password into locked memory
+ *
+ * The password is copied from the buffer the OS returned it in straight into
+ * the secure pool, so it never resides in ordinary heap memory.
+ *
+ * \param package, service, user Used to identify the password to get
+ * \param password Output parameter receiving the password; cleared on error
+ * \param err Output parameter communicating success or error details
+ */
+void getPassword(const std::string &package, const std::string &service,
+                 const std::string &user, SecureString &password, Error &err);
+
+//! \overload
+void getPassword(const Key &key, SecureString &password, Error &err);
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_SNAPSHOT_H_
+#define XPLATFORM_KEYCHAIN_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "basic_keychain.h"
+#include "keychain.h"
+#include "stats.h"
+
+#ifndef KEYCHAIN_WINDOWS
+#include "agent.h"
+#endif
+
+namespace keychain {
+
+/*! \brief A frozen, read-only set of passwords to share with forked workers
+ *
+ * A Snapshot copies passwords into a single region of memory that is locked
+ * into RAM, excluded from core dumps and then made read-only. Taking a
+ * snapshot in a parent process before forking its workers lets all of them
+ * read the passwords from the same physical pages: since the region is never
+ * written to, copy-on-write never copies it. Note that the memory lock is not
+ * inherited, the pages stay resident as long as the parent keeps the snapshot.
+ *
+ * Fetching connects the parent to the credentials storage, so on Linux the
+ * workers cannot use OsBackend themselves, see keychain.h. SnapshotKeychain
+ * therefore sends passwords missing from the snapshot, and all writes, to
+ * keychain-agent.
+ *
+ * Looking up a password is a lock-free binary search by Key::hash().
+ */
+class Snapshot {
+  public:
+    Snapshot() noexcept = default;
+    ~Snapshot();
+
+    Snapshot(Snapshot &&other) noexcept;
+    Snapshot &operator=(Snapshot &&other) noexcept;
+
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    /*! \brief Retrieve the passwords of `keys` and freeze them into a snapshot
+     *
+     * Passwords that do not exist are left out, so looking them up falls back
+     * to the keychain's backend. Any other error aborts and yields an empty
+     * snapshot.
+     *
+     * \param keys Used to identify the passwords to get
+     * \param err Output parameter communicating success or error details
+     */
+    static Snapshot fetch(const std::vector<Key> &keys, Error &err);
+
+    /*! \brief Find the password of `key`
+     *
+     * \param data, size Set to the password if it was found
+     *
+     * \return true if the snapshot holds the password
+     */
+    bool find(const Key &key, const char *&data,
+              std::size_t &size) const noexcept;
+
+    /*! \brief Stop finding the password of `key` in this process
+     *
+     * The snapshot itself is read-only, so other processes sharing it are not
+     * affected.
+     */
+    void invalidate(const Key &key) const noexcept;
+
+    //! \brief The number of passwords in the snapshot
+    std::size_t size() const noexcept { return _count; }
+
+    //! \brief The number of bytes mapped for the snapshot
+    std::size_t bytes() const noexcept { return _size; }
+
+    //! \brief Whether the snapshot is locked into RAM
+    bool locked() const noexcept { return _locked; }
+
+  private:
+    struct Entry;
+
+    //! \brief Wipe and release the region, leaving the snapshot empty
+    void unmap() noexcept;
+
+    //! \brief The index of the entry of `key`, or `_count` if there is none
+    std::size_t indexOf(const Key &key) const noexcept;
+
+    unsigned char *_region = nullptr;
+    std::size_t _size = 0;
+    const Entry *_entries = nullptr;
+    std::size_t _count = 0;
+    bool _locked = false;
+
+    //! \brief Per-process invalidations, kept outside the read-only region
+    std::unique_ptr<std::atomic<bool>[]> _invalidated;
+};
+
+/*! \brief A CachePolicy serving passwords from a Snapshot
+ *
+ * Passwords missing from the snapshot are retrieved from the backend but not
+ * cached, as the snapshot is read-only. Writing or deleting a password through
+ * the keychain invalidates it in the snapshot.
+ */
+class SnapshotCache {
+  public:
+    static constexpr bool enabled = true;
+
+    SnapshotCache() = default;
+    explicit SnapshotCache(std::shared_ptr<const Snapshot> snapshot)
+        : _snapshot(std::move(snapshot)) {}
+
+    bool lookup(const Key &key, std::string &password) {
+        const char *data = nullptr;
+        std::size_t size = 0;
+        if (!_snapshot || !_snapshot->find(key, data, size)) {
+            recordCount(Counter::SnapshotMisses);
+            return false;
+        }
+        password.assign(data, size);
+        recordCount(Counter::SnapshotHits);
+        return true;
+    }
+
+    void store(const Key &, const std::string &) noexcept {}
+
+    void invalidate(const Key &key) noexcept {
+        if (_snapshot) {
+            _snapshot->invalidate(key);
+        }
+    }
+
+  private:
+    std::shared_ptr<const Snapshot> _snapshot;
+};
+
+/*! \brief The Backend of SnapshotKeychain
+ *
+ * On Unix, this is AgentBackend: keychain-agent serves passwords missing from
+ * the snapshot to forked workers. Without an agent, AgentBackend falls back to
+ * OsBackend, which on Linux fails with ErrorType::Unavailable in a worker
+ * forked after the snapshot was fetched.
+ */
+#ifdef KEYCHAIN_WINDOWS
+using SnapshotBackend = OsBackend;
+#else
+using SnapshotBackend = AgentBackend;
+#endif
+
+//! \brief A keychain reading through a Snapshot
+using SnapshotKeychain =
+    BasicKeychain<SnapshotBackend, SnapshotCache, NoInstrumentation>;
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_STATS_H_
+#define XPLATFORM_KEYCHAIN_STATS_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "basic_keychain.h"
+#include "keychain.h"
+#include "keychain/config.h"
+
+/*! \brief Latency statistics of keychain operations
+ *
+ * The free functions of keychain.h and AgentKeychain record the latency of
+ * each operation they perform, broken down by operation, backend and outcome.
+ * Recording costs two clock reads and two relaxed atomic increments, so it is
+ * always on. stats() returns a snapshot of everything recorded so far.
+ *
+ * Other keychains record their operations by using StatsInstrumentation as
+ * their Instrumentation.
+ *
+ * In addition, the backends and caches count the work they do, such as D-Bus
+ * round trips or cache hits, see Counter. toPrometheusText renders all of it
+ * in Prometheus' text exposition format.
+ */
+namespace keychain {
+
+//! \brief How an operation ended
+enum class Outcome {
+    Success = 0,
+    NotFound,
+    Error,
+};
+
+//! \brief The number of values of Outcome
+constexpr std::size_t OutcomeCount = 3;
+
+//! \brief The outcome of an operation that ended with err
+Outcome outcomeOf(const Error &err) noexcept;
+
+//! \brief A lower-case name of an Outcome, e.g. "not_found"
+const char *outcomeName(Outcome outcome) noexcept;
+
+//! \brief The backend an operation was recorded for
+enum class StatsBackend {
+    Os = 0, // OsBackend, i.e. the free functions
+    Agent,  // AgentBackend
+};
+
+//! \brief The number of values of StatsBackend
+constexpr std::size_t StatsBackendCount = 2;
+
+//! \brief A lower-case name of a StatsBackend, e.g. "os"
+const char *statsBackendName(StatsBackend backend) noexcept;
+
+namespace detail {
+
+//! \brief The index of the highest bit set in value, which must not be zero
+inline unsigned highestBit(std::uint64_t value) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    unsigned bit = 0;
+    for (unsigned shift = 32; shift > 0; shift /= 2) {
+        if (value >> (bit + shift)) {
+            bit += shift;
+        }
+    }
+    return bit;
+#endif
+}
+
+} // namespace detail
+
+/*! \brief A histogram of latencies
+ *
+ * Latencies are counted in buckets whose width grows with the latency, as in
+ * HdrHistogram: each power of two is split into 2^SubBucketBits buckets, so a
+ * latency is known to within 1/2^SubBucketBits of its value. Latencies below
+ * 2^SubBucketBits ns are counted exactly, those of 2^(MaxExponent + 1) ns or
+ * more in the last bucket.
+ *
+ * stats() reports LatencyHistograms. keychain-loadgen uses a finer instance.
+ */
+template <unsigned SubBucketBits, unsigned MaxExponent>
+class BasicLatencyHistogram {
+  public:
+    static constexpr std::uint64_t SubBucketCount = std::uint64_t(1)
+                                                    << SubBucketBits;
+    static constexpr std::size_t BucketCount =
+        (MaxExponent - SubBucketBits + 2) * SubBucketCount;
+
+    //! \brief The bucket counting latency
+    static std::size_t bucketOf(std::chrono::nanoseconds latency) noexcept {
+        const auto value = static_cast<std::uint64_t>(
+            std::max<std::chrono::nanoseconds::rep>(latency.count(), 0));
+        if (value < SubBucketCount) {
+            return static_cast<std::size_t>(value);
+        }
+
+        const unsigned exponent = detail::highestBit(value);
+        if (exponent > MaxExponent) {
+            return BucketCount - 1;
+        }
+        const unsigned shift = exponent - SubBucketBits;
+        return static_cast<std::size_t>((shift + 1) * SubBucketCount +
+                                        (value >> shift) - SubBucketCount);
+    }
+
+    //! \brief The highest latency counted in bucket
+    static std::chrono::nanoseconds bucketLimit(std::size_t bucket) noexcept {
+        if (bucket < SubBucketCount) {
+            return std::chrono::nanoseconds(bucket);
+        }
+
+        const std::size_t shift = bucket / SubBucketCount - 1;
+        const std::uint64_t lower = (SubBucketCount + bucket % SubBucketCount)
+                                    << shift;
+        return std::chrono::nanoseconds(lower + (std::uint64_t(1) << shift) -
+                                        1);
+    }
+
+    BasicLatencyHistogram() : _buckets(BucketCount) {}
+
+    void record(std::chrono::nanoseconds latency) {
+        ++_buckets[bucketOf(latency)];
+        ++_count;
+        _total += latency;
+    }
+
+    void add(const BasicLatencyHistogram &other) {
+        for (std::size_t i = 0; i < BucketCount; ++i) {
+            _buckets[i] += other._buckets[i];
+        }
+        _count += other._count;
+        _total += other._total;
+    }
+
+    //! \brief The number of latencies recorded
+    std::uint64_t count() const noexcept { return _count; }
+
+    //! \brief The sum of all latencies recorded
+    std::chrono::nanoseconds total() const noexcept { return _total; }
+
+    //! \brief The number of latencies counted in bucket
+    std::uint64_t bucket(std::size_t bucket) const noexcept {
+        return _buckets[bucket];
+    }
+
+    std::chrono::nanoseconds mean() const noexcept {
+        if (_count == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        return std::chrono::nanoseconds(_total.count() /
+                                        static_cast<std::int64_t>(_count));
+    }
+
+    /*! \brief The latency that percent of all latencies are at or below
+     *
+     * This is the limit of the bucket the latency was counted in, i.e. it
+     * overestimates the latency by up to 1/2^SubBucketBits. Returns zero if
+     * the histogram is empty.
+     */
+    std::chrono::nanoseconds percentile(double percent) const noexcept {
+        if (_count == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+
+        const double rank =
+            std::ceil(std::min(percent, 100.0) / 100 * _count);
+        const std::uint64_t target =
+            std::max<std::uint64_t>(static_cast<std::uint64_t>(rank), 1);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BucketCount; ++i) {
+            seen += _buckets[i];
+            if (seen >= target) {
+                return bucketLimit(i);
+            }
+        }
+        return bucketLimit(BucketCount - 1);
+    }
+
+  private:
+    friend class Recorder;
+
+    std::vector<std::uint64_t> _buckets;
+    std::uint64_t _count = 0;
+    std::chrono::nanoseconds _total{0};
+};
+
+template <unsigned SubBucketBits, unsigned MaxExponent>
+constexpr std::uint64_t
+    BasicLatencyHistogram<SubBucketBits, MaxExponent>::SubBucketCount;
+
+template <unsigned SubBucketBits, unsigned MaxExponent>
+constexpr std::size_t
+    BasicLatencyHistogram<SubBucketBits, MaxExponent>::BucketCount;
+
+/*! \brief The histogram of stats(), accurate to 1/16
+ *
+ * Latencies of 2^36 ns (about 69 s) or more are counted in the last bucket.
+ */
+using LatencyHistogram = BasicLatencyHistogram<4, 35>;
+
+/*! \brief The work done by the backends and caches, counted per process
+ *
+ * Divided by the number of operations, e.g. in a Prometheus query, these
+ * tell how much work each operation causes.
+ *
+ * The counters are not kept per keychain instance: OsBackend is stateless,
+ * and on Linux all instances share one D-Bus connection, whose round trips are
+ * counted on GIO's I/O thread rather than on the thread of the operation that
+ * caused them. To tell keychains apart, run them in processes of their own,
+ * or compare snapshots taken around the operations of interest.
+ */
+enum class Counter {
+    //! \brief D-Bus method calls to the Secret Service (Linux)
+    RoundTrips = 0,
+    //! \brief Prompts shown to unlock a collection (Linux)
+    UnlockPrompts,
+    //! \brief Bytes of passwords and secrets transferred from the storage
+    SecretBytesRead,
+    //! \brief Bytes of passwords and secrets transferred to the storage
+    SecretBytesWritten,
+    //! \brief Calls repeated after the connection was lost (Linux)
+    Retries,
+    MemoryCacheHits,
+    MemoryCacheMisses,
+    KeyringCacheHits,
+    KeyringCacheMisses,
+    SnapshotHits,
+    SnapshotMisses,
+};
+
+//! \brief The number of values of Counter
+constexpr std::size_t CounterCount = 11;
+
+/*! \brief Add amount to a Counter
+ *
+ * This is thread-safe and does not allocate. Custom backends and caches may
+ * count their work with it as well.
+ */
+void recordCount(Counter counter, std::uint64_t amount = 1) noexcept;
+
+//! \brief The latencies of one kind of operation
+struct OperationStats {
+    Operation operation;
+    StatsBackend backend;
+    Outcome outcome;
+    LatencyHistogram latency;
+};
+
+//! \brief A snapshot of the latencies and counters recorded
+struct Stats {
+    //! \brief One entry for each kind of operation recorded at least once
+    std::vector<OperationStats> operations;
+
+    //! \brief The value of each Counter
+    std::array<std::uint64_t, CounterCount> counters{};
+
+    std::uint64_t counter(Counter counter) const noexcept {
+        return counters[static_cast<std::size_t>(counter)];
+    }
+
+    //! \brief The latencies of one kind of operation, or null if none
+    const LatencyHistogram *latency(Operation operation, StatsBackend backend,
+                                    Outcome outcome) const noexcept;
+};
+
+/*! \brief Take a snapshot of the latencies and counters recorded
+ *
+ * If reset is true, everything is reset as it is collected, so no operation
+ * is lost or counted twice by consecutive snapshots.
+ *
+ * Operations ending while the snapshot is taken may be included in some of a
+ * histogram's numbers but not yet in others, e.g. in its count but not in its
+ * total.
+ */
+Stats stats(bool reset = false);
+
+//! \brief Discard all latencies and counters recorded so far
+void resetStats();
+
+/*! \brief Render stats in Prometheus' text exposition format
+ *
+ * Latencies become the histogram keychain_operation_duration_seconds, with
+ * the labels operation, backend and outcome. Each Counter becomes a counter
+ * such as keychain_dbus_round_trips_total. Prometheus expects counters to
+ * only grow, so pass a snapshot taken without reset.
+ */
+std::string toPrometheusText(const Stats &stats);
+
+/*! \brief Record the latency of an operation
+ *
+ * This is what StatsInstrumentation calls. It is thread-safe and does not
+ * allocate.
+ */
+void recordLatency(Operation operation, StatsBackend backend,
+                   const Error &err,
+                   std::chrono::steady_clock::duration latency) noexcept;
+
+#ifdef KEYCHAIN_TRACING
+//! \brief Report the beginning of an operation to the Tracer, see tracing.h
+void traceBegin(Operation operation, StatsBackend backend,
+                std::uint64_t keyHash,
+                std::chrono::steady_clock::time_point start) noexcept;
+
+//! \brief Report the end of an operation to the Tracer, see tracing.h
+void traceEnd(Operation operation, StatsBackend backend,
+              std::uint64_t keyHash,
+              std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::duration latency,
+              ErrorType error) noexcept;
+#endif
+
+/*! \brief Track an operation for the watchdog, see watchdog.h
+ *
+ * Returns a token to pass to watchEnd, or zero if no watchdog is running.
+ */
+std::uint64_t watchBegin(Operation operation, StatsBackend backend,
+                         std::uint64_t keyHash,
+                         std::chrono::steady_clock::time_point start) noexcept;
+
+//! \brief Stop tracking an operation for the watchdog
+void watchEnd(std::uint64_t token) noexcept;
+
+/*! \brief An Instrumentation recording latencies for stats()
+ *
+ * Operations are reported to the Tracer and the watchdog as well, see
+ * tracing.h and watchdog.h.
+ */
+template <StatsBackend backend> struct StatsInstrumentation {
+    struct Span {
+        Operation operation;
+        std::uint64_t keyHash;
+        std::chrono::steady_clock::time_point start;
+        std::uint64_t watch;
+    };
+
+    Span begin(Operation operation, const Key *key) noexcept {
+        Span span{operation,
+                  key != nullptr ? key->hash() : 0,
+                  std::chrono::steady_clock::now(),
+                  0};
+        span.watch = watchBegin(operation, backend, span.keyHash, span.start);
+#ifdef KEYCHAIN_TRACING
+        traceBegin(span.operation, backend, span.keyHash, span.start);
+#endif
+        return span;
+    }
+
+    void end(const Span &span, const Error &err) noexcept {
+        const auto latency = std::chrono::steady_clock::now() - span.start;
+        if (span.watch != 0) {
+            watchEnd(span.watch);
+        }
+        recordLatency(span.operation, backend, err, latency);
+#ifdef KEYCHAIN_TRACING
+        traceEnd(span.operation,
+                 backend,
+                 span.keyHash,
+                 span.start,
+                 latency,
+                 err.type);
+#endif
+    }
+};
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_TRACING_H_
+#define XPLATFORM_KEYCHAIN_TRACING_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "basic_keychain.h"
+#include "keychain.h"
+#include "keychain/config.h"
+#include "stats.h"
+
+/*! \brief Tracing hooks around keychain operations
+ *
+ * The operations recorded in stats() are reported to the Tracer registered
+ * with setTracer as well, e.g. to add them as spans to a distributed trace.
+ * Without a Tracer this costs a single atomic load per operation.
+ *
+ * Setting $KEYCHAIN_TRACE_FILE registers a ChromeTraceExporter writing to
+ * that file when the program starts, so no code changes are needed to see
+ * keychain operations on a timeline. The file is completed when the program
+ * exits.
+ *
+ * Tracing is only compiled in if keychain is built with -DENABLE_TRACING=ON,
+ * which defines KEYCHAIN_TRACING in the generated keychain/config.h, so that
+ * keychain and its users see the same definition. Otherwise, no Tracer is
+ * ever called.
+ */
+namespace keychain {
+
+//! \brief An operation reported to a Tracer
+struct TraceEvent {
+    Operation operation;
+    StatsBackend backend;
+
+    //! \brief The Key's hash(), or zero for operations not taking a Key
+    std::uint64_t keyHash;
+
+    std::chrono::steady_clock::time_point start;
+
+    //! \brief The operation's duration; zero when beginning
+    std::chrono::nanoseconds duration;
+
+    //! \brief How the operation ended; NoError when beginning
+    ErrorType error;
+};
+
+/*! \brief Receives an event at the beginning and end of each operation
+ *
+ * Both are called on the thread running the operation, which is blocked
+ * until they return, so they should not do much.
+ */
+class Tracer {
+  public:
+    virtual ~Tracer() = default;
+
+    virtual void begin(const TraceEvent &event) noexcept = 0;
+    virtual void end(const TraceEvent &event) noexcept = 0;
+};
+
+/*! \brief Register the Tracer to report operations to
+ *
+ * Replaces the Tracer registered before, if any. Pass a null pointer to stop
+ * tracing. The Tracer is not owned and must outlive all operations begun
+ * while it was registered.
+ */
+void setTracer(Tracer *tracer) noexcept;
+
+//! \brief The Tracer registered, or a null pointer
+Tracer *tracer() noexcept;
+
+/*! \brief A Tracer writing Chrome's trace event format
+ *
+ * Each operation is written as a complete event when it ends, and flushed
+ * right away, so the file is usable even if the program is killed. Timestamps
+ * are taken from std::chrono::steady_clock. The file can be opened in
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * A "%p" in the path is replaced by the process ID.
+ */
+class ChromeTraceExporter : public Tracer {
+  public:
+    explicit ChromeTraceExporter(const std::string &path);
+    ~ChromeTraceExporter() override;
+
+    ChromeTraceExporter(const ChromeTraceExporter &) = delete;
+    ChromeTraceExporter &operator=(const ChromeTraceExporter &) = delete;
+
+    //! \brief Whether the file is open for writing
+    bool isOpen() const noexcept;
+
+    /*! \brief Terminate the trace and close the file
+     *
+     * Operations ending afterwards are not written. Called by the destructor,
+     * and at exit for the exporter registered for $KEYCHAIN_TRACE_FILE.
+     */
+    void close() noexcept;
+
+    void begin(const TraceEvent &) noexcept override {}
+    void end(const TraceEvent &event) noexcept override;
+
+  private:
+    mutable std::mutex _mutex;
+    std::FILE *_file;
+    bool _first = true;
+};
+
+} // namespace keychain
+
+#endif
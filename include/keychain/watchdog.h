@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_WATCHDOG_H_
+#define XPLATFORM_KEYCHAIN_WATCHDOG_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+#include "basic_keychain.h"
+#include "stats.h"
+
+/*! \brief Reporting operations that take too long while they are still running
+ *
+ * A hidden unlock prompt or a stuck daemon can block an operation for a long
+ * time, or forever. The watchdog tracks the operations in flight and reports
+ * each one exceeding a threshold as soon as it does, without waiting for it
+ * to complete.
+ *
+ * It covers the operations recorded in stats(), i.e. those of the free
+ * functions, AgentKeychain and keychains using StatsInstrumentation. While no
+ * watchdog is running, this costs a single atomic load per operation; while
+ * one is, operations claim and release one of 256 slots without locking.
+ * Operations beyond that many in flight at once are not tracked.
+ */
+namespace keychain {
+
+//! \brief An operation running for longer than the watchdog's threshold
+struct SlowOperation {
+    Operation operation;
+    StatsBackend backend;
+
+    //! \brief The Key's hash(), or zero for operations not taking a Key
+    std::uint64_t keyHash;
+
+    //! \brief The time the operation has been running for so far
+    std::chrono::nanoseconds elapsed;
+
+    //! \brief The thread running the operation
+    std::thread::id thread;
+};
+
+using SlowOperationCallback = std::function<void(const SlowOperation &)>;
+
+/*! \brief Start reporting operations running for longer than threshold
+ *
+ * callback is invoked once for each such operation, on a thread of the
+ * watchdog's own, while the operation is still running. Operations are
+ * checked a few times per threshold, so they are reported at most a quarter
+ * of the threshold late. Operations begun before the watchdog was started are
+ * not tracked.
+ *
+ * Replaces a watchdog started before.
+ */
+void startWatchdog(std::chrono::steady_clock::duration threshold,
+                   SlowOperationCallback callback);
+
+/*! \brief Stop the watchdog
+ *
+ * Once this returns, the callback is not invoked anymore, unless this is
+ * called from the callback itself.
+ */
+void stopWatchdog();
+
+} // namespace keychain
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "agent.h"
+
+#include "agent_protocol.h"
+#include "locked_memory.h"
+
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+//! \brief A connection to keychain-agent, closed when destroyed
+class AgentConnection {
+  public:
+    explicit AgentConnection(const std::string &path) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        if (path.size() >= sizeof(address.sun_path)) {
+            return;
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_fd < 0) {
+            return;
+        }
+        fcntl(_fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        const int on = 1;
+        setsockopt(_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+        // refuse to hand secrets to anyone but our own user
+        if (connect(_fd,
+                    reinterpret_cast<const sockaddr *>(&address),
+                    sizeof(address)) != 0 ||
+            !keychain::agent::isSameUser(_fd)) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    ~AgentConnection() {
+        if (_fd >= 0) {
+            close(_fd);
+        }
+    }
+
+    AgentConnection(const AgentConnection &) = delete;
+    AgentConnection &operator=(const AgentConnection &) = delete;
+
+    explicit operator bool() const { return _fd >= 0; }
+    int fd() const { return _fd; }
+
+  private:
+    int _fd = -1;
+};
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+    str.clear();
+}
+
+/*! \brief Have the agent handle a request
+ *
+ * The request's value, a copy of the password or secret to set, is wiped once
+ * it was sent.
+ *
+ * \return false if no agent could be reached, in which case the caller falls
+ *         back to OsBackend
+ */
+bool forward(const std::string &socketPath, keychain::agent::Request request,
+             keychain::agent::Response &response, keychain::Error &err) {
+    AgentConnection connection(socketPath);
+    if (!connection) {
+        wipe(request.value);
+        return false;
+    }
+
+    const bool sent = keychain::agent::sendRequest(connection.fd(), request);
+    wipe(request.value);
+    if (!sent || !keychain::agent::receiveResponse(connection.fd(), response)) {
+        err.type = keychain::ErrorType::GenericError;
+        err.message = keychain::ErrorMessage::literal(
+            "Lost the connection to keychain-agent.");
+        err.code = -1; // generic non-zero
+        return true;
+    }
+
+    err = std::move(response.error);
+    return true;
+}
+
+keychain::agent::Request makeRequest(keychain::agent::Op op,
+                                     const keychain::Key &key,
+                                     std::string value = std::string()) {
+    return keychain::agent::Request{
+        op, key.package(), key.service(), key.user(), std::move(value)};
+}
+
+} // namespace
+
+namespace keychain {
+
+AgentBackend::AgentBackend() : _socketPath(agentSocketPath()) {}
+
+AgentBackend::AgentBackend(std::string socketPath)
+    : _socketPath(std::move(socketPath)) {}
+
+std::string AgentBackend::getPassword(const Key &key, Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::GetPassword, key),
+                 response,
+                 err)) {
+        return OsBackend::getPassword(key, err);
+    }
+    return std::move(response.value);
+}
+
+void AgentBackend::withPassword(const Key &key, PasswordViewCallback callback,
+                                void *context, Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::GetPassword, key),
+                 response,
+                 err)) {
+        OsBackend::withPassword(key, callback, context, err);
+        return;
+    }
+
+    if (!err) {
+        callback(response.value.data(), response.value.size(), context);
+    }
+    wipe(response.value);
+}
+
+void AgentBackend::setPassword(const Key &key, const std::string &password,
+                               Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::SetPassword, key, password),
+                 response,
+                 err)) {
+        OsBackend::setPassword(key, password, err);
+    }
+}
+
+std::vector<unsigned char> AgentBackend::getSecret(const Key &key,
+                                                   Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::GetSecret, key),
+                 response,
+                 err)) {
+        return OsBackend::getSecret(key, err);
+    }
+
+    std::vector<unsigned char> secret(response.value.begin(),
+                                      response.value.end());
+    wipe(response.value);
+    return secret;
+}
+
+void AgentBackend::setSecret(const Key &key, const unsigned char *data,
+                             std::size_t size, Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::SetSecret,
+                             key,
+                             std::string(reinterpret_cast<const char *>(data),
+                                         size)),
+                 response,
+                 err)) {
+        OsBackend::setSecret(key, data, size, err);
+    }
+}
+
+void AgentBackend::deletePassword(const Key &key, Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::DeletePassword, key),
+                 response,
+                 err)) {
+        OsBackend::deletePassword(key, err);
+    }
+}
+
+bool AgentBackend::hasPassword(const Key &key, Error &err) {
+    agent::Response response;
+    if (!forward(_socketPath,
+                 makeRequest(agent::Op::HasPassword, key),
+                 response,
+                 err)) {
+        return OsBackend::hasPassword(key, err);
+    }
+    return response.value == "1";
+}
+
+Metadata AgentBackend::getMetadata(const Key &key, Error &err) {
+    return OsBackend::getMetadata(key, err);
+}
+
+std::vector<Metadata> AgentBackend::getAllMetadata(const std::string &package,
+                                                   Error &err) {
+    return OsBackend::getAllMetadata(package, err);
+}
+
+bool AgentBackend::isAvailable(Error &err) {
+    return OsBackend::isAvailable(err);
+}
+
+} // namespace keychain
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "agent_protocol.h"
+
+#include "agent.h"
+
+#include "locked_memory.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace {
+
+//! \brief Guards the agent against clients announcing huge strings
+const std::uint32_t MaxStringSize = 16 * 1024 * 1024;
+
+#ifdef MSG_NOSIGNAL
+const int SendFlags = MSG_NOSIGNAL; // report EPIPE instead of raising SIGPIPE
+#else
+const int SendFlags = 0; // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+bool sendAll(int fd, const char *data, std::size_t size) {
+    while (size > 0) {
+        const auto sent = send(fd, data, size, SendFlags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+bool receiveAll(int fd, char *data, std::size_t size) {
+    while (size > 0) {
+        const auto received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        } else if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+template <typename T> void append(std::string &buffer, T value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+void append(std::string &buffer, const std::string &str) {
+    append(buffer, static_cast<std::uint32_t>(str.size()));
+    buffer.append(str);
+}
+
+template <typename T> bool receive(int fd, T &value) {
+    return receiveAll(fd, reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+bool receive(int fd, std::string &str) {
+    std::uint32_t size = 0;
+    if (!receive(fd, size) || size > MaxStringSize) {
+        return false;
+    }
+    str.resize(size);
+    return size == 0 || receiveAll(fd, &str[0], size);
+}
+
+//! \brief Send a serialized message and wipe it, as it may hold a secret
+bool sendAndWipe(int fd, std::string &buffer) {
+    const bool sent = sendAll(fd, buffer.data(), buffer.size());
+    keychain::detail::secureWipe(&buffer[0], buffer.size());
+    return sent;
+}
+
+} // namespace
+
+namespace keychain {
+namespace agent {
+
+bool isSameUser(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+        return false;
+    }
+    return credentials.uid == geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+bool sendRequest(int fd, const Request &request) {
+    // reserved up front, so no reallocation leaves a copy of the value behind
+    std::string buffer;
+    buffer.reserve(sizeof(std::uint8_t) + 4 * sizeof(std::uint32_t) +
+                   request.package.size() + request.service.size() +
+                   request.user.size() + request.value.size());
+    append(buffer, static_cast<std::uint8_t>(request.op));
+    append(buffer, request.package);
+    append(buffer, request.service);
+    append(buffer, request.user);
+    append(buffer, request.value);
+    return sendAndWipe(fd, buffer);
+}
+
+bool receiveRequest(int fd, Request &request) {
+    std::uint8_t op = 0;
+    if (!receive(fd, op)) {
+        return false;
+    }
+    request.op = static_cast<Op>(op);
+    return receive(fd, request.package) && receive(fd, request.service) &&
+           receive(fd, request.user) && receive(fd, request.value);
+}
+
+bool sendResponse(int fd, const Response &response) {
+    const std::string message = response.error.message.str();
+    std::string buffer;
+    buffer.reserve(sizeof(std::uint8_t) + sizeof(std::int32_t) +
+                   2 * sizeof(std::uint32_t) + message.size() +
+                   response.value.size());
+    append(buffer, static_cast<std::uint8_t>(response.error.type));
+    append(buffer, static_cast<std::int32_t>(response.error.code));
+    append(buffer, message);
+    append(buffer, response.value);
+    return sendAndWipe(fd, buffer);
+}
+
+bool receiveResponse(int fd, Response &response) {
+    std::uint8_t type = 0;
+    std::int32_t code = 0;
+    std::string message;
+    if (!receive(fd, type) || !receive(fd, code) || !receive(fd, message) ||
+        !receive(fd, response.value)) {
+        return false;
+    }
+    response.error.type = static_cast<ErrorType>(type);
+    response.error.code = code;
+    response.error.message = std::move(message);
+    return true;
+}
+
+} // namespace agent
+
+std::string agentSocketPath() {
+    if (const char *path = std::getenv("KEYCHAIN_AGENT_SOCKET")) {
+        return path;
+    } else if (const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR")) {
+        return std::string(runtimeDir) + "/keychain-agent.sock";
+    }
+    return "/tmp/keychain-agent-" + std::to_string(getuid()) +
+           "/keychain-agent.sock";
+}
+
+} // namespace keychain
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_AGENT_PROTOCOL_H_
+#define XPLATFORM_KEYCHAIN_AGENT_PROTOCOL_H_
+
+#include <cstdint>
+#include <string>
+
+#include "keychain.h"
+
+/* The protocol between keychain-agent and AgentBackend.
+ *
+ * A client connects to the agent's Unix domain socket and sends requests, each
+ * answered by one response. All integers are in host byte order, strings are
+ * prefixed by their length as a uint32.
+ *
+ *     request:  op (uint8), package, service, user, value
+ *     response: type (uint8), code (int32), message, value
+ *
+ * `value` is the password or secret where the operation has one, an empty
+ * string otherwise. The response to HasPassword carries "1" if the password
+ * exists.
+ */
+namespace keychain {
+namespace agent {
+
+enum class Op : std::uint8_t {
+    GetPassword = 1,
+    SetPassword,
+    DeletePassword,
+    HasPassword,
+    GetSecret,
+    SetSecret,
+};
+
+struct Request {
+    Op op;
+    std::string package;
+    std::string service;
+    std::string user;
+    std::string value;
+};
+
+struct Response {
+    Error error;
+    std::string value;
+};
+
+//! \brief Checks if the process at the other end of fd runs as our user
+bool isSameUser(int fd);
+
+// Blocking, returning false if the connection was closed or failed. Strings
+// longer than 16 MiB are rejected.
+bool sendRequest(int fd, const Request &request);
+bool receiveRequest(int fd, Request &request);
+bool sendResponse(int fd, const Response &response);
+bool receiveResponse(int fd, Response &response);
+
+} // namespace agent
+} // namespace keychain
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+// Asynchronous operations for platforms without an asynchronous API: the
+// blocking operations are run one after the other on a single worker thread.
+
+#include "async.h"
+#include "default_keychain.h"
+#include "locked_memory.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace {
+
+class Worker {
+  public:
+    static Worker &instance() {
+        // leaked, so the thread is not torn down during static destruction
+        static Worker *worker = new Worker();
+        return *worker;
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(job));
+        }
+        _wakeup.notify_one();
+    }
+
+  private:
+    Worker() { std::thread([this] { run(); }).detach(); }
+
+    void run() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wakeup.wait(lock, [this] { return !_jobs.empty(); });
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::deque<std::function<void()>> _jobs;
+};
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+}
+
+} // namespace
+
+namespace keychain {
+
+// The operations go through the keychain of the free functions, so they are
+// recorded and watched like those. Each password handed on is a copy, so that
+// the worker's own can be wiped.
+
+void getPasswordAsync(const Key &key, AsyncCallback callback) {
+    Worker::instance().post([key, callback] {
+        Error err;
+        auto password = detail::defaultKeychain().getPassword(key, err);
+        callback(password, std::move(err));
+        wipe(password);
+    });
+}
+
+void setPasswordAsync(const Key &key, const std::string &password,
+                      AsyncCallback callback) {
+    Worker::instance().post([key, secret = password, callback]() mutable {
+        Error err;
+        detail::defaultKeychain().setPassword(key, secret, err);
+        wipe(secret);
+        callback(std::string(), std::move(err));
+    });
+}
+
+void deletePasswordAsync(const Key &key, AsyncCallback callback) {
+    Worker::instance().post([key, callback] {
+        Error err;
+        detail::defaultKeychain().deletePassword(key, err);
+        callback(std::string(), std::move(err));
+    });
+}
+
+} // namespace keychain
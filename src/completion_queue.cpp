@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "completion_queue.h"
+
+#include "async.h"
+#include "locked_memory.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifdef KEYCHAIN_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef KEYCHAIN_LINUX
+#include <sys/eventfd.h>
+#endif
+
+namespace {
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+}
+
+} // namespace
+
+namespace keychain {
+
+/*! \brief The queue's state, shared with the operations in flight
+ *
+ * Operations may finish after the CompletionQueue was destroyed, so they keep
+ * the state alive until then.
+ */
+struct CompletionQueue::State {
+    explicit State(Error &err) {
+        err = Error{};
+#if defined(KEYCHAIN_WINDOWS)
+        // manual-reset, so the event stays signaled until drained
+        handle = CreateEventW(NULL, TRUE, FALSE, NULL);
+        if (handle == NULL) {
+            err.type = ErrorType::GenericError;
+            err.message = ErrorMessage::literal("Failed to create event.");
+            err.code = static_cast<int>(GetLastError());
+        }
+#elif defined(KEYCHAIN_LINUX)
+        handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (handle < 0) {
+            setErrno(err);
+        }
+#else
+        int fds[2];
+        if (pipe(fds) != 0) {
+            setErrno(err);
+            return;
+        }
+        for (const int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        handle = fds[0];
+        writeEnd = fds[1];
+#endif
+    }
+
+    ~State() {
+#ifdef KEYCHAIN_WINDOWS
+        if (handle != NULL) {
+            CloseHandle(handle);
+        }
+#else
+        if (handle >= 0) {
+            close(handle);
+        }
+        if (writeEnd >= 0) {
+            close(writeEnd);
+        }
+#endif
+    }
+
+    State(const State &) = delete;
+    State &operator=(const State &) = delete;
+
+    //! \brief Queue a finished operation's callback and signal the handle
+    void push(std::function<void()> completion) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completions.push_back(std::move(completion));
+        }
+        signal();
+    }
+
+    void signal() {
+#if defined(KEYCHAIN_WINDOWS)
+        SetEvent(handle);
+#elif defined(KEYCHAIN_LINUX)
+        const std::uint64_t one = 1;
+        const auto written = write(handle, &one, sizeof(one));
+        static_cast<void>(written); // only fails if the counter overflows
+#else
+        const char byte = 0;
+        const auto written = write(writeEnd, &byte, 1);
+        static_cast<void>(written); // a full pipe is readable already
+#endif
+    }
+
+    //! \brief Make the handle unreadable until signaled again
+    void reset() {
+#if defined(KEYCHAIN_WINDOWS)
+        ResetEvent(handle);
+#elif defined(KEYCHAIN_LINUX)
+        std::uint64_t count;
+        const auto consumed = read(handle, &count, sizeof(count));
+        static_cast<void>(consumed); // fails if not signaled, which is fine
+#else
+        char buffer[64];
+        while (read(handle, buffer, sizeof(buffer)) > 0) {
+        }
+#endif
+    }
+
+#ifndef KEYCHAIN_WINDOWS
+    static void setErrno(Error &err) {
+        err.type = ErrorType::GenericError;
+        err.message = std::strerror(errno);
+        err.code = errno;
+    }
+#endif
+
+#ifdef KEYCHAIN_WINDOWS
+    Handle handle = NULL;
+#else
+    Handle handle = -1;
+    int writeEnd = -1; // only used for the pipe on macOS
+#endif
+
+    std::mutex mutex;
+    std::vector<std::function<void()>> completions;
+    std::atomic<std::size_t> pending{0};
+};
+
+CompletionQueue::CompletionQueue(Error &err)
+    : _state(std::make_shared<State>(err)) {}
+
+CompletionQueue::~CompletionQueue() = default;
+
+CompletionQueue::Handle CompletionQueue::fd() const noexcept {
+    return _state->handle;
+}
+
+std::size_t CompletionQueue::drain() {
+    // reset before taking the completions, so that operations finishing in
+    // between signal the handle again
+    _state->reset();
+
+    std::vector<std::function<void()>> completions;
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        completions.swap(_state->completions);
+    }
+
+    for (auto &completion : completions) {
+        --_state->pending;
+        completion();
+    }
+
+    return completions.size();
+}
+
+std::size_t CompletionQueue::pending() const noexcept {
+    return _state->pending;
+}
+
+void CompletionQueue::getPassword(const Key &key, PasswordCallback callback) {
+    ++_state->pending;
+    auto state = _state;
+    getPasswordAsync(
+        key, [state, callback](std::string password, Error err) {
+            // the copy queued is wiped once passed on, just like this one
+            state->push([callback, password, err]() mutable {
+                callback(password, err);
+                wipe(password);
+            });
+            wipe(password);
+        });
+}
+
+void CompletionQueue::setPassword(const Key &key, const std::string &password,
+                                  Callback callback) {
+    ++_state->pending;
+    auto state = _state;
+    setPasswordAsync(
+        key, password, [state, callback](std::string, Error err) {
+            state->push([callback, err] { callback(err); });
+        });
+}
+
+void CompletionQueue::deletePassword(const Key &key, Callback callback) {
+    ++_state->pending;
+    auto state = _state;
+    deletePasswordAsync(
+        key, [state, callback](std::string, Error err) {
+            state->push([callback, err] { callback(err); });
+        });
+}
+
+} // namespace keychain
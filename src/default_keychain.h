@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_DEFAULT_KEYCHAIN_H_
+#define XPLATFORM_KEYCHAIN_DEFAULT_KEYCHAIN_H_
+
+#include "basic_keychain.h"
+#include "stats.h"
+
+#include <cstddef>
+#include <string>
+
+// The keychain behind the free functions of keychain.h, shared with the
+// asynchronous operations so that they are recorded the same way.
+namespace keychain {
+namespace detail {
+
+#ifdef KEYCHAIN_LINUX
+/*! \brief Remove the entry of `key` from KeyringCache, in all processes
+ *
+ * For writes bypassing KeyringCache, which would otherwise leave a stale
+ * password in the user keyring for the whole TTL.
+ */
+void invalidateKeyring(const Key &key);
+
+//! \brief OsBackend, invalidating KeyringCache's entries on each write
+struct FreeBackend : OsBackend {
+    static void setPassword(const Key &key, const std::string &password,
+                            Error &err);
+    static void setSecret(const Key &key, const unsigned char *data,
+                          std::size_t size, Error &err);
+    static void deletePassword(const Key &key, Error &err);
+};
+#else
+using FreeBackend = OsBackend;
+#endif
+
+using OsStats = StatsInstrumentation<StatsBackend::Os>;
+using FreeKeychain = BasicKeychain<FreeBackend, NoCache, OsStats>;
+
+//! \brief The keychain of the free functions, recording into stats()
+FreeKeychain &defaultKeychain() noexcept;
+
+} // namespace detail
+} // namespace keychain
+
+#endif
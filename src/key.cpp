@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "default_keychain.h"
+#include "keychain.h"
+
+namespace {
+
+const std::uint64_t FnvOffsetBasis = 14695981039346656037ULL;
+const std::uint64_t FnvPrime = 1099511628211ULL;
+
+//! \brief Continues a 64 bit FNV-1a hash over str including its terminator
+std::uint64_t fnv1a(std::uint64_t hash, const std::string &str) {
+    for (const char c : str) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= FnvPrime;
+    }
+    hash *= FnvPrime; // terminating '\0', so that ("ab", "c") != ("a", "bc")
+    return hash;
+}
+
+keychain::detail::FreeKeychain freeKeychain;
+
+} // namespace
+
+namespace keychain {
+
+detail::FreeKeychain &detail::defaultKeychain() noexcept {
+    return freeKeychain;
+}
+
+Key::Key(const std::string &package, const std::string &service,
+         const std::string &user)
+    : _package(package), _service(service), _user(user),
+      _hash(fnv1a(fnv1a(fnv1a(FnvOffsetBasis, package), service), user)),
+      _native(makeNative(*this)) {}
+
+std::string getPassword(const Key &key, Error &err) {
+    return freeKeychain.getPassword(key, err);
+}
+
+void withPassword(const Key &key, PasswordViewCallback callback, void *context,
+                  Error &err) {
+    freeKeychain.withPassword(key, callback, context, err);
+}
+
+void setPassword(const Key &key, const std::string &password, Error &err) {
+    freeKeychain.setPassword(key, password, err);
+}
+
+std::vector<unsigned char> getSecret(const Key &key, Error &err) {
+    return freeKeychain.getSecret(key, err);
+}
+
+void setSecret(const Key &key, const unsigned char *data, std::size_t size,
+               Error &err) {
+    freeKeychain.setSecret(key, data, size, err);
+}
+
+void deletePassword(const Key &key, Error &err) {
+    freeKeychain.deletePassword(key, err);
+}
+
+bool hasPassword(const Key &key, Error &err) {
+    return freeKeychain.hasPassword(key, err);
+}
+
+Metadata getMetadata(const Key &key, Error &err) {
+    return freeKeychain.getMetadata(key, err);
+}
+
+std::vector<Metadata> getAllMetadata(const std::string &package, Error &err) {
+    return freeKeychain.getAllMetadata(package, err);
+}
+
+bool isAvailable(Error &err) { return freeKeychain.isAvailable(err); }
+
+// The overloads identifying a password by package, service, and user merely
+// build a Key. The OS APIs would mangle the identifiers just the same.
+
+std::string getPassword(const std::string &package, const std::string &service,
+                        const std::string &user, Error &err) {
+    return getPassword(Key(package, service, user), err);
+}
+
+Result<std::string> getPassword(const std::string &package,
+                                const std::string &service,
+                                const std::string &user) {
+    return getPassword(Key(package, service, user));
+}
+
+Result<std::string> getPassword(const Key &key) {
+    Error err;
+    auto password = getPassword(key, err);
+    return Result<std::string>(std::move(password), std::move(err));
+}
+
+void withPassword(const std::string &package, const std::string &service,
+                  const std::string &user, PasswordViewCallback callback,
+                  void *context, Error &err) {
+    withPassword(Key(package, service, user), callback, context, err);
+}
+
+void setPassword(const std::string &package, const std::string &service,
+                 const std::string &user, const std::string &password,
+                 Error &err) {
+    setPassword(Key(package, service, user), password, err);
+}
+
+std::vector<unsigned char> getSecret(const std::string &package,
+                                     const std::string &service,
+                                     const std::string &user, Error &err) {
+    return getSecret(Key(package, service, user), err);
+}
+
+void setSecret(const std::string &package, const std::string &service,
+               const std::string &user, const unsigned char *data,
+               std::size_t size, Error &err) {
+    setSecret(Key(package, service, user), data, size, err);
+}
+
+void deletePassword(const std::string &package, const std::string &service,
+                    const std::string &user, Error &err) {
+    deletePassword(Key(package, service, user), err);
+}
+
+bool hasPassword(const std::string &package, const std::string &service,
+                 const std::string &user, Error &err) {
+    return hasPassword(Key(package, service, user), err);
+}
+
+Metadata getMetadata(const std::string &package, const std::string &service,
+                     const std::string &user, Error &err) {
+    return getMetadata(Key(package, service, user), err);
+}
+
+} // namespace keychain
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "chunked.h"
+
+#include "basic_keychain.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const char *ManifestMagic = "keychain-chunked-v1";
+
+//! \brief Separates a chunk's service from the secret's service
+const char *ChunkServiceSuffix = "#chunk.";
+
+//! \brief The number of chunks written or read ahead concurrently
+const std::size_t MaxChunksInFlight = 4;
+
+const std::uint64_t FnvOffsetBasis = 14695981039346656037ULL;
+const std::uint64_t FnvPrime = 1099511628211ULL;
+
+struct Manifest {
+    unsigned long long generation = 0;
+    unsigned long long count = 0;
+    unsigned long long size = 0;
+    std::uint64_t checksum = FnvOffsetBasis;
+};
+
+//! \brief Continues a 64 bit FNV-1a hash over data
+std::uint64_t fnv1a(std::uint64_t hash, const unsigned char *data,
+                    std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= FnvPrime;
+    }
+    return hash;
+}
+
+/*! \brief Pick the generation of a secret about to be written
+ *
+ * Generations are random rather than counted up from the previous one, so
+ * concurrent writers replacing the same secret never write the same chunks.
+ */
+unsigned long long newGeneration(const Manifest &previous) {
+    thread_local std::mt19937_64 engine([] {
+        std::random_device device;
+        return (std::uint64_t(device()) << 32) ^ device();
+    }());
+
+    unsigned long long generation;
+    do {
+        generation = engine();
+    } while (generation == previous.generation);
+    return generation;
+}
+
+std::string makeChunkService(const std::string &service,
+                             unsigned long long generation,
+                             unsigned long long index) {
+    return service + ChunkServiceSuffix + std::to_string(generation) + "." +
+           std::to_string(index);
+}
+
+/*! \brief A fixed set of threads writing or reading the chunks of a secret
+ *
+ * Threads are started on demand, up to MaxChunksInFlight, and post() waits
+ * while that many jobs are pending. The destructor waits for all pending
+ * jobs, so they may refer to anything declared before the ChunkWorkers.
+ */
+class ChunkWorkers {
+  public:
+    ChunkWorkers() = default;
+    ChunkWorkers(const ChunkWorkers &) = delete;
+    ChunkWorkers &operator=(const ChunkWorkers &) = delete;
+
+    ~ChunkWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _queued.notify_all();
+        for (auto &thread : _threads) {
+            thread.join();
+        }
+    }
+
+    void post(std::function<void()> job) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending < MaxChunksInFlight; });
+        _jobs.push_back(std::move(job));
+        ++_pending;
+        if (_idle == 0 && _threads.size() < MaxChunksInFlight) {
+            _threads.emplace_back(&ChunkWorkers::run, this);
+        }
+        lock.unlock();
+        _queued.notify_one();
+    }
+
+    //! \brief Wait until all jobs posted so far are done
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _pending == 0; });
+    }
+
+  private:
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            ++_idle;
+            _queued.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+            --_idle;
+            if (_jobs.empty()) {
+                return; // stopping
+            }
+
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+
+            --_pending;
+            _done.notify_all();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _queued;
+    std::condition_variable _done;
+    std::deque<std::function<void()>> _jobs;
+    std::size_t _pending = 0; // queued or running
+    std::size_t _idle = 0;
+    bool _stopping = false;
+    std::vector<std::thread> _threads;
+};
+
+std::vector<unsigned char> encodeManifest(const Manifest &manifest) {
+    std::ostringstream stream;
+    stream << ManifestMagic << ' ' << manifest.generation << ' '
+           << manifest.count << ' ' << manifest.size << ' '
+           << manifest.checksum;
+
+    const auto encoded = stream.str();
+    return std::vector<unsigned char>(encoded.begin(), encoded.end());
+}
+
+bool decodeManifest(const std::vector<unsigned char> &encoded,
+                    Manifest &manifest) {
+    std::istringstream stream(std::string(encoded.begin(), encoded.end()));
+    std::string magic;
+    stream >> magic >> manifest.generation >> manifest.count >>
+        manifest.size >> manifest.checksum;
+    return stream && magic == ManifestMagic;
+}
+
+void setGenericError(keychain::Error &err, const char *message) {
+    err.type = keychain::ErrorType::GenericError;
+    err.message = keychain::ErrorMessage::literal(message);
+    err.code = -1; // generic non-zero
+}
+
+bool readManifest(const std::string &package, const std::string &service,
+                  const std::string &user, Manifest &manifest,
+                  keychain::Error &err) {
+    const auto encoded = keychain::getSecret(package, service, user, err);
+    if (err) {
+        return false;
+    }
+
+    if (!decodeManifest(encoded, manifest)) {
+        setGenericError(err, "Secret is not a chunked secret.");
+        return false;
+    }
+
+    return true;
+}
+
+//! \brief Best-effort deletion of the chunks of a manifest
+void deleteChunks(const std::string &package, const std::string &service,
+                  const std::string &user, const Manifest &manifest) {
+    keychain::Error ignored;
+    for (unsigned long long i = 0; i < manifest.count; ++i) {
+        keychain::deletePassword(package,
+                                 makeChunkService(
+                                     service, manifest.generation, i),
+                                 user,
+                                 ignored);
+    }
+}
+
+} // namespace
+
+namespace keychain {
+
+namespace detail {
+
+bool isChunkService(const std::string &service) {
+    const auto suffix = service.rfind(ChunkServiceSuffix);
+    if (suffix == std::string::npos) {
+        return false;
+    }
+
+    // <generation>.<index>
+    const auto numbers =
+        service.substr(suffix + std::strlen(ChunkServiceSuffix));
+    const auto dot = numbers.find('.');
+    const auto isNumber = [](const std::string &str) {
+        return !str.empty() &&
+               std::all_of(str.begin(), str.end(), [](char c) {
+                   return c >= '0' && c <= '9';
+               });
+    };
+    return dot != std::string::npos && isNumber(numbers.substr(0, dot)) &&
+           isNumber(numbers.substr(dot + 1));
+}
+
+} // namespace detail
+
+void setChunkedSecret(const std::string &package, const std::string &service,
+                      const std::string &user, const ChunkSource &source,
+                      Error &err, std::size_t chunkSize) {
+    err = Error{};
+    if (chunkSize == 0) {
+        setGenericError(err, "Chunk size must not be zero.");
+        return;
+    }
+
+    // a plain secret stored with the same identifiers is simply replaced, but
+    // if the lookup failed, the generation in use is unknown
+    Manifest previous;
+    Error lookupErr;
+    const auto stored = getSecret(package, service, user, lookupErr);
+    if (lookupErr && lookupErr.type != ErrorType::NotFound) {
+        err = lookupErr;
+        return;
+    }
+    const bool replacing = !lookupErr && decodeManifest(stored, previous);
+
+    Manifest manifest;
+    manifest.generation = newGeneration(previous);
+
+    std::mutex errMutex;
+    Error chunkErr;
+    std::atomic<bool> failed{false};
+    {
+        ChunkWorkers workers;
+        while (!failed) {
+            using Chunk = std::vector<unsigned char>;
+            auto chunk = std::make_shared<Chunk>(chunkSize);
+            std::size_t filled = 0;
+            while (filled < chunkSize) {
+                const auto copied =
+                    source(chunk->data() + filled, chunkSize - filled);
+                if (copied == 0) {
+                    break;
+                }
+                filled += copied;
+            }
+
+            if (filled == 0) {
+                break;
+            }
+
+            chunk->resize(filled);
+            manifest.checksum =
+                fnv1a(manifest.checksum, chunk->data(), filled);
+            manifest.size += filled;
+
+            auto chunkService = makeChunkService(
+                service, manifest.generation, manifest.count++);
+            workers.post([&, chunkService, chunk]() {
+                Error setErr;
+                setSecret(package,
+                          chunkService,
+                          user,
+                          chunk->data(),
+                          chunk->size(),
+                          setErr);
+                if (setErr) {
+                    std::lock_guard<std::mutex> lock(errMutex);
+                    if (!failed.exchange(true)) {
+                        chunkErr = setErr;
+                    }
+                }
+            });
+
+            if (filled < chunkSize) {
+                break;
+            }
+        }
+    }
+    err = chunkErr;
+
+    if (!err) {
+        const auto encoded = encodeManifest(manifest);
+        setSecret(
+            package, service, user, encoded.data(), encoded.size(), err);
+    }
+
+    if (err) {
+        deleteChunks(package, service, user, manifest);
+    } else if (replacing) {
+        deleteChunks(package, service, user, previous);
+    }
+}
+
+void setChunkedSecret(const std::string &package, const std::string &service,
+                      const std::string &user, const unsigned char *data,
+                      std::size_t size, Error &err, std::size_t chunkSize) {
+    std::size_t offset = 0;
+    const ChunkSource source = [&](unsigned char *buffer,
+                                   std::size_t capacity) {
+        const auto copied = std::min(capacity, size - offset);
+        std::copy(data + offset, data + offset + copied, buffer);
+        offset += copied;
+        return copied;
+    };
+
+    setChunkedSecret(package, service, user, source, err, chunkSize);
+}
+
+void readChunkedSecret(const std::string &package, const std::string &service,
+                       const std::string &user, const ChunkSink &sink,
+                       Error &err) {
+    err = Error{};
+    Manifest manifest;
+    if (!readManifest(package, service, user, manifest, err)) {
+        return;
+    }
+
+    using Chunk = std::pair<std::vector<unsigned char>, Error>;
+    std::uint64_t checksum = FnvOffsetBasis;
+    unsigned long long size = 0;
+    unsigned long long requested = 0;
+    std::deque<std::future<Chunk>> ahead;
+    ChunkWorkers workers; // last, its jobs refer to the above
+
+    // keeps up to MaxChunksInFlight chunks in flight or ready, in order
+    auto fetchAhead = [&]() {
+        while (requested < manifest.count && ahead.size() < MaxChunksInFlight) {
+            auto promise = std::make_shared<std::promise<Chunk>>();
+            ahead.push_back(promise->get_future());
+            const auto index = requested++;
+            workers.post([&, promise, index]() {
+                Chunk chunk;
+                chunk.first = getSecret(
+                    package,
+                    makeChunkService(service, manifest.generation, index),
+                    user,
+                    chunk.second);
+                promise->set_value(std::move(chunk));
+            });
+        }
+    };
+
+    for (unsigned long long i = 0; i < manifest.count; ++i) {
+        fetchAhead();
+        const auto chunk = ahead.front().get();
+        ahead.pop_front();
+
+        if (chunk.second) {
+            err = chunk.second;
+            if (err.type == ErrorType::NotFound) {
+                setGenericError(err, "Chunked secret is incomplete.");
+            }
+            return;
+        }
+
+        checksum = fnv1a(checksum, chunk.first.data(), chunk.first.size());
+        size += chunk.first.size();
+        sink(chunk.first.data(), chunk.first.size());
+    }
+
+    if (size != manifest.size || checksum != manifest.checksum) {
+        setGenericError(err, "Chunked secret is corrupt.");
+    }
+}
+
+void deleteChunkedSecret(const std::string &package, const std::string &service,
+                         const std::string &user, Error &err) {
+    err = Error{};
+    Manifest manifest;
+    if (!readManifest(package, service, user, manifest, err)) {
+        return;
+    }
+
+    deletePassword(package, service, user, err);
+    if (!err) {
+        deleteChunks(package, service, user, manifest);
+    }
+}
+
+} // namespace keychain
@@ -24,14 +24,62 @@
  *
  */
 
+#include "async.h"
+#include "basic_keychain.h"
+#include "default_keychain.h"
 #include "keychain.h"
+#include "locked_memory.h"
+#include "stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <pthread.h>
+#include <unistd.h>
 
 #include <libsecret/secret.h>
 
+// for secret_service_search_for_dbus_paths_sync
+#define SECRET_API_SUBJECT_TO_CHANGE
+#include <libsecret/secret-unstable.h>
+
+#ifdef KEYCHAIN_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+// Raised by the kernel while a tracer is attached to the probe, so that the
+// latency is only measured if someone is listening.
+extern "C" {
+__extension__ unsigned short keychain_operation_return_semaphore
+    __attribute__((unused, section(".probes"), visibility("hidden")));
+__extension__ unsigned short keychain_libsecret_return_semaphore
+    __attribute__((unused, section(".probes"), visibility("hidden")));
+__extension__ unsigned short keychain_operation_entry_semaphore
+    __attribute__((unused, section(".probes"), visibility("hidden")));
+__extension__ unsigned short keychain_libsecret_entry_semaphore
+    __attribute__((unused, section(".probes"), visibility("hidden")));
+}
+
+#define KEYCHAIN_PROBE_ENABLED(name)                                           \
+    __builtin_expect(keychain_##name##_semaphore != 0, 0)
+#endif
+
 namespace {
 
 const char *ServiceFieldName = "service";
 const char *AccountFieldName = "username";
+const char *TextContentType = "text/plain";
+const char *BinaryContentType = "application/octet-stream";
+
+const char *SecretServiceName = "org.freedesktop.secrets";
+const char *SecretServicePath = "/org/freedesktop/secrets";
+const char *SecretServiceInterface = "org.freedesktop.Secret.Service";
+const char *PromptInterface = "org.freedesktop.Secret.Prompt";
 
 // disable warnings about missing initializers in SecretSchema
 #ifdef __GNUC__
@@ -48,6 +96,17 @@ SecretSchema makeSchema(const std::string &package) {
                         }};
 }
 
+//! \brief Releases values returned by libsecret, which wipes their secret
+struct ValueDeleter {
+    void operator()(SecretValue *value) const { secret_value_unref(value); }
+};
+
+using ScopedValue = std::unique_ptr<SecretValue, ValueDeleter>;
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+}
+
 std::string makeLabel(const std::string &service, const std::string &user) {
     std::string label = service;
 
@@ -58,6 +117,21 @@ std::string makeLabel(const std::string &service, const std::string &user) {
     return label;
 }
 
+std::string formatGError(const void *error) {
+    return static_cast<const GError *>(error)->message;
+}
+
+void *copyGError(const void *error) {
+    return g_error_copy(static_cast<const GError *>(error));
+}
+
+void freeGError(void *error) { g_error_free(static_cast<GError *>(error)); }
+
+//! \brief Lets an ErrorMessage own a GError, copying its message lazily
+const keychain::ErrorMessage::NativeError GErrorMessage = {
+    &formatGError, &copyGError, &freeGError};
+
+//! \brief Store error in err, taking ownership of it
 void updateError(keychain::Error &err, GError *error) {
     if (error == NULL) {
         err = keychain::Error{};
@@ -65,126 +139,922 @@ void updateError(keychain::Error &err, GError *error) {
     }
 
     err.type = keychain::ErrorType::GenericError;
-    err.message = error->message;
     err.code = error->code;
-    g_error_free(error);
+    err.message = keychain::ErrorMessage::deferred(GErrorMessage, error);
 }
 
 void setErrorNotFound(keychain::Error &err) {
     err.type = keychain::ErrorType::NotFound;
-    err.message = "Password not found.";
+    err.message = keychain::ErrorMessage::literal("Password not found.");
     err.code = -1; // generic non-zero
 }
 
-} // namespace
+//! \brief The item exists, but holds a binary secret stored with setSecret
+void setErrorNotAPassword(keychain::Error &err) {
+    err.type = keychain::ErrorType::GenericError;
+    err.message = keychain::ErrorMessage::literal(
+        "The item holds a binary secret, use getSecret to retrieve it.");
+    err.code = -1; // generic non-zero
+}
 
-namespace keychain {
+//! \brief Checks if a call failed because the connection was lost
+bool isDisconnected(const GError *error) {
+    return g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CLOSED) ||
+           g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_DISCONNECTED);
+}
 
-void setPassword(const std::string &package, const std::string &service,
-                 const std::string &user, const std::string &password,
-                 Error &err) {
-    err = Error{};
-    const auto schema = makeSchema(package);
-    const auto label = makeLabel(service, user);
-    GError *error = NULL;
+//! \brief Count the length of a secret transferred
+void countSecret(keychain::Counter counter, SecretValue *value) {
+    if (value != NULL) {
+        gsize length = 0;
+        secret_value_get(value, &length);
+        keychain::recordCount(counter, length);
+    }
+}
+
+/*! \brief Counts the method calls sent on the service's connection
+ *
+ * These include the calls libsecret makes on its own, such as opening a
+ * session or unlocking a collection. Invoked on GDBus' worker thread.
+ */
+GDBusMessage *countMessage(GDBusConnection *, GDBusMessage *message,
+                           gboolean incoming, gpointer) {
+    if (!incoming &&
+        g_dbus_message_get_message_type(message) ==
+            G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+        !(g_dbus_message_get_flags(message) &
+          G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)) {
+        keychain::recordCount(keychain::Counter::RoundTrips);
+        if (g_strcmp0(g_dbus_message_get_interface(message),
+                      PromptInterface) == 0) {
+            keychain::recordCount(keychain::Counter::UnlockPrompts);
+        }
+    }
+    return message;
+}
 
-    secret_password_store_sync(&schema,
-                               SECRET_COLLECTION_DEFAULT,
-                               label.c_str(),
-                               password.c_str(),
-                               NULL, // not cancellable
-                               &error,
-                               ServiceFieldName,
-                               service.c_str(),
-                               AccountFieldName,
-                               user.c_str(),
-                               NULL);
+#ifdef KEYCHAIN_USDT
+const char *ProbeBackend = "libsecret";
 
-    if (error != NULL) {
-        updateError(err, error);
+/*! \brief Fires the USDT probes keychain:operation_entry and
+ *         keychain:operation_return around a public function
+ *
+ * operation_entry(function, backend)
+ * operation_return(function, backend, latency in ns, ErrorType, error code)
+ */
+class OperationProbe {
+  public:
+    explicit OperationProbe(const char *function,
+                            const keychain::Error *err = NULL)
+        : _function(function), _err(err) {
+        DTRACE_PROBE2(keychain, operation_entry, _function, ProbeBackend);
+        if (KEYCHAIN_PROBE_ENABLED(operation_return)) {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~OperationProbe() {
+        if (!KEYCHAIN_PROBE_ENABLED(operation_return) ||
+            _start == std::chrono::steady_clock::time_point()) {
+            return; // attached after the function was entered
+        }
+        const long long latency =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start)
+                .count();
+        const int type = _err != NULL ? static_cast<int>(_err->type) : 0;
+        const int code = _err != NULL ? _err->code : 0;
+        DTRACE_PROBE5(keychain,
+                      operation_return,
+                      _function,
+                      ProbeBackend,
+                      latency,
+                      type,
+                      code);
+    }
+
+    OperationProbe(const OperationProbe &) = delete;
+    OperationProbe &operator=(const OperationProbe &) = delete;
+
+  private:
+    const char *const _function;
+    const keychain::Error *const _err;
+    std::chrono::steady_clock::time_point _start;
+};
+
+/*! \brief Fires the USDT probes keychain:libsecret_entry and
+ *         keychain:libsecret_return around a call into libsecret
+ *
+ * libsecret_entry(call)
+ * libsecret_return(call, latency in ns, GError code or 0)
+ */
+class LibsecretProbe {
+  public:
+    explicit LibsecretProbe(const char *call) : _call(call) {
+        DTRACE_PROBE1(keychain, libsecret_entry, _call);
+        if (KEYCHAIN_PROBE_ENABLED(libsecret_return)) {
+            _start = std::chrono::steady_clock::now();
+        }
+    }
+
+    void done(const GError *error) {
+        if (!KEYCHAIN_PROBE_ENABLED(libsecret_return) ||
+            _start == std::chrono::steady_clock::time_point()) {
+            return;
+        }
+        const long long latency =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - _start)
+                .count();
+        const int code = error != NULL ? error->code : 0;
+        DTRACE_PROBE3(keychain, libsecret_return, _call, latency, code);
+    }
+
+  private:
+    const char *const _call;
+    std::chrono::steady_clock::time_point _start;
+};
+#else
+// without -DENABLE_USDT=ON, there are no probes to fire
+class OperationProbe {
+  public:
+    explicit OperationProbe(const char *, const keychain::Error * = NULL) {}
+};
+
+class LibsecretProbe {
+  public:
+    explicit LibsecretProbe(const char *) {}
+    void done(const GError *) {}
+};
+#endif
+
+class AsyncLoop;
+
+/* The state shared by all calls: the SecretService and the AsyncLoop.
+ *
+ * GIO does the I/O of all D-Bus connections on a single thread, which is
+ * started along with the first connection and never stopped. In a child
+ * process after fork(), that thread does not exist, but GIO still relies on
+ * it, so each D-Bus call hangs until it times out. The AsyncLoop's thread does
+ * not exist in the child either.
+ *
+ * Hence, a child of a process that has connected cannot use keychain at all.
+ * statePid tells the process that created the state, so that calls in a child
+ * fail right away instead of hanging. It is checked without taking stateMutex,
+ * which may have been held by one of the parent's threads at the time of the
+ * fork.
+ */
+pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+SecretService *service = NULL;   // guarded by stateMutex
+AsyncLoop *loop = NULL;          // guarded by stateMutex
+std::atomic<pid_t> statePid{0}; // zero until the state is first created
+
+class StateLock {
+  public:
+    StateLock() { pthread_mutex_lock(&stateMutex); }
+    ~StateLock() { pthread_mutex_unlock(&stateMutex); }
+
+    StateLock(const StateLock &) = delete;
+    StateLock &operator=(const StateLock &) = delete;
+};
+
+//! \brief Record that this process creates the state; stateMutex must be held
+void claimState() {
+    if (statePid.load(std::memory_order_relaxed) == 0) {
+        statePid.store(getpid(), std::memory_order_release);
     }
 }
 
-std::string getPassword(const std::string &package, const std::string &service,
-                        const std::string &user, Error &err) {
-    err = Error{};
-    const auto schema = makeSchema(package);
-    GError *error = NULL;
+//! \brief Whether this is a child forked after the parent created the state
+bool isForkedChild() {
+    const pid_t owner = statePid.load(std::memory_order_acquire);
+    return owner != 0 && owner != getpid();
+}
+
+void setErrorForkedChild(keychain::Error &err) {
+    err.type = keychain::ErrorType::Unavailable;
+    err.message = keychain::ErrorMessage::literal(
+        "keychain cannot be used in a process forked after its parent "
+        "connected to the Secret Service.");
+    err.code = -1;
+}
+
+SecretService *connectService(GError **error) {
+    gchar *address =
+        g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, error);
+    if (address == NULL) {
+        return NULL;
+    }
+
+    GDBusConnection *connection = g_dbus_connection_new_for_address_sync(
+        address,
+        static_cast<GDBusConnectionFlags>(
+            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+            G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+        NULL, // no auth observer
+        NULL, // not cancellable
+        error);
+    g_free(address);
+    if (connection == NULL) {
+        return NULL;
+    }
+    g_dbus_connection_add_filter(connection, &countMessage, NULL, NULL);
+
+    LibsecretProbe probe("secret_service_new");
+    auto svc = static_cast<SecretService *>(
+        g_initable_new(SECRET_TYPE_SERVICE,
+                       NULL, // not cancellable
+                       error,
+                       "g-flags",
+                       G_DBUS_PROXY_FLAGS_NONE,
+                       "g-connection",
+                       connection,
+                       "g-name",
+                       SecretServiceName,
+                       "g-object-path",
+                       SecretServicePath,
+                       "g-interface-name",
+                       SecretServiceInterface,
+                       NULL));
+    probe.done(*error);
+
+    // the service holds a reference to the connection as long as needed
+    g_object_unref(connection);
+    return svc;
+}
+
+//! \brief A new reference to the service, connecting if necessary
+SecretService *acquireService(GError **error) {
+    StateLock lock;
+    if (service == NULL) {
+        claimState();
+        service = connectService(error);
+    }
+    return service != NULL ? static_cast<SecretService *>(g_object_ref(service))
+                           : NULL;
+}
+
+//! \brief Drop the service if it still is `stale`, reconnecting on next use
+void resetService(SecretService *stale) {
+    StateLock lock;
+    if (service == stale) {
+        g_object_unref(service);
+        service = NULL;
+    }
+}
+
+/*! \brief Run a call with the service, retrying once if it was disconnected
+ *
+ * `call(SecretService *, GError **)` may be invoked twice, so it must not
+ * consume anything. Errors, including failure to connect, are stored in err.
+ * `function` names the libsecret function called, for the USDT probes.
+ */
+template <typename Call>
+void callService(const char *function, keychain::Error &err, Call call) {
+    if (isForkedChild()) {
+        setErrorForkedChild(err);
+        return;
+    }
+
+    for (int attempt = 0;; ++attempt) {
+        GError *error = NULL;
+        SecretService *svc = acquireService(&error);
+        if (svc == NULL) {
+            updateError(err, error);
+            return;
+        }
+
+        LibsecretProbe probe(function);
+        call(svc, &error);
+        probe.done(error);
+
+        const bool retry = attempt == 0 && isDisconnected(error);
+        if (retry) {
+            keychain::recordCount(keychain::Counter::Retries);
+            resetService(svc);
+            g_error_free(error);
+        }
+        g_object_unref(svc);
+
+        if (!retry) {
+            updateError(err, error);
+            return;
+        }
+    }
+}
+
+//! \brief Look up the value of a Key, setting NotFound if there is none
+ScopedValue lookupValue(const SecretSchema &schema, GHashTable *attributes,
+                        keychain::Error &err) {
+    ScopedValue value;
+
+    const auto lookup = [&](SecretService *svc, GError **error) {
+        value.reset(secret_service_lookup_sync(svc,
+                                               &schema,
+                                               attributes,
+                                               NULL, // not cancellable
+                                               error));
+    };
+    callService("secret_service_lookup_sync", err, lookup);
+
+    if (!err && !value) {
+        // libsecret reports no error if the password was not found
+        setErrorNotFound(err);
+    }
+
+    countSecret(keychain::Counter::SecretBytesRead, value.get());
+    return value;
+}
+
+void storeValue(const SecretSchema &schema, GHashTable *attributes,
+                const std::string &label, SecretValue *value,
+                keychain::Error &err) {
+    const auto store = [&](SecretService *svc, GError **error) {
+        secret_service_store_sync(svc,
+                                  &schema,
+                                  attributes,
+                                  SECRET_COLLECTION_DEFAULT,
+                                  label.c_str(),
+                                  value,
+                                  NULL, // not cancellable
+                                  error);
+    };
+    callService("secret_service_store_sync", err, store);
+
+    if (!err) {
+        countSecret(keychain::Counter::SecretBytesWritten, value);
+    }
+}
+
+/*! \brief Find the D-Bus object paths of items by their attributes
+ *
+ * This is a single SearchItems call: locked items match as well, no prompt is
+ * shown, and neither secrets nor item properties are transferred.
+ */
+std::vector<std::string> searchPaths(const SecretSchema &schema,
+                                     GHashTable *attributes,
+                                     keychain::Error &err) {
+    std::vector<std::string> paths;
+
+    const auto search = [&](SecretService *svc, GError **error) {
+        gchar **unlocked = NULL;
+        gchar **locked = NULL;
+        if (secret_service_search_for_dbus_paths_sync(svc,
+                                                      &schema,
+                                                      attributes,
+                                                      NULL, // not cancellable
+                                                      &unlocked,
+                                                      &locked,
+                                                      error)) {
+            for (gchar **list : {unlocked, locked}) {
+                for (gchar **path = list; path && *path; ++path) {
+                    paths.emplace_back(*path);
+                }
+            }
+        }
+        g_strfreev(unlocked);
+        g_strfreev(locked);
+    };
+    callService("secret_service_search_for_dbus_paths_sync", err, search);
+
+    return paths;
+}
+
+/*! \brief Create the proxy of an item, loading its properties but no secret
+ *
+ * Returns NULL, with err set, if the item could not be loaded.
+ */
+SecretItem *loadItem(const std::string &path, keychain::Error &err) {
+    SecretItem *item = NULL;
+
+    const auto load = [&](SecretService *svc, GError **error) {
+        item = secret_item_new_for_dbus_path_sync(svc,
+                                                  path.c_str(),
+                                                  SECRET_ITEM_NONE,
+                                                  NULL, // not cancellable
+                                                  error);
+    };
+    callService("secret_item_new_for_dbus_path_sync", err, load);
+
+    return item;
+}
+
+/*! \brief Find items by their attributes and load their properties
+ *
+ * Without SECRET_SEARCH_UNLOCK and SECRET_SEARCH_LOAD_SECRETS, locked items
+ * match as well, no prompt is shown, and no secret is transferred. A proxy is
+ * created for each item, which costs a round trip per item; use searchPaths
+ * where the items' properties are not needed.
+ */
+GList *searchItems(const SecretSchema &schema, GHashTable *attributes,
+                   SecretSearchFlags flags, keychain::Error &err) {
+    GList *items = NULL;
+
+    const auto search = [&](SecretService *svc, GError **error) {
+        items = secret_service_search_sync(svc,
+                                           &schema,
+                                           attributes,
+                                           flags,
+                                           NULL, // not cancellable
+                                           error);
+    };
+    callService("secret_service_search_sync", err, search);
+
+    return items;
+}
+
+std::chrono::system_clock::time_point fromUnixTime(guint64 seconds) {
+    return std::chrono::system_clock::from_time_t(
+        static_cast<std::time_t>(seconds));
+}
+
+keychain::Metadata makeMetadata(SecretItem *item) {
+    keychain::Metadata metadata;
+
+    gchar *label = secret_item_get_label(item);
+    if (label != NULL) {
+        metadata.label = label;
+        g_free(label);
+    }
+
+    metadata.created = fromUnixTime(secret_item_get_created(item));
+    metadata.modified = fromUnixTime(secret_item_get_modified(item));
+
+    GHashTable *attributes = secret_item_get_attributes(item);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, attributes);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        metadata.attributes.emplace(static_cast<const char *>(key),
+                                    static_cast<const char *>(value));
+    }
+    g_hash_table_unref(attributes);
+
+    metadata.service = metadata.attributes[ServiceFieldName];
+    metadata.user = metadata.attributes[AccountFieldName];
+
+    return metadata;
+}
+
+/*! \brief Dispatches libsecret's asynchronous calls on a dedicated thread
+ *
+ * The thread runs a private GMainContext, which is where the calls' callbacks
+ * are invoked. It is started on first use and never stopped.
+ */
+class AsyncLoop {
+  public:
+    //! \brief The loop of this process
+    static AsyncLoop &instance() {
+        StateLock lock;
+        if (loop == NULL) {
+            claimState();
+            // leaked, so the thread is not torn down during static destruction
+            loop = new AsyncLoop();
+        }
+        return *loop;
+    }
+
+    //! \brief Run job on the loop's thread
+    void post(std::function<void()> job) {
+        g_main_context_invoke_full(_context,
+                                   G_PRIORITY_DEFAULT,
+                                   &AsyncLoop::run,
+                                   new std::function<void()>(std::move(job)),
+                                   &AsyncLoop::destroy);
+    }
+
+  private:
+    AsyncLoop()
+        : _context(g_main_context_new()),
+          _loop(g_main_loop_new(_context, FALSE)) {
+        std::thread([this] {
+            // calls started here complete into _context
+            g_main_context_push_thread_default(_context);
+            g_main_loop_run(_loop);
+        }).detach();
+    }
+
+    static gboolean run(gpointer job) {
+        (*static_cast<std::function<void()> *>(job))();
+        return G_SOURCE_REMOVE;
+    }
+
+    static void destroy(gpointer job) {
+        delete static_cast<std::function<void()> *>(job);
+    }
+
+    GMainContext *const _context;
+    GMainLoop *const _loop;
+};
+
+/*! \brief An asynchronous call in flight
+ *
+ * Keeps the Key's Native and the service alive until the call has finished.
+ * The call is reported as an operation of the free functions' keychain, so it
+ * is recorded, traced and watched just like a blocking one.
+ */
+struct AsyncCall {
+    keychain::Key key;
+    std::string password;
+    keychain::AsyncCallback callback;
+    keychain::detail::FreeKeychain::AsyncOperation operation;
+    SecretService *service;
+
+    ~AsyncCall() {
+        wipe(password);
+        if (service != NULL) {
+            g_object_unref(service);
+        }
+    }
+
+    //! \brief Report the result and pass it on, wiping the password after
+    void complete(std::string &value, keychain::Error err) {
+        operation.finish(key, value, err);
+        callback(value, std::move(err));
+        wipe(value);
+    }
+};
 
-    gchar *raw_passwords = secret_password_lookup_sync(&schema,
-                                                       NULL, // not cancellable
-                                                       &error,
-                                                       ServiceFieldName,
-                                                       service.c_str(),
-                                                       AccountFieldName,
-                                                       user.c_str(),
-                                                       NULL);
+//! \brief Create a call of operation
+std::unique_ptr<AsyncCall> makeAsyncCall(keychain::Operation operation,
+                                         const keychain::Key &key,
+                                         const std::string &password,
+                                         keychain::AsyncCallback callback) {
+    return std::unique_ptr<AsyncCall>(new AsyncCall{
+        key,
+        password,
+        std::move(callback),
+        keychain::detail::defaultKeychain().beginAsync(operation, key),
+        NULL});
+}
+
+/*! \brief Start a call on the loop's thread
+ *
+ * `start(AsyncCall *)` is invoked with the service set, and must pass the
+ * call on to its GAsyncReadyCallback. If connecting fails, the call is
+ * finished right away.
+ */
+template <typename Start>
+void startAsync(std::unique_ptr<AsyncCall> call, Start start) {
+    if (isForkedChild()) {
+        // the loop's thread does not exist here
+        keychain::Error err;
+        setErrorForkedChild(err);
+        std::string none;
+        call->complete(none, std::move(err));
+        return;
+    }
+
+    AsyncCall *released = call.release();
+    AsyncLoop::instance().post([released, start] {
+        std::unique_ptr<AsyncCall> call(released);
+        GError *error = NULL;
+        call->service = acquireService(&error);
+        if (call->service == NULL) {
+            keychain::Error err;
+            updateError(err, error);
+            std::string none;
+            call->complete(none, std::move(err));
+            return;
+        }
+        start(call.release());
+    });
+}
 
+void finishLookup(GObject *, GAsyncResult *result, gpointer data) {
+    std::unique_ptr<AsyncCall> call(static_cast<AsyncCall *>(data));
+    GError *error = NULL;
+    ScopedValue value(
+        secret_service_lookup_finish(call->service, result, &error));
+
+    keychain::Error err;
     std::string password;
 
+    countSecret(keychain::Counter::SecretBytesRead, value.get());
     if (error != NULL) {
         updateError(err, error);
-    } else if (raw_passwords == NULL) {
+    } else if (!value) {
         // libsecret reports no error if the password was not found
         setErrorNotFound(err);
+    } else if (secret_value_get_text(value.get()) == NULL) {
+        // as in OsBackend::getPassword, an existing binary secret must not
+        // look as if there was no item that could be overwritten
+        setErrorNotAPassword(err);
     } else {
-        password = raw_passwords;
-        secret_password_free(raw_passwords);
+        password = secret_value_get_text(value.get());
     }
 
-    return password;
+    call->complete(password, std::move(err));
 }
 
-void deletePassword(const std::string &package, const std::string &service,
-                    const std::string &user, Error &err) {
-    err = Error{};
-    const auto schema = makeSchema(package);
+void finishStore(GObject *, GAsyncResult *result, gpointer data) {
+    std::unique_ptr<AsyncCall> call(static_cast<AsyncCall *>(data));
     GError *error = NULL;
+    secret_service_store_finish(call->service, result, &error);
+    if (error == NULL) {
+        keychain::recordCount(keychain::Counter::SecretBytesWritten,
+                              call->password.size());
+    }
 
-    bool deleted = secret_password_clear_sync(&schema,
-                                              NULL, // not cancellable
-                                              &error,
-                                              ServiceFieldName,
-                                              service.c_str(),
-                                              AccountFieldName,
-                                              user.c_str(),
-                                              NULL);
+    keychain::Error err;
+    updateError(err, error);
+    // other processes may have cached the previous password
+    keychain::detail::invalidateKeyring(call->key);
+    std::string none;
+    call->complete(none, std::move(err));
+}
 
+void finishClear(GObject *, GAsyncResult *result, gpointer data) {
+    std::unique_ptr<AsyncCall> call(static_cast<AsyncCall *>(data));
+    GError *error = NULL;
+    const bool deleted =
+        secret_service_clear_finish(call->service, result, &error);
+
+    keychain::Error err;
     if (error != NULL) {
         updateError(err, error);
     } else if (!deleted) {
         // libsecret reports no error if the password did not exist
         setErrorNotFound(err);
     }
+
+    // other processes may have cached the previous password
+    keychain::detail::invalidateKeyring(call->key);
+    std::string none;
+    call->complete(none, std::move(err));
+}
+
+} // namespace
+
+namespace keychain {
+
+/*! \brief The libsecret schema, label and attribute table of a Key
+ *
+ * Keeps its own copy of the package, which the schema's name points to.
+ */
+struct Key::Native {
+    explicit Native(const Key &key)
+        : package(key.package()), schema(makeSchema(package)),
+          label(makeLabel(key.service(), key.user())),
+          attributes(secret_attributes_build(&schema,
+                                             ServiceFieldName,
+                                             key.service().c_str(),
+                                             AccountFieldName,
+                                             key.user().c_str(),
+                                             NULL)) {}
+
+    ~Native() { g_hash_table_unref(attributes); }
+
+    Native(const Native &) = delete;
+    Native &operator=(const Native &) = delete;
+
+    const std::string package;
+    const SecretSchema schema;
+    const std::string label;
+    GHashTable *const attributes;
+};
+
+std::shared_ptr<const Key::Native> Key::makeNative(const Key &key) {
+    return std::make_shared<const Native>(key);
 }
 
-bool isAvailable(Error &err) {
+void OsBackend::setPassword(const Key &key, const std::string &password,
+                            Error &err) {
+    OperationProbe probe("setPassword", &err);
+    const auto &native = key.native();
+    ScopedValue value(secret_value_new(password.c_str(), -1, TextContentType));
+    storeValue(
+        native.schema, native.attributes, native.label, value.get(), err);
+}
+
+std::string OsBackend::getPassword(const Key &key, Error &err) {
+    OperationProbe probe("getPassword", &err);
+    const auto &native = key.native();
+    ScopedValue value = lookupValue(native.schema, native.attributes, err);
+
+    std::string password;
+
+    if (value) {
+        const gchar *text = secret_value_get_text(value.get());
+        if (text == NULL) {
+            // not a password but a binary secret, which must not look as
+            // if there was no item that could be overwritten
+            setErrorNotAPassword(err);
+        } else {
+            password = text;
+        }
+    }
+
+    return password;
+}
+
+void OsBackend::setSecret(const Key &key, const unsigned char *data,
+                          std::size_t size, Error &err) {
+    OperationProbe probe("setSecret", &err);
+    const auto &native = key.native();
+
+    // the length is passed explicitly, so embedded NULs are preserved
+    ScopedValue value(secret_value_new(reinterpret_cast<const gchar *>(data),
+                                       static_cast<gssize>(size),
+                                       BinaryContentType));
+
+    storeValue(
+        native.schema, native.attributes, native.label, value.get(), err);
+}
+
+std::vector<unsigned char> OsBackend::getSecret(const Key &key, Error &err) {
+    OperationProbe probe("getSecret", &err);
+    const auto &native = key.native();
+    ScopedValue value = lookupValue(native.schema, native.attributes, err);
+
+    std::vector<unsigned char> secret;
+
+    if (value) {
+        gsize length = 0;
+        const auto bytes = reinterpret_cast<const unsigned char *>(
+            secret_value_get(value.get(), &length));
+        secret.assign(bytes, bytes + length);
+    }
+
+    return secret;
+}
+
+void OsBackend::withPassword(const Key &key, PasswordViewCallback callback,
+                             void *context, Error &err) {
+    OperationProbe probe("withPassword", &err);
+    const auto &native = key.native();
+
+    // libsecret keeps transferred secrets in non-pageable memory, which is
+    // wiped when the value is released, even if the callback throws
+    ScopedValue value = lookupValue(native.schema, native.attributes, err);
+
+    if (value) {
+        const gchar *text = secret_value_get_text(value.get());
+        if (text == NULL) {
+            // not a password but a binary secret, which must not look as
+            // if there was no item that could be overwritten
+            setErrorNotAPassword(err);
+        } else {
+            callback(text, std::strlen(text), context);
+        }
+    }
+}
+
+void OsBackend::deletePassword(const Key &key, Error &err) {
+    OperationProbe probe("deletePassword", &err);
+    const auto &native = key.native();
+    bool deleted = false;
+
+    const auto clear = [&](SecretService *svc, GError **error) {
+        deleted = secret_service_clear_sync(svc,
+                                            &native.schema,
+                                            native.attributes,
+                                            NULL, // not cancellable
+                                            error);
+    };
+    callService("secret_service_clear_sync", err, clear);
+
+    if (!err && !deleted) {
+        // libsecret reports no error if the password did not exist
+        setErrorNotFound(err);
+    }
+}
+
+bool OsBackend::hasPassword(const Key &key, Error &err) {
+    OperationProbe probe("hasPassword", &err);
+    const auto &native = key.native();
+    return !searchPaths(native.schema, native.attributes, err).empty();
+}
+
+Metadata OsBackend::getMetadata(const Key &key, Error &err) {
+    OperationProbe probe("getMetadata", &err);
+    const auto &native = key.native();
+
+    const auto paths = searchPaths(native.schema, native.attributes, err);
+
+    Metadata metadata;
+
+    if (err) {
+        return metadata;
+    } else if (paths.empty()) {
+        setErrorNotFound(err);
+        return metadata;
+    }
+
+    // only the item found is loaded, with a second round trip
+    SecretItem *item = loadItem(paths.front(), err);
+    if (item != NULL) {
+        metadata = makeMetadata(item);
+        g_object_unref(item);
+    }
+
+    return metadata;
+}
+
+std::vector<Metadata> OsBackend::getAllMetadata(const std::string &package,
+                                                Error &err) {
+    OperationProbe probe("getAllMetadata", &err);
+    const auto schema = makeSchema(package);
+
+    // an empty attribute table matches all items of the schema
+    GHashTable *attributes = secret_attributes_build(&schema, NULL);
+    GList *items = searchItems(schema, attributes, SECRET_SEARCH_ALL, err);
+    g_hash_table_unref(attributes);
+
+    std::vector<Metadata> result;
+    result.reserve(g_list_length(items));
+    for (GList *l = items; l != NULL; l = l->next) {
+        result.push_back(makeMetadata(static_cast<SecretItem *>(l->data)));
+    }
+
+    g_list_free_full(items, g_object_unref);
+    return result;
+}
+
+bool OsBackend::isAvailable(Error &err) {
+    OperationProbe probe("isAvailable", &err);
     err = Error{};
 
 #ifdef SIMULATE_FAILURES
     // TEST HOOK: Simulate failure to create SecretService
     if (getenv("KEYCHAIN_TEST_SIMULATED_FAILURE")) {
         err.type = ErrorType::Unavailable;
-        err.message = "Simulated failure: SecretService unavailable";
+        err.message = ErrorMessage::literal(
+            "Simulated failure: SecretService unavailable");
         err.code = -1;
         return false;
     }
 #endif
 
+    if (isForkedChild()) {
+        setErrorForkedChild(err);
+        return false;
+    }
+
     GError *error = NULL;
-    SecretService *svc =
-        secret_service_get_sync((SecretServiceFlags)0, NULL, &error);
+    SecretService *svc = acquireService(&error);
 
     if (error != NULL || svc == NULL) {
         err.type = ErrorType::Unavailable;
-        err.message = error ? error->message : "SecretService unavailable";
         err.code = error ? error->code : -1;
-        if (error)
-            g_error_free(error);
+        err.message =
+            error ? ErrorMessage::deferred(GErrorMessage, error)
+                  : ErrorMessage::literal("SecretService unavailable");
         return false;
     }
     g_object_unref(svc);
     return true;
 }
 
+void getPasswordAsync(const Key &key, AsyncCallback callback) {
+    OperationProbe probe("getPasswordAsync");
+    auto call = makeAsyncCall(
+        Operation::GetPassword, key, std::string(), std::move(callback));
+    startAsync(std::move(call), [](AsyncCall *started) {
+        const auto &native = started->key.native();
+        secret_service_lookup(started->service,
+                              &native.schema,
+                              native.attributes,
+                              NULL, // not cancellable
+                              &finishLookup,
+                              started);
+    });
+}
+
+void setPasswordAsync(const Key &key, const std::string &password,
+                      AsyncCallback callback) {
+    OperationProbe probe("setPasswordAsync");
+    auto call = makeAsyncCall(
+        Operation::SetPassword, key, password, std::move(callback));
+    startAsync(std::move(call), [](AsyncCall *started) {
+        const auto &native = started->key.native();
+        ScopedValue value(secret_value_new(
+            started->password.c_str(), -1, TextContentType));
+        secret_service_store(started->service,
+                             &native.schema,
+                             native.attributes,
+                             SECRET_COLLECTION_DEFAULT,
+                             native.label.c_str(),
+                             value.get(),
+                             NULL, // not cancellable
+                             &finishStore,
+                             started);
+    });
+}
+
+void deletePasswordAsync(const Key &key, AsyncCallback callback) {
+    OperationProbe probe("deletePasswordAsync");
+    auto call = makeAsyncCall(
+        Operation::DeletePassword, key, std::string(), std::move(callback));
+    startAsync(std::move(call), [](AsyncCall *started) {
+        const auto &native = started->key.native();
+        secret_service_clear(started->service,
+                             &native.schema,
+                             native.attributes,
+                             NULL, // not cancellable
+                             &finishClear,
+                             started);
+    });
+}
+
 } // namespace keychain
@@ -23,11 +23,13 @@
  *
  */
 
+#include <memory>
 #include <type_traits>
 #include <vector>
 
 #include <Security/Security.h>
 
+#include "basic_keychain.h"
 #include "keychain.h"
 
 namespace {
@@ -83,7 +85,10 @@ void updateError(keychain::Error &err, OSStatus status) {
         return;
     }
 
-    err.message = errorStatusToString(status);
+    // formatting the message is comparatively expensive and not needed for
+    // expected errors such as errSecItemNotFound, so it is deferred
+    err.message = keychain::ErrorMessage::deferred(
+        [](int code) { return errorStatusToString(code); }, status);
     err.code = status;
 
     switch (status) {
@@ -103,9 +108,9 @@ void updateError(keychain::Error &err, OSStatus status) {
     }
 }
 
-void setGenericError(keychain::Error &err, const std::string &errorMessage) {
+void setGenericError(keychain::Error &err, const char *errorMessage) {
     err = keychain::Error{};
-    err.message = errorMessage;
+    err.message = keychain::ErrorMessage::literal(errorMessage);
     err.type = keychain::ErrorType::GenericError;
     err.code = -1;
 }
@@ -175,12 +180,10 @@ createCFMutableDictionary(keychain::Error &err) {
     return result;
 }
 
-ScopedCFRef<CFDataRef> createCFData(const std::string &data,
-                                    keychain::Error &err) {
+ScopedCFRef<CFDataRef> createCFData(const unsigned char *data,
+                                    std::size_t size, keychain::Error &err) {
     auto result = ScopedCFRef<CFDataRef>(
-        CFDataCreate(kCFAllocatorDefault,
-                     reinterpret_cast<const UInt8 *>(data.c_str()),
-                     data.length()));
+        CFDataCreate(kCFAllocatorDefault, data, static_cast<CFIndex>(size)));
     if (!result)
         setGenericError(err, "Failed to create CFData");
     return result;
@@ -207,18 +210,54 @@ ScopedCFRef<CFMutableDictionaryRef> createQuery(const std::string &serviceName,
 
 namespace keychain {
 
-void setPassword(const std::string &package, const std::string &service,
-                 const std::string &user, const std::string &password,
-                 Error &err) {
-    err = Error{};
-    const auto serviceName = makeServiceName(package, service);
-    const auto cfPassword = createCFData(password, err);
-    auto query = createQuery(serviceName, user, err);
+//! \brief The Keychain Services query identifying the item of a Key
+struct Key::Native {
+    explicit Native(const Key &key)
+        : query(createQuery(makeServiceName(key.package(), key.service()),
+                            key.user(),
+                            error)) {}
+
+    //! \brief Set if the query could not be created
+    Error error;
+    ScopedCFRef<CFMutableDictionaryRef> query;
+};
+
+std::shared_ptr<const Key::Native> Key::makeNative(const Key &key) {
+    return std::make_shared<const Native>(key);
+}
+
+} // namespace keychain
+
+namespace {
+
+//! \brief Copy the precomputed query of a Key, so that it can be amended
+ScopedCFRef<CFMutableDictionaryRef> copyQuery(const keychain::Key &key,
+                                              keychain::Error &err) {
+    const auto &native = key.native();
+    if (native.error) {
+        err = native.error;
+        return ScopedCFRef<CFMutableDictionaryRef>(nullptr);
+    }
+
+    auto result = ScopedCFRef<CFMutableDictionaryRef>(
+        CFDictionaryCreateMutableCopy(
+            kCFAllocatorDefault, 0, native.query.get()));
+    if (!result)
+        setGenericError(err, "Failed to create CFMutableDictionary");
+    return result;
+}
+
+//! \brief Add or update the item's data
+void storeData(const keychain::Key &key, const unsigned char *data,
+               std::size_t size, keychain::Error &err) {
+    err = keychain::Error{};
+    const auto cfData = createCFData(data, size, err);
+    auto query = copyQuery(key, err);
 
     if (err.type != keychain::ErrorType::NoError)
         return;
 
-    CFDictionaryAddValue(query.get(), kSecValueData, cfPassword.get());
+    CFDictionaryAddValue(query.get(), kSecValueData, cfData.get());
     OSStatus status = SecItemAdd(query.get(), NULL);
 
     if (status == errSecDuplicateItem) {
@@ -228,27 +267,82 @@ void setPassword(const std::string &package, const std::string &service,
             return;
 
         CFDictionaryAddValue(
-            attributesToUpdate.get(), kSecValueData, cfPassword.get());
-        status = SecItemUpdate(query.get(), attributesToUpdate.get());
+            attributesToUpdate.get(), kSecValueData, cfData.get());
+        status = SecItemUpdate(key.native().query.get(),
+                               attributesToUpdate.get());
     }
 
     updateError(err, status);
 }
 
-std::string getPassword(const std::string &package, const std::string &service,
-                        const std::string &user, Error &err) {
-    err = Error{};
-    const auto serviceName = makeServiceName(package, service);
-    auto query = createQuery(serviceName, user, err);
+//! \brief Retrieve the item's data
+ScopedCFRef<CFDataRef> copyData(const keychain::Key &key,
+                                keychain::Error &err) {
+    err = keychain::Error{};
+    auto query = copyQuery(key, err);
 
     if (err.type != keychain::ErrorType::NoError)
-        return "";
+        return ScopedCFRef<CFDataRef>(nullptr);
 
     CFDictionaryAddValue(query.get(), kSecReturnData, kCFBooleanTrue);
 
     CFTypeRef result = nullptr;
     updateError(err, SecItemCopyMatching(query.get(), &result));
-    const auto cfPassword = ScopedCFRef<CFDataRef>((CFDataRef)result);
+    return ScopedCFRef<CFDataRef>((CFDataRef)result);
+}
+
+std::string stringAttribute(CFDictionaryRef attributes, CFStringRef key) {
+    const auto value = CFDictionaryGetValue(attributes, key);
+    if (value == nullptr || CFGetTypeID(value) != CFStringGetTypeID())
+        return "";
+    return CFStringToStdString(static_cast<CFStringRef>(value));
+}
+
+std::chrono::system_clock::time_point dateAttribute(CFDictionaryRef attributes,
+                                                    CFStringRef key) {
+    const auto value = CFDictionaryGetValue(attributes, key);
+    if (value == nullptr || CFGetTypeID(value) != CFDateGetTypeID())
+        return {};
+
+    const std::chrono::duration<double> sinceEpoch(
+        CFDateGetAbsoluteTime(static_cast<CFDateRef>(value)) +
+        kCFAbsoluteTimeIntervalSince1970);
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            sinceEpoch));
+}
+
+/*! \brief Converts an item's attribute dictionary to keychain::Metadata
+ *
+ * Note that the service is left empty, as only the caller knows how to strip
+ * the package from the item's service name.
+ */
+keychain::Metadata makeMetadata(CFDictionaryRef attributes) {
+    keychain::Metadata metadata;
+    metadata.user = stringAttribute(attributes, kSecAttrAccount);
+    metadata.label = stringAttribute(attributes, kSecAttrLabel);
+    metadata.created = dateAttribute(attributes, kSecAttrCreationDate);
+    metadata.modified = dateAttribute(attributes, kSecAttrModificationDate);
+    metadata.attributes["service"] =
+        stringAttribute(attributes, kSecAttrService);
+    metadata.attributes["account"] = metadata.user;
+    return metadata;
+}
+
+} // namespace
+
+namespace keychain {
+
+void OsBackend::setPassword(const Key &key, const std::string &password,
+                            Error &err) {
+    storeData(key,
+              reinterpret_cast<const unsigned char *>(password.data()),
+              password.size(),
+              err);
+}
+
+std::string OsBackend::getPassword(const Key &key, Error &err) {
+    const auto cfPassword = copyData(key, err);
 
     if (!cfPassword || err.type != keychain::ErrorType::NoError)
         return "";
@@ -258,25 +352,138 @@ std::string getPassword(const std::string &package, const std::string &service,
         CFDataGetLength(cfPassword.get()));
 }
 
-void deletePassword(const std::string &package, const std::string &service,
-                    const std::string &user, Error &err) {
+void OsBackend::withPassword(const Key &key, PasswordViewCallback callback,
+                             void *context, Error &err) {
+    const auto cfPassword = copyData(key, err);
+
+    if (!cfPassword || err.type != keychain::ErrorType::NoError)
+        return;
+
+    callback(reinterpret_cast<const char *>(CFDataGetBytePtr(cfPassword.get())),
+             CFDataGetLength(cfPassword.get()),
+             context);
+}
+
+void OsBackend::setSecret(const Key &key, const unsigned char *data,
+                          std::size_t size, Error &err) {
+    storeData(key, data, size, err);
+}
+
+std::vector<unsigned char> OsBackend::getSecret(const Key &key, Error &err) {
+    const auto cfSecret = copyData(key, err);
+
+    if (!cfSecret || err.type != keychain::ErrorType::NoError)
+        return {};
+
+    const auto bytes = CFDataGetBytePtr(cfSecret.get());
+    return std::vector<unsigned char>(bytes,
+                                      bytes + CFDataGetLength(cfSecret.get()));
+}
+
+void OsBackend::deletePassword(const Key &key, Error &err) {
     err = Error{};
-    const auto serviceName = makeServiceName(package, service);
-    const auto query = createQuery(serviceName, user, err);
+    const auto &native = key.native();
 
-    if (err.type != keychain::ErrorType::NoError)
+    if (native.error) {
+        err = native.error;
         return;
+    }
 
-    updateError(err, SecItemDelete(query.get()));
+    updateError(err, SecItemDelete(native.query.get()));
 }
 
-bool isAvailable(Error &err) {
+bool OsBackend::hasPassword(const Key &key, Error &err) {
+    err = Error{};
+    const auto &native = key.native();
+
+    if (native.error) {
+        err = native.error;
+        return false;
+    }
+
+    // no kSecReturnData: only the item's attributes are matched
+    const OSStatus status = SecItemCopyMatching(native.query.get(), nullptr);
+
+    if (status == errSecItemNotFound)
+        return false;
+
+    updateError(err, status);
+    return status == errSecSuccess;
+}
+
+Metadata OsBackend::getMetadata(const Key &key, Error &err) {
+    err = Error{};
+    auto query = copyQuery(key, err);
+
+    if (err.type != keychain::ErrorType::NoError)
+        return Metadata{};
+
+    CFDictionaryAddValue(query.get(), kSecReturnAttributes, kCFBooleanTrue);
+
+    CFTypeRef result = nullptr;
+    updateError(err, SecItemCopyMatching(query.get(), &result));
+    const auto attributes =
+        ScopedCFRef<CFDictionaryRef>((CFDictionaryRef)result);
+
+    if (!attributes || err.type != keychain::ErrorType::NoError)
+        return Metadata{};
+
+    auto metadata = makeMetadata(attributes.get());
+    metadata.service = key.service();
+    return metadata;
+}
+
+std::vector<Metadata> OsBackend::getAllMetadata(const std::string &package,
+                                                Error &err) {
+    err = Error{};
+    std::vector<Metadata> metadata;
+    auto query = createCFMutableDictionary(err);
+
+    if (err.type != keychain::ErrorType::NoError)
+        return metadata;
+
+    CFDictionaryAddValue(query.get(), kSecClass, kSecClassGenericPassword);
+    CFDictionaryAddValue(query.get(), kSecReturnAttributes, kCFBooleanTrue);
+    CFDictionaryAddValue(query.get(), kSecMatchLimit, kSecMatchLimitAll);
+
+    CFTypeRef result = nullptr;
+    const OSStatus status = SecItemCopyMatching(query.get(), &result);
+    const auto items = ScopedCFRef<CFArrayRef>((CFArrayRef)result);
+
+    if (status == errSecItemNotFound)
+        return metadata;
+
+    updateError(err, status);
+    if (!items || err.type != keychain::ErrorType::NoError)
+        return metadata;
+
+    // Keychain Services cannot match a service name prefix, so the package is
+    // filtered here
+    const auto prefix = makeServiceName(package, "");
+    for (CFIndex i = 0; i < CFArrayGetCount(items.get()); ++i) {
+        const auto attributes = static_cast<CFDictionaryRef>(
+            CFArrayGetValueAtIndex(items.get(), i));
+        auto item = makeMetadata(attributes);
+        const auto &serviceName = item.attributes["service"];
+
+        if (serviceName.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        item.service = serviceName.substr(prefix.size());
+        metadata.push_back(std::move(item));
+    }
+
+    return metadata;
+}
+
+bool OsBackend::isAvailable(Error &err) {
     err = Error{};
 
     auto query = createCFMutableDictionary(err);
     if (!query) {
         err.type = ErrorType::Unavailable;
-        err.message = "Failed to create query dictionary";
+        err.message =
+            ErrorMessage::literal("Failed to create query dictionary");
         return false;
     }
 
@@ -288,7 +495,8 @@ bool isAvailable(Error &err) {
         createCFStringWithCString("keychain_availability_check_account", err);
     if (!service || !account) {
         err.type = ErrorType::Unavailable;
-        err.message = "Failed to create service/account string";
+        err.message =
+            ErrorMessage::literal("Failed to create service/account string");
         return false;
     }
 
@@ -300,7 +508,8 @@ bool isAvailable(Error &err) {
     // TEST HOOK: Simulate SecItemCopyMatching failure
     if (getenv("KEYCHAIN_TEST_SIMULATED_FAILURE")) {
         err.type = ErrorType::Unavailable;
-        err.message = "Simulated failure: SecItemCopyMatching";
+        err.message =
+            ErrorMessage::literal("Simulated failure: SecItemCopyMatching");
         return false;
     }
 #endif
@@ -311,8 +520,10 @@ bool isAvailable(Error &err) {
         return true;
     } else {
         err.type = ErrorType::Unavailable;
-        err.message = errorStatusToString(status);
+        err.message = ErrorMessage::deferred(
+            [](int code) { return errorStatusToString(code); }, status);
         return false;
     }
 }
+
 } // namespace keychain
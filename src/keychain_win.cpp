@@ -25,6 +25,7 @@
 
 // clang-format off
 // make sure windows.h is included before wincred.h
+#include "basic_keychain.h"
 #include "keychain.h"
 
 #include <memory>
@@ -47,6 +48,16 @@ struct LpwstrDeleter {
 //! Wrapper around a WCHAR pointer a.k.a. LPWStr to take care of memory handling
 using ScopedLpwstr = std::unique_ptr<WCHAR, LpwstrDeleter>;
 
+struct CredentialDeleter {
+    void operator()(CREDENTIAL *cred) const {
+        SecureZeroMemory(cred->CredentialBlob, cred->CredentialBlobSize);
+        ::CredFree(cred);
+    }
+};
+
+//! Wrapper around a CREDENTIAL that wipes the credential blob before freeing it
+using ScopedCredential = std::unique_ptr<CREDENTIAL, CredentialDeleter>;
+
 /*! \brief Converts a UTF-8 std::string to wide char
  *
  * Uses MultiByteToWideChar to convert the input string and wraps the result in
@@ -81,17 +92,18 @@ ScopedLpwstr utf8ToWideChar(const std::string &utf8) {
 
 /*! \brief Converts a wide char pointer to a std::string
  *
- * Note that this function provides no reliable indication of errors and simply
- * returns an empty string in case it fails.
+ * The result is encoded using the given code page. Note that this function
+ * provides no reliable indication of errors and simply returns an empty string
+ * in case it fails.
  */
-std::string wideCharToAnsi(LPWSTR wChar) {
+std::string wideCharToString(LPCWSTR wChar, UINT codePage) {
     std::string result;
     if (wChar == nullptr) {
         return result;
     }
 
     int requiredBufSize = WideCharToMultiByte(
-        CP_ACP,
+        codePage,
         0, // flags
         wChar,
         -1,       // rely on null-terminated input string
@@ -106,8 +118,14 @@ std::string wideCharToAnsi(LPWSTR wChar) {
     }
 
     std::unique_ptr<char[]> buffer(new char[requiredBufSize]);
-    int bytesWritten = WideCharToMultiByte(
-        CP_ACP, 0, wChar, -1, buffer.get(), requiredBufSize, nullptr, nullptr);
+    int bytesWritten = WideCharToMultiByte(codePage,
+                                           0,
+                                           wChar,
+                                           -1,
+                                           buffer.get(),
+                                           requiredBufSize,
+                                           nullptr,
+                                           nullptr);
 
     if (bytesWritten != 0) {
         result = std::string(buffer.get());
@@ -132,7 +150,7 @@ std::string getErrorMessage(DWORD errorCode) {
         nullptr); // no additional arguments
 
     if (written > 0 && errBuffer != nullptr) {
-        errMsg = wideCharToAnsi(errBuffer);
+        errMsg = wideCharToString(errBuffer, CP_ACP);
         LocalFree(errBuffer);
     }
     return errMsg;
@@ -145,7 +163,13 @@ void updateError(keychain::Error &err) {
         return;
     }
 
-    err.message = getErrorMessage(code);
+    // formatting the message is comparatively expensive and not needed for
+    // expected errors such as ERROR_NOT_FOUND, so it is deferred
+    err.message = keychain::ErrorMessage::deferred(
+        [](int errorCode) {
+            return getErrorMessage(static_cast<DWORD>(errorCode));
+        },
+        static_cast<int>(code));
     err.code = code;
     err.type = err.code == ERROR_NOT_FOUND ? keychain::ErrorType::NotFound
                                            : keychain::ErrorType::GenericError;
@@ -165,7 +189,8 @@ ScopedLpwstr makeTargetName(const std::string &package,
         // make really sure that we set an error code if we will return nullptr
         if (!err) {
             err.type = keychain::ErrorType::GenericError;
-            err.message = "Failed to create credential target name.";
+            err.message = keychain::ErrorMessage::literal(
+                "Failed to create credential target name.");
             err.code = -1; // generic non-zero
         }
     }
@@ -173,39 +198,89 @@ ScopedLpwstr makeTargetName(const std::string &package,
     return result;
 }
 
+/*! \brief Converts a FILETIME to a std::chrono::system_clock::time_point
+ *
+ * FILETIME counts 100-nanosecond intervals since January 1, 1601 (UTC).
+ */
+std::chrono::system_clock::time_point fromFileTime(const FILETIME &fileTime) {
+    const unsigned long long sinceWindowsEpoch =
+        (static_cast<unsigned long long>(fileTime.dwHighDateTime) << 32) |
+        fileTime.dwLowDateTime;
+    const unsigned long long windowsToUnixEpoch = 116444736000000000ULL;
+
+    if (sinceWindowsEpoch < windowsToUnixEpoch) {
+        return {};
+    }
+
+    const std::chrono::microseconds sinceUnixEpoch(
+        (sinceWindowsEpoch - windowsToUnixEpoch) / 10);
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            sinceUnixEpoch));
+}
+
+//! \brief Converts a credential to keychain::Metadata, leaving service empty
+keychain::Metadata makeMetadata(const CREDENTIAL &cred) {
+    keychain::Metadata metadata;
+    metadata.user = wideCharToString(cred.UserName, CP_UTF8);
+    metadata.label = wideCharToString(cred.TargetName, CP_UTF8);
+    metadata.modified = fromFileTime(cred.LastWritten);
+    metadata.created = metadata.modified;
+    metadata.attributes["target"] = metadata.label;
+    return metadata;
+}
+
 } // namespace
 
 namespace keychain {
 
-void setPassword(const std::string &package, const std::string &service,
-                 const std::string &user, const std::string &password,
-                 Error &err) {
-    err = Error{};
-    auto target_name = makeTargetName(package, service, user, err);
-    if (err) {
-        return;
+//! \brief The wide char target and user name of a Key
+struct Key::Native {
+    explicit Native(const Key &key)
+        : target_name(makeTargetName(
+              key.package(), key.service(), key.user(), error)),
+          user_name(utf8ToWideChar(key.user())) {
+        if (!error && !user_name) {
+            updateError(error);
+        }
     }
 
-    ScopedLpwstr user_name(utf8ToWideChar(user));
-    if (!user_name) {
-        updateError(err);
+    //! \brief Set if the names could not be converted
+    Error error;
+    ScopedLpwstr target_name;
+    ScopedLpwstr user_name;
+};
+
+std::shared_ptr<const Key::Native> Key::makeNative(const Key &key) {
+    return std::make_shared<const Native>(key);
+}
+
+} // namespace keychain
+
+namespace {
+
+void writeCredential(const keychain::Key &key, const unsigned char *data,
+                     std::size_t size, keychain::Error &err) {
+    err = keychain::Error{};
+    const auto &native = key.native();
+    if (native.error) {
+        err = native.error;
         return;
     }
 
-    if (password.size() > CRED_MAX_CREDENTIAL_BLOB_SIZE ||
-        password.size() > DWORD_MAX) {
-        err.type = ErrorType::PasswordTooLong;
-        err.message = "Password too long.";
+    if (size > CRED_MAX_CREDENTIAL_BLOB_SIZE || size > DWORD_MAX) {
+        err.type = keychain::ErrorType::PasswordTooLong;
+        err.message = keychain::ErrorMessage::literal("Password too long.");
         err.code = -1; // generic non-zero
         return;
     }
 
     CREDENTIAL cred = {};
     cred.Type = kCredType;
-    cred.TargetName = target_name.get();
-    cred.UserName = user_name.get();
-    cred.CredentialBlobSize = static_cast<DWORD>(password.size());
-    cred.CredentialBlob = (LPBYTE)(password.data());
+    cred.TargetName = native.target_name.get();
+    cred.UserName = native.user_name.get();
+    cred.CredentialBlobSize = static_cast<DWORD>(size);
+    cred.CredentialBlob = const_cast<LPBYTE>(data);
     cred.Persist = CRED_PERSIST_ENTERPRISE;
 
     if (::CredWrite(&cred, 0) == FALSE) {
@@ -213,44 +288,157 @@ void setPassword(const std::string &package, const std::string &service,
     }
 }
 
-std::string getPassword(const std::string &package, const std::string &service,
-                        const std::string &user, Error &err) {
-    err = Error{};
-    std::string password;
-
-    auto target_name = makeTargetName(package, service, user, err);
-    if (err) {
-        return password;
+//! \brief Read the credential of a Key; returns nullptr on failure
+ScopedCredential readCredential(const keychain::Key &key,
+                                keychain::Error &err) {
+    err = keychain::Error{};
+    const auto &native = key.native();
+    if (native.error) {
+        err = native.error;
+        return nullptr;
     }
 
     CREDENTIAL *cred;
-    bool result = ::CredRead(target_name.get(), kCredType, 0, &cred);
-
-    if (result == TRUE) {
-        password = std::string(reinterpret_cast<char *>(cred->CredentialBlob),
-                               cred->CredentialBlobSize);
-        ::CredFree(cred);
-    } else {
+    if (::CredRead(native.target_name.get(), kCredType, 0, &cred) == FALSE) {
         updateError(err);
+        return nullptr;
+    }
+
+    return ScopedCredential(cred);
+}
+
+} // namespace
+
+namespace keychain {
+
+void OsBackend::setPassword(const Key &key, const std::string &password,
+                            Error &err) {
+    writeCredential(key,
+                    reinterpret_cast<const unsigned char *>(password.data()),
+                    password.size(),
+                    err);
+}
+
+std::string OsBackend::getPassword(const Key &key, Error &err) {
+    const auto cred = readCredential(key, err);
+    if (!cred) {
+        return "";
+    }
+
+    return std::string(reinterpret_cast<char *>(cred->CredentialBlob),
+                       cred->CredentialBlobSize);
+}
+
+void OsBackend::withPassword(const Key &key, PasswordViewCallback callback,
+                             void *context, Error &err) {
+    const auto cred = readCredential(key, err);
+    if (!cred) {
+        return;
+    }
+
+    callback(reinterpret_cast<const char *>(cred->CredentialBlob),
+             cred->CredentialBlobSize,
+             context);
+}
+
+void OsBackend::setSecret(const Key &key, const unsigned char *data,
+                          std::size_t size, Error &err) {
+    writeCredential(key, data, size, err);
+}
+
+std::vector<unsigned char> OsBackend::getSecret(const Key &key, Error &err) {
+    const auto cred = readCredential(key, err);
+    if (!cred) {
+        return {};
     }
 
-    return password;
+    return std::vector<unsigned char>(
+        cred->CredentialBlob, cred->CredentialBlob + cred->CredentialBlobSize);
 }
 
-void deletePassword(const std::string &package, const std::string &service,
-                    const std::string &user, Error &err) {
+void OsBackend::deletePassword(const Key &key, Error &err) {
     err = Error{};
-    auto target_name = makeTargetName(package, service, user, err);
-    if (err) {
+    const auto &native = key.native();
+    if (native.error) {
+        err = native.error;
         return;
     }
 
-    if (::CredDelete(target_name.get(), kCredType, 0) == FALSE) {
+    if (::CredDelete(native.target_name.get(), kCredType, 0) == FALSE) {
         updateError(err);
     }
 }
 
-bool isAvailable(Error &err) {
+bool OsBackend::hasPassword(const Key &key, Error &err) {
+    // Credential Manager has no attribute-only lookup; discard the blob
+    const auto cred = readCredential(key, err);
+
+    if (err.type == ErrorType::NotFound) {
+        err = Error{};
+    }
+    return cred != nullptr;
+}
+
+Metadata OsBackend::getMetadata(const Key &key, Error &err) {
+    const auto cred = readCredential(key, err);
+    if (!cred) {
+        return Metadata{};
+    }
+
+    auto metadata = makeMetadata(*cred);
+    metadata.service = key.service();
+    return metadata;
+}
+
+std::vector<Metadata> OsBackend::getAllMetadata(const std::string &package,
+                                                Error &err) {
+    err = Error{};
+    std::vector<Metadata> metadata;
+
+    // target names are "package.service/user", see makeTargetName
+    const std::string prefix = package + ".";
+    ScopedLpwstr filter(utf8ToWideChar(prefix + "*"));
+    if (!filter) {
+        updateError(err);
+        return metadata;
+    }
+
+    DWORD count = 0;
+    CREDENTIAL **creds;
+    if (::CredEnumerate(filter.get(), 0, &count, &creds) == FALSE) {
+        updateError(err);
+        if (err.type == ErrorType::NotFound) {
+            err = Error{};
+        }
+        return metadata;
+    }
+
+    for (DWORD i = 0; i < count; ++i) {
+        if (creds[i]->Type != kCredType) {
+            continue;
+        }
+
+        auto item = makeMetadata(*creds[i]);
+        const auto &target = item.label;
+        const auto suffix = "/" + item.user;
+
+        if (target.size() < prefix.size() + suffix.size() ||
+            target.compare(0, prefix.size(), prefix) != 0 ||
+            target.compare(
+                target.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            continue;
+        }
+
+        item.service = target.substr(
+            prefix.size(), target.size() - prefix.size() - suffix.size());
+        metadata.push_back(std::move(item));
+    }
+
+    ::CredFree(creds);
+    return metadata;
+}
+
+bool OsBackend::isAvailable(Error &err) {
     // Credential Manager is always present on Windows;
     // any runtime errors will surface in get/set/delete.
     err = Error{};
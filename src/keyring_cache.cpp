@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "keyring_cache.h"
+
+#include "default_keychain.h"
+#include "locked_memory.h"
+#include "stats.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include <linux/keyctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The cache is best effort: if the kernel refuses an operation, e.g. because
+// the user's key quota is exhausted, we simply fall back to the backend.
+namespace {
+
+const char *const KeyType = "user";
+
+// Limits of the kernel's "user" key type
+constexpr std::size_t MaxDescriptionSize = 4095;
+constexpr std::size_t MaxPayloadSize = 32767;
+
+// Possessor: everything. User: view, read, write, search and setattr, so that
+// processes not possessing the user keyring can still use the entries.
+constexpr unsigned long Permissions = 0x3f2f0000;
+
+// Prefixes the description of an entry's tombstone, see invalidate
+constexpr char TombstonePrefix[] = "invalidated:";
+
+// How long a tombstone keeps passwords from being cached. This exceeds the
+// D-Bus timeout of 25 s, so that reads overlapping a write are all covered.
+constexpr unsigned long TombstoneTimeout = 30;
+
+constexpr std::size_t TombstonePrefixSize = sizeof(TombstonePrefix) - 1;
+
+/*! \brief An unambiguous description of a key's entry and of its tombstone
+ *
+ * The tombstone's description is the entry's with TombstonePrefix in front.
+ * Both are built in place, so that invalidating an entry on each write does
+ * not allocate.
+ */
+class Description {
+  public:
+    explicit Description(const keychain::Key &key) noexcept {
+        append(TombstonePrefix, TombstonePrefixSize);
+        append("keychain:", 9);
+        for (const std::string *part : {&key.package(), &key.service(),
+                                        &key.user()}) {
+            appendNumber(part->size());
+            append(":", 1);
+            append(part->data(), part->size());
+        }
+        if (valid()) {
+            _buffer[_size] = '\0';
+        }
+    }
+
+    Description(const Description &) = delete;
+    Description &operator=(const Description &) = delete;
+
+    //! \brief Whether the tombstone's description is within the kernel's limit
+    bool valid() const noexcept { return _size <= MaxDescriptionSize; }
+
+    const char *entry() const noexcept {
+        return _buffer + TombstonePrefixSize;
+    }
+    const char *tombstone() const noexcept { return _buffer; }
+
+  private:
+    void append(const char *data, std::size_t size) noexcept {
+        if (_size <= MaxDescriptionSize && size <= MaxDescriptionSize - _size) {
+            std::memcpy(_buffer + _size, data, size);
+        }
+        _size += size; // counted even if it does not fit, see valid
+    }
+
+    void appendNumber(std::size_t number) noexcept {
+        char digits[20];
+        char *const end = digits + sizeof(digits);
+        char *begin = end;
+        do {
+            *--begin = static_cast<char>('0' + number % 10);
+            number /= 10;
+        } while (number != 0);
+        append(begin, static_cast<std::size_t>(end - begin));
+    }
+
+    char _buffer[MaxDescriptionSize + 1];
+    std::size_t _size = 0;
+};
+
+long search(const char *description) {
+    return syscall(SYS_keyctl,
+                   KEYCTL_SEARCH,
+                   KEY_SPEC_USER_KEYRING,
+                   KeyType,
+                   description,
+                   0);
+}
+
+void remove(long id) {
+    if (syscall(SYS_keyctl, KEYCTL_INVALIDATE, id) != 0) {
+        // kernels older than 3.5
+        syscall(SYS_keyctl, KEYCTL_UNLINK, id, KEY_SPEC_USER_KEYRING);
+    }
+}
+
+void removeDescribed(const char *description) {
+    const long id = search(description);
+    if (id >= 0) {
+        remove(id);
+    }
+}
+
+void wipe(std::string &str) {
+    keychain::detail::secureWipe(&str[0], str.size());
+}
+
+//! \brief Add a key with a timeout, returning its ID or -1 on failure
+long add(const char *description, const char *payload, std::size_t size,
+         unsigned long timeout) {
+    const long id = syscall(SYS_add_key,
+                            KeyType,
+                            description,
+                            payload,
+                            size,
+                            KEY_SPEC_USER_KEYRING);
+    if (id < 0) {
+        return -1;
+    }
+
+    if (syscall(SYS_keyctl, KEYCTL_SETPERM, id, Permissions) != 0 ||
+        syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, timeout) != 0) {
+        remove(id); // never keep a key without a timeout
+        return -1;
+    }
+    return id;
+}
+
+} // namespace
+
+namespace keychain {
+
+KeyringCache::KeyringCache(std::chrono::seconds ttl) noexcept : _ttl(ttl) {}
+
+bool KeyringCache::lookup(const Key &key, std::string &password) {
+    const Description description(key);
+    if (!description.valid()) {
+        recordCount(Counter::KeyringCacheMisses);
+        return false;
+    }
+    const long id = search(description.entry());
+    if (id < 0) {
+        recordCount(Counter::KeyringCacheMisses);
+        return false; // not cached, or expired
+    }
+
+    // most passwords are short, retry with the actual size if this is not
+    std::string buffer(256, '\0');
+    for (;;) {
+        const long size =
+            syscall(SYS_keyctl, KEYCTL_READ, id, &buffer[0], buffer.size());
+        if (size < 0) {
+            wipe(buffer);
+            recordCount(Counter::KeyringCacheMisses);
+            return false;
+        } else if (static_cast<std::size_t>(size) <= buffer.size()) {
+            password.assign(buffer.data(), static_cast<std::size_t>(size));
+            wipe(buffer);
+            recordCount(Counter::KeyringCacheHits);
+            return true;
+        }
+        wipe(buffer);
+        buffer.resize(static_cast<std::size_t>(size));
+    }
+}
+
+void KeyringCache::store(const Key &key, const std::string &password) {
+    const Description description(key);
+    if (!description.valid()) {
+        return;
+    } else if (_ttl <= std::chrono::seconds::zero() || password.empty() ||
+               password.size() > MaxPayloadSize) {
+        // don't leave a previous password behind
+        removeDescribed(description.entry());
+        return;
+    }
+
+    // replaces the payload of an existing entry
+    const long id = add(description.entry(),
+                        password.data(),
+                        password.size(),
+                        static_cast<unsigned long>(_ttl.count()));
+
+    // The password may have been read before a write that invalidated the
+    // entry in the meantime. Checking only after adding the entry closes the
+    // gap to invalidate, which adds the tombstone before removing the entry.
+    if (id >= 0 && search(description.tombstone()) >= 0) {
+        remove(id);
+    }
+}
+
+void KeyringCache::invalidate(const Key &key) {
+    const Description description(key);
+    if (!description.valid()) {
+        return;
+    }
+
+    // keeps reads that overlapped the write from caching a stale password
+    const char marker = 0;
+    add(description.tombstone(), &marker, 1, TombstoneTimeout);
+    removeDescribed(description.entry());
+}
+
+namespace detail {
+
+void invalidateKeyring(const Key &key) { KeyringCache().invalidate(key); }
+
+void FreeBackend::setPassword(const Key &key, const std::string &password,
+                              Error &err) {
+    OsBackend::setPassword(key, password, err);
+    invalidateKeyring(key);
+}
+
+void FreeBackend::setSecret(const Key &key, const unsigned char *data,
+                            std::size_t size, Error &err) {
+    OsBackend::setSecret(key, data, size, err);
+    invalidateKeyring(key);
+}
+
+void FreeBackend::deletePassword(const Key &key, Error &err) {
+    OsBackend::deletePassword(key, err);
+    invalidateKeyring(key);
+}
+
+} // namespace detail
+
+} // namespace keychain
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "locked_memory.h"
+
+#ifdef KEYCHAIN_WINDOWS
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace keychain {
+namespace detail {
+
+void secureWipe(void *data, std::size_t size) {
+#ifdef KEYCHAIN_WINDOWS
+    SecureZeroMemory(data, size);
+#else
+    // volatile prevents the compiler from eliding the writes
+    volatile unsigned char *p = static_cast<volatile unsigned char *>(data);
+    while (size--) {
+        *p++ = 0;
+    }
+#endif
+}
+
+std::size_t pageSize() {
+#ifdef KEYCHAIN_WINDOWS
+    static const std::size_t size = []() {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<std::size_t>(info.dwPageSize);
+    }();
+#else
+    static const std::size_t size =
+        static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    return size;
+}
+
+std::size_t roundToPages(std::size_t size) {
+    const auto page = pageSize();
+    return (size + page - 1) / page * page;
+}
+
+unsigned char *mapGuarded(std::size_t size, bool &locked) {
+    const auto page = pageSize();
+    const auto total = size + 2 * page;
+
+#ifdef KEYCHAIN_WINDOWS
+    auto base = static_cast<unsigned char *>(
+        VirtualAlloc(nullptr, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (base == nullptr) {
+        return nullptr;
+    }
+
+    DWORD previous;
+    VirtualProtect(base, page, PAGE_NOACCESS, &previous);
+    VirtualProtect(base + page + size, page, PAGE_NOACCESS, &previous);
+    locked = VirtualLock(base + page, size) != FALSE;
+#else
+    auto base = static_cast<unsigned char *>(mmap(nullptr,
+                                                  total,
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS,
+                                                  -1,
+                                                  0));
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+
+    mprotect(base, page, PROT_NONE);
+    mprotect(base + page + size, page, PROT_NONE);
+    locked = mlock(base + page, size) == 0;
+#ifdef MADV_DONTDUMP
+    madvise(base + page, size, MADV_DONTDUMP);
+#endif
+#endif
+
+    return base + page;
+}
+
+void unmapGuarded(unsigned char *data, std::size_t size) {
+    const auto page = pageSize();
+
+#ifdef KEYCHAIN_WINDOWS
+    VirtualUnlock(data, size);
+    VirtualFree(data - page, 0, MEM_RELEASE);
+#else
+    munlock(data, size);
+    munmap(data - page, size + 2 * page);
+#endif
+}
+
+void protectGuarded(unsigned char *data, std::size_t size, bool readOnly) {
+#ifdef KEYCHAIN_WINDOWS
+    DWORD previous;
+    VirtualProtect(
+        data, size, readOnly ? PAGE_READONLY : PAGE_READWRITE, &previous);
+#else
+    mprotect(data, size, readOnly ? PROT_READ : PROT_READ | PROT_WRITE);
+#endif
+}
+
+} // namespace detail
+} // namespace keychain
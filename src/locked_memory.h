@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef XPLATFORM_KEYCHAIN_LOCKED_MEMORY_H_
+#define XPLATFORM_KEYCHAIN_LOCKED_MEMORY_H_
+
+#include <cstddef>
+
+// Page-granular memory that is locked into RAM, excluded from core dumps and
+// surrounded by inaccessible guard pages, as used by SecureString and
+// Snapshot.
+namespace keychain {
+namespace detail {
+
+//! \brief Overwrite memory with zeros in a way the compiler cannot elide
+void secureWipe(void *data, std::size_t size);
+
+std::size_t pageSize();
+
+std::size_t roundToPages(std::size_t size);
+
+/*! \brief Map `size` bytes surrounded by inaccessible guard pages
+ *
+ * `size` must be a multiple of the page size. The usable memory is locked if
+ * possible, which is reported via `locked`. Returns nullptr on failure.
+ */
+unsigned char *mapGuarded(std::size_t size, bool &locked);
+
+//! \brief Release memory obtained from mapGuarded
+void unmapGuarded(unsigned char *data, std::size_t size);
+
+//! \brief Make memory obtained from mapGuarded read-only, or writable again
+void protectGuarded(unsigned char *data, std::size_t size, bool readOnly);
+
+} // namespace detail
+} // namespace keychain
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "memory_cache.h"
+
+#include "secure_string.h"
+#include "stats.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace keychain {
+
+struct MemoryCache::State {
+    struct Entry {
+        SecureString password;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
+    explicit State(std::chrono::steady_clock::duration ttl) : ttl(ttl) {}
+
+    const std::chrono::steady_clock::duration ttl;
+    mutable std::mutex mutex;
+    std::unordered_map<Key, Entry> entries;
+};
+
+MemoryCache::MemoryCache(std::chrono::steady_clock::duration ttl)
+    : _state(std::make_shared<State>(ttl)) {}
+
+bool MemoryCache::lookup(const Key &key, std::string &password) {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+
+    auto it = _state->entries.find(key);
+    if (it == _state->entries.end()) {
+        recordCount(Counter::MemoryCacheMisses);
+        return false;
+    } else if (it->second.expiry <= std::chrono::steady_clock::now()) {
+        _state->entries.erase(it);
+        recordCount(Counter::MemoryCacheMisses);
+        return false;
+    }
+
+    password.assign(it->second.password.data(), it->second.password.size());
+    recordCount(Counter::MemoryCacheHits);
+    return true;
+}
+
+void MemoryCache::store(const Key &key, const std::string &password) {
+    if (_state->ttl <= std::chrono::steady_clock::duration::zero()) {
+        return; // would expire right away
+    }
+
+    State::Entry entry{SecureString(password.data(), password.size()),
+                       std::chrono::steady_clock::now() + _state->ttl};
+
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    auto it = _state->entries.find(key);
+    if (it != _state->entries.end()) {
+        it->second = std::move(entry);
+    } else {
+        _state->entries.emplace(key, std::move(entry));
+    }
+}
+
+void MemoryCache::invalidate(const Key &key) {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    _state->entries.erase(key);
+}
+
+void MemoryCache::clear() {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    _state->entries.clear();
+}
+
+std::size_t MemoryCache::size() const {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    return _state->entries.size();
+}
+
+} // namespace keychain
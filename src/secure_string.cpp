@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "secure_string.h"
+
+#include "locked_memory.h"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+using keychain::detail::mapGuarded;
+using keychain::detail::roundToPages;
+using keychain::detail::secureWipe;
+using keychain::detail::unmapGuarded;
+
+//! \brief Size classes are powers of two from MinClassSize to MaxClassSize
+const std::size_t MinClassSize = 32;
+const std::size_t ClassCount = 8;
+const std::size_t MaxClassSize = MinClassSize << (ClassCount - 1);
+
+//! \brief The usable size of a slab, which is split into blocks of one class
+const std::size_t SlabSize = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+/*! \brief A lock that never throws, unlike std::mutex
+ *
+ * SecureString releases its memory from noexcept functions, including its
+ * destructor. The pool only holds the lock for a few list operations, or
+ * while mapping a string exceeding the largest size class.
+ */
+class SpinLock {
+  public:
+    void lock() noexcept {
+        while (_locked.test_and_set(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock() noexcept { _locked.clear(std::memory_order_release); }
+
+  private:
+    std::atomic_flag _locked = ATOMIC_FLAG_INIT;
+};
+
+/*! \brief The process-wide pool backing SecureString
+ *
+ * Slabs are never returned to the OS; their blocks are recycled via the free
+ * lists instead.
+ */
+class SecurePool {
+  public:
+    static SecurePool &instance() {
+        // intentionally leaked, so that SecureStrings with static storage
+        // duration can still be freed during static destruction
+        static SecurePool *pool = new SecurePool;
+        return *pool;
+    }
+
+    /*! \brief Allocate at least `capacity` bytes
+     *
+     * `capacity` is updated to the size actually allocated, which must be
+     * passed to deallocate.
+     */
+    unsigned char *allocate(std::size_t &capacity) {
+        std::lock_guard<SpinLock> lock(_lock);
+
+        if (capacity > MaxClassSize) {
+            capacity = roundToPages(capacity);
+            bool locked = false;
+            auto data = mapGuarded(capacity, locked);
+            if (data == nullptr) {
+                throw std::bad_alloc();
+            }
+            try {
+                _large.emplace(data, locked);
+            } catch (...) {
+                // the mapping is not tracked, so it would be leaked otherwise
+                unmapGuarded(data, capacity);
+                throw;
+            }
+            account(capacity, locked);
+            _stats.usedBytes += capacity;
+            ++_stats.allocations;
+            return data;
+        }
+
+        std::size_t index = 0;
+        while ((MinClassSize << index) < capacity) {
+            ++index;
+        }
+        capacity = MinClassSize << index;
+
+        if (_freeLists[index] == nullptr) {
+            addSlab(index);
+        }
+
+        auto block = _freeLists[index];
+        _freeLists[index] = block->next;
+        _stats.usedBytes += capacity;
+        ++_stats.allocations;
+        return reinterpret_cast<unsigned char *>(block);
+    }
+
+    //! \brief Wipe and release memory obtained from allocate
+    void deallocate(unsigned char *data, std::size_t capacity) {
+        secureWipe(data, capacity);
+        std::lock_guard<SpinLock> lock(_lock);
+
+        _stats.usedBytes -= capacity;
+        --_stats.allocations;
+
+        if (capacity > MaxClassSize) {
+            _stats.reservedBytes -= capacity;
+            const auto large = _large.find(data);
+            if (large->second) {
+                _stats.lockedBytes -= capacity;
+            }
+            _large.erase(large);
+            unmapGuarded(data, capacity);
+            return;
+        }
+
+        std::size_t index = 0;
+        while ((MinClassSize << index) < capacity) {
+            ++index;
+        }
+
+        auto block = reinterpret_cast<FreeBlock *>(data);
+        block->next = _freeLists[index];
+        _freeLists[index] = block;
+    }
+
+    keychain::SecurePoolStats stats() {
+        std::lock_guard<SpinLock> lock(_lock);
+        return _stats;
+    }
+
+  private:
+    void account(std::size_t size, bool locked) {
+        _stats.reservedBytes += size;
+        if (locked) {
+            _stats.lockedBytes += size;
+        }
+    }
+
+    void addSlab(std::size_t index) {
+        bool locked = false;
+        auto slab = mapGuarded(SlabSize, locked);
+        if (slab == nullptr) {
+            throw std::bad_alloc();
+        }
+        account(SlabSize, locked);
+
+        const auto blockSize = MinClassSize << index;
+        for (std::size_t offset = SlabSize; offset >= blockSize;) {
+            offset -= blockSize;
+            auto block = reinterpret_cast<FreeBlock *>(slab + offset);
+            block->next = _freeLists[index];
+            _freeLists[index] = block;
+        }
+    }
+
+    SpinLock _lock;
+    FreeBlock *_freeLists[ClassCount] = {};
+
+    //! \brief Mappings of strings exceeding MaxClassSize and if they are locked
+    std::unordered_map<unsigned char *, bool> _large;
+
+    keychain::SecurePoolStats _stats;
+};
+
+} // namespace
+
+namespace keychain {
+
+SecureString::SecureString(std::size_t size) {
+    // zero-filled, as blocks are wiped when freed and mappings start zeroed
+    _capacity = size + 1;
+    _data = reinterpret_cast<char *>(
+        SecurePool::instance().allocate(_capacity));
+    std::memset(_data, 0, size + 1);
+    _size = size;
+}
+
+SecureString::SecureString(const char *data, std::size_t size)
+    : SecureString(size) {
+    std::memcpy(_data, data, size);
+}
+
+SecureString::~SecureString() { clear(); }
+
+SecureString::SecureString(SecureString &&other) noexcept
+    : _data(other._data), _size(other._size), _capacity(other._capacity) {
+    other._data = nullptr;
+    other._size = 0;
+    other._capacity = 0;
+}
+
+SecureString &SecureString::operator=(SecureString &&other) noexcept {
+    if (this != &other) {
+        clear();
+        _data = other._data;
+        _size = other._size;
+        _capacity = other._capacity;
+        other._data = nullptr;
+        other._size = 0;
+        other._capacity = 0;
+    }
+    return *this;
+}
+
+void SecureString::assign(const char *data, std::size_t size) {
+    if (_data != nullptr && size < _capacity) {
+        std::memcpy(_data, data, size);
+        secureWipe(_data + size, _capacity - size);
+        _size = size;
+        return;
+    }
+
+    *this = SecureString(data, size);
+}
+
+void SecureString::clear() noexcept {
+    if (_data != nullptr) {
+        SecurePool::instance().deallocate(
+            reinterpret_cast<unsigned char *>(_data), _capacity);
+    }
+    _data = nullptr;
+    _size = 0;
+    _capacity = 0;
+}
+
+SecurePoolStats securePoolStats() { return SecurePool::instance().stats(); }
+
+void getPassword(const std::string &package, const std::string &service,
+                 const std::string &user, SecureString &password, Error &err) {
+    getPassword(Key(package, service, user), password, err);
+}
+
+void getPassword(const Key &key, SecureString &password, Error &err) {
+    withPassword(
+        key,
+        [&](const char *data, std::size_t size) {
+            password.assign(data, size);
+        },
+        err);
+
+    if (err) {
+        password.clear();
+    }
+}
+
+} // namespace keychain
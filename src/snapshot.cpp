@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "snapshot.h"
+
+#include "locked_memory.h"
+#include "secure_string.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace keychain {
+
+/*! \brief Locates a password and its identifiers within the region
+ *
+ * The entries are sorted by hash and followed by the strings they refer to.
+ */
+struct Snapshot::Entry {
+    std::uint64_t hash;
+    std::uint64_t offset; // of package, service, user and password
+    std::uint32_t packageSize;
+    std::uint32_t serviceSize;
+    std::uint32_t userSize;
+    std::uint32_t passwordSize;
+};
+
+Snapshot::~Snapshot() { unmap(); }
+
+void Snapshot::unmap() noexcept {
+    if (_region != nullptr) {
+        detail::protectGuarded(_region, _size, false);
+        detail::secureWipe(_region, _size);
+        detail::unmapGuarded(_region, _size);
+    }
+    _region = nullptr;
+    _size = 0;
+    _entries = nullptr;
+    _count = 0;
+    _locked = false;
+    _invalidated.reset();
+}
+
+Snapshot::Snapshot(Snapshot &&other) noexcept { *this = std::move(other); }
+
+Snapshot &Snapshot::operator=(Snapshot &&other) noexcept {
+    if (this != &other) {
+        unmap();
+        std::swap(_region, other._region);
+        std::swap(_size, other._size);
+        std::swap(_entries, other._entries);
+        std::swap(_count, other._count);
+        std::swap(_locked, other._locked);
+        std::swap(_invalidated, other._invalidated);
+    }
+    return *this;
+}
+
+Snapshot Snapshot::fetch(const std::vector<Key> &keys, Error &err) {
+    // passwords are staged in the secure pool, never in ordinary heap memory
+    std::vector<std::pair<const Key *, SecureString>> found;
+    found.reserve(keys.size());
+
+    for (const auto &key : keys) {
+        SecureString password;
+        getPassword(key, password, err);
+        if (err.type == ErrorType::NotFound) {
+            continue;
+        } else if (err) {
+            return Snapshot();
+        }
+        found.emplace_back(&key, std::move(password));
+    }
+    err = Error{};
+
+    std::sort(found.begin(), found.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.first->hash() < rhs.first->hash();
+    });
+
+    std::size_t total = found.size() * sizeof(Entry);
+    for (const auto &item : found) {
+        total += item.first->package().size() + item.first->service().size() +
+                 item.first->user().size() + item.second.size();
+    }
+
+    Snapshot snapshot;
+    if (found.empty()) {
+        return snapshot;
+    }
+
+    snapshot._size = detail::roundToPages(total);
+    snapshot._region = detail::mapGuarded(snapshot._size, snapshot._locked);
+    if (snapshot._region == nullptr) {
+        snapshot._size = 0;
+        err.type = ErrorType::GenericError;
+        err.message = ErrorMessage::literal("Failed to map the snapshot.");
+        err.code = -1; // generic non-zero
+        return snapshot;
+    }
+
+    auto entries = reinterpret_cast<Entry *>(snapshot._region);
+    std::size_t offset = found.size() * sizeof(Entry);
+    auto append = [&](const char *data, std::size_t size) {
+        std::memcpy(snapshot._region + offset, data, size);
+        offset += size;
+        return static_cast<std::uint32_t>(size);
+    };
+
+    for (std::size_t i = 0; i < found.size(); ++i) {
+        const Key &key = *found[i].first;
+        const SecureString &password = found[i].second;
+        entries[i].hash = key.hash();
+        entries[i].offset = offset;
+        entries[i].packageSize =
+            append(key.package().data(), key.package().size());
+        entries[i].serviceSize =
+            append(key.service().data(), key.service().size());
+        entries[i].userSize = append(key.user().data(), key.user().size());
+        entries[i].passwordSize = append(password.data(), password.size());
+    }
+
+    detail::protectGuarded(snapshot._region, snapshot._size, true);
+    snapshot._entries = entries;
+    snapshot._count = found.size();
+    snapshot._invalidated.reset(new std::atomic<bool>[found.size()]());
+    return snapshot;
+}
+
+std::size_t Snapshot::indexOf(const Key &key) const noexcept {
+    auto it = std::lower_bound(
+        _entries,
+        _entries + _count,
+        key.hash(),
+        [](const Entry &entry, std::uint64_t hash) {
+            return entry.hash < hash;
+        });
+
+    for (; it != _entries + _count && it->hash == key.hash(); ++it) {
+        const auto identifiers =
+            reinterpret_cast<const char *>(_region + it->offset);
+        std::size_t at = 0;
+        const auto matches = [&](std::uint32_t size, const std::string &str) {
+            const auto data = identifiers + at;
+            at += size;
+            return size == str.size() &&
+                   std::memcmp(data, str.data(), size) == 0;
+        };
+
+        if (matches(it->packageSize, key.package()) &&
+            matches(it->serviceSize, key.service()) &&
+            matches(it->userSize, key.user())) {
+            return static_cast<std::size_t>(it - _entries);
+        }
+    }
+
+    return _count;
+}
+
+bool Snapshot::find(const Key &key, const char *&data,
+                    std::size_t &size) const noexcept {
+    const auto index = indexOf(key);
+    if (index == _count ||
+        _invalidated[index].load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    const Entry &entry = _entries[index];
+    data = reinterpret_cast<const char *>(_region + entry.offset) +
+           entry.packageSize + entry.serviceSize + entry.userSize;
+    size = entry.passwordSize;
+    return true;
+}
+
+void Snapshot::invalidate(const Key &key) const noexcept {
+    const auto index = indexOf(key);
+    if (index != _count) {
+        _invalidated[index].store(true, std::memory_order_relaxed);
+    }
+}
+
+} // namespace keychain
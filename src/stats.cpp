@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+// upper bounds of the buckets of the Prometheus histogram
+const struct {
+    std::int64_t ns;
+    const char *label;
+} PrometheusBuckets[] = {
+    {10000, "1e-05"},      {25000, "2.5e-05"},    {50000, "5e-05"},
+    {100000, "0.0001"},    {250000, "0.00025"},   {500000, "0.0005"},
+    {1000000, "0.001"},    {2500000, "0.0025"},   {5000000, "0.005"},
+    {10000000, "0.01"},    {25000000, "0.025"},   {50000000, "0.05"},
+    {100000000, "0.1"},    {250000000, "0.25"},   {500000000, "0.5"},
+    {1000000000, "1"},     {2500000000, "2.5"},   {5000000000, "5"},
+    {10000000000, "10"},
+};
+
+//! \brief How each Counter is exposed, grouped by metric
+const struct {
+    keychain::Counter counter;
+    const char *name;
+    const char *help;
+    const char *labels;
+} PrometheusCounters[] = {
+    {keychain::Counter::RoundTrips,
+     "keychain_dbus_round_trips_total",
+     "D-Bus method calls to the Secret Service.",
+     ""},
+    {keychain::Counter::UnlockPrompts,
+     "keychain_unlock_prompts_total",
+     "Prompts shown to unlock a collection.",
+     ""},
+    {keychain::Counter::SecretBytesRead,
+     "keychain_secret_bytes_total",
+     "Bytes of secrets transferred from or to the credentials storage.",
+     "{direction=\"read\"}"},
+    {keychain::Counter::SecretBytesWritten,
+     "keychain_secret_bytes_total",
+     nullptr,
+     "{direction=\"written\"}"},
+    {keychain::Counter::Retries,
+     "keychain_retries_total",
+     "Calls repeated after the connection was lost.",
+     ""},
+    {keychain::Counter::MemoryCacheHits,
+     "keychain_cache_hits_total",
+     "Passwords found in a cache.",
+     "{cache=\"memory\"}"},
+    {keychain::Counter::KeyringCacheHits,
+     "keychain_cache_hits_total",
+     nullptr,
+     "{cache=\"keyring\"}"},
+    {keychain::Counter::SnapshotHits,
+     "keychain_cache_hits_total",
+     nullptr,
+     "{cache=\"snapshot\"}"},
+    {keychain::Counter::MemoryCacheMisses,
+     "keychain_cache_misses_total",
+     "Passwords not found in a cache.",
+     "{cache=\"memory\"}"},
+    {keychain::Counter::KeyringCacheMisses,
+     "keychain_cache_misses_total",
+     nullptr,
+     "{cache=\"keyring\"}"},
+    {keychain::Counter::SnapshotMisses,
+     "keychain_cache_misses_total",
+     nullptr,
+     "{cache=\"snapshot\"}"},
+};
+
+//! \brief Append a formatted line to out
+#ifdef __GNUC__
+__attribute__((format(printf, 2, 3)))
+#endif
+void appendLine(std::string &out, const char *format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    const int size = std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (size > 0) {
+        out.append(line, std::min<std::size_t>(size, sizeof(line) - 1));
+    }
+    out += '\n';
+}
+
+} // namespace
+
+namespace keychain {
+
+Outcome outcomeOf(const Error &err) noexcept {
+    if (!err) {
+        return Outcome::Success;
+    }
+    return err.type == ErrorType::NotFound ? Outcome::NotFound
+                                           : Outcome::Error;
+}
+
+const char *outcomeName(Outcome outcome) noexcept {
+    static const char *const names[OutcomeCount] = {
+        "success",
+        "not_found",
+        "error",
+    };
+    return names[static_cast<std::size_t>(outcome)];
+}
+
+const char *statsBackendName(StatsBackend backend) noexcept {
+    static const char *const names[StatsBackendCount] = {
+        "os",
+        "agent",
+    };
+    return names[static_cast<std::size_t>(backend)];
+}
+
+const LatencyHistogram *Stats::latency(Operation operation,
+                                       StatsBackend backend,
+                                       Outcome outcome) const noexcept {
+    for (const auto &entry : operations) {
+        if (entry.operation == operation && entry.backend == backend &&
+            entry.outcome == outcome) {
+            return &entry.latency;
+        }
+    }
+    return nullptr;
+}
+
+//! \brief The latencies of one kind of operation, recorded concurrently
+class Recorder {
+  public:
+    void record(std::chrono::steady_clock::duration latency) noexcept {
+        const auto ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency);
+        _buckets[LatencyHistogram::bucketOf(ns)].fetch_add(
+            1, std::memory_order_relaxed);
+        _total.fetch_add(static_cast<std::uint64_t>(ns.count()),
+                         std::memory_order_relaxed);
+    }
+
+    //! \brief Add the latencies to histogram, resetting them if reset is true
+    void collect(LatencyHistogram &histogram, bool reset) noexcept {
+        for (std::size_t i = 0; i < LatencyHistogram::BucketCount; ++i) {
+            const std::uint64_t count =
+                reset ? _buckets[i].exchange(0, std::memory_order_relaxed)
+                      : _buckets[i].load(std::memory_order_relaxed);
+            histogram._buckets[i] += count;
+            histogram._count += count;
+        }
+        const std::uint64_t total =
+            reset ? _total.exchange(0, std::memory_order_relaxed)
+                  : _total.load(std::memory_order_relaxed);
+        histogram._total += std::chrono::nanoseconds(total);
+    }
+
+  private:
+    std::atomic<std::uint64_t> _buckets[LatencyHistogram::BucketCount];
+    std::atomic<std::uint64_t> _total;
+};
+
+namespace {
+
+// zero-initialized as a static, and untouched pages stay unallocated
+Recorder recorders[OperationCount][StatsBackendCount][OutcomeCount];
+std::atomic<std::uint64_t> counters[CounterCount];
+
+} // namespace
+
+Stats stats(bool reset) {
+    Stats result;
+    for (std::size_t op = 0; op < OperationCount; ++op) {
+        for (std::size_t backend = 0; backend < StatsBackendCount; ++backend) {
+            for (std::size_t outcome = 0; outcome < OutcomeCount; ++outcome) {
+                OperationStats entry{static_cast<Operation>(op),
+                                     static_cast<StatsBackend>(backend),
+                                     static_cast<Outcome>(outcome),
+                                     LatencyHistogram()};
+                recorders[op][backend][outcome].collect(entry.latency, reset);
+                if (entry.latency.count() > 0) {
+                    result.operations.push_back(std::move(entry));
+                }
+            }
+        }
+    }
+    for (std::size_t i = 0; i < CounterCount; ++i) {
+        result.counters[i] =
+            reset ? counters[i].exchange(0, std::memory_order_relaxed)
+                  : counters[i].load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void resetStats() { stats(true); }
+
+void recordLatency(Operation operation, StatsBackend backend,
+                   const Error &err,
+                   std::chrono::steady_clock::duration latency) noexcept {
+    recorders[static_cast<std::size_t>(operation)]
+             [static_cast<std::size_t>(backend)]
+             [static_cast<std::size_t>(outcomeOf(err))]
+                 .record(latency);
+}
+
+void recordCount(Counter counter, std::uint64_t amount) noexcept {
+    counters[static_cast<std::size_t>(counter)].fetch_add(
+        amount, std::memory_order_relaxed);
+}
+
+std::string toPrometheusText(const Stats &stats) {
+    std::string out;
+    const char *const histogram = "keychain_operation_duration_seconds";
+    appendLine(out,
+               "# HELP %s Latency of keychain operations.",
+               histogram);
+    appendLine(out, "# TYPE %s histogram", histogram);
+
+    for (const auto &entry : stats.operations) {
+        char labels[128];
+        std::snprintf(labels,
+                      sizeof(labels),
+                      "operation=\"%s\",backend=\"%s\",outcome=\"%s\"",
+                      operationName(entry.operation),
+                      statsBackendName(entry.backend),
+                      outcomeName(entry.outcome));
+
+        // buckets of the histogram straddling a limit count above it
+        const LatencyHistogram &latency = entry.latency;
+        std::size_t bucket = 0;
+        std::uint64_t count = 0;
+        for (const auto &limit : PrometheusBuckets) {
+            for (; bucket < LatencyHistogram::BucketCount &&
+                   LatencyHistogram::bucketLimit(bucket).count() <= limit.ns;
+                 ++bucket) {
+                count += latency.bucket(bucket);
+            }
+            appendLine(out,
+                       "%s_bucket{%s,le=\"%s\"} %" PRIu64,
+                       histogram,
+                       labels,
+                       limit.label,
+                       count);
+        }
+        appendLine(out,
+                   "%s_bucket{%s,le=\"+Inf\"} %" PRIu64,
+                   histogram,
+                   labels,
+                   latency.count());
+        appendLine(out,
+                   "%s_sum{%s} %.9f",
+                   histogram,
+                   labels,
+                   std::chrono::duration<double>(latency.total()).count());
+        appendLine(out,
+                   "%s_count{%s} %" PRIu64,
+                   histogram,
+                   labels,
+                   latency.count());
+    }
+
+    for (const auto &counter : PrometheusCounters) {
+        if (counter.help != nullptr) {
+            appendLine(out, "# HELP %s %s", counter.name, counter.help);
+            appendLine(out, "# TYPE %s counter", counter.name);
+        }
+        appendLine(out,
+                   "%s%s %" PRIu64,
+                   counter.name,
+                   counter.labels,
+                   stats.counter(counter.counter));
+    }
+    return out;
+}
+
+} // namespace keychain
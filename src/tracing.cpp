@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "tracing.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdlib>
+
+#if defined(KEYCHAIN_WINDOWS)
+#include <windows.h>
+#elif defined(KEYCHAIN_MACOS)
+#include <pthread.h>
+#include <unistd.h>
+#else
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<keychain::Tracer *> activeTracer{nullptr};
+
+const char *errorTypeName(keychain::ErrorType type) {
+    switch (type) {
+    case keychain::ErrorType::NoError:
+        return "NoError";
+    case keychain::ErrorType::GenericError:
+        return "GenericError";
+    case keychain::ErrorType::NotFound:
+        return "NotFound";
+    case keychain::ErrorType::Unavailable:
+        return "Unavailable";
+    case keychain::ErrorType::PasswordTooLong:
+        return "PasswordTooLong";
+    case keychain::ErrorType::AccessDenied:
+        return "AccessDenied";
+    }
+    return "Unknown";
+}
+
+std::uint64_t processId() {
+#if defined(KEYCHAIN_WINDOWS)
+    return GetCurrentProcessId();
+#else
+    return static_cast<std::uint64_t>(getpid());
+#endif
+}
+
+std::uint64_t threadId() {
+#if defined(KEYCHAIN_WINDOWS)
+    return GetCurrentThreadId();
+#elif defined(KEYCHAIN_MACOS)
+    std::uint64_t tid = 0;
+    pthread_threadid_np(nullptr, &tid);
+    return tid;
+#else
+    return static_cast<std::uint64_t>(syscall(SYS_gettid));
+#endif
+}
+
+//! \brief path with each "%p" replaced by the process ID
+std::string expandPath(const std::string &path) {
+    std::string expanded;
+    for (std::size_t i = 0; i < path.size(); ++i) {
+        if (path.compare(i, 2, "%p") == 0) {
+            expanded += std::to_string(processId());
+            ++i;
+        } else {
+            expanded += path[i];
+        }
+    }
+    return expanded;
+}
+
+double microseconds(std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+#ifdef KEYCHAIN_TRACING
+//! \brief The exporter registered for $KEYCHAIN_TRACE_FILE, if any
+keychain::ChromeTraceExporter *environmentExporter = nullptr;
+
+//! \brief Terminate the trace file when the program exits
+void closeEnvironmentTracer() {
+    keychain::Tracer *expected = environmentExporter;
+    activeTracer.compare_exchange_strong(expected, nullptr);
+    // leaked, operations ending on other threads may still hold it
+    environmentExporter->close();
+}
+
+//! \brief Registers a ChromeTraceExporter if $KEYCHAIN_TRACE_FILE is set
+const bool environmentTracer = [] {
+    const char *path = std::getenv("KEYCHAIN_TRACE_FILE");
+    if (path == nullptr || *path == '\0') {
+        return false;
+    }
+
+    auto exporter = new keychain::ChromeTraceExporter(path);
+    if (!exporter->isOpen()) {
+        std::fprintf(stderr, "keychain: cannot write trace to %s\n", path);
+        delete exporter;
+        return false;
+    }
+    environmentExporter = exporter;
+    std::atexit(&closeEnvironmentTracer);
+    keychain::setTracer(exporter);
+    return true;
+}();
+#endif
+
+} // namespace
+
+namespace keychain {
+
+void setTracer(Tracer *tracer) noexcept {
+    activeTracer.store(tracer, std::memory_order_release);
+}
+
+Tracer *tracer() noexcept {
+    return activeTracer.load(std::memory_order_acquire);
+}
+
+#ifdef KEYCHAIN_TRACING
+void traceBegin(Operation operation, StatsBackend backend,
+                std::uint64_t keyHash,
+                std::chrono::steady_clock::time_point start) noexcept {
+    if (Tracer *active = tracer()) {
+        active->begin(TraceEvent{operation,
+                                 backend,
+                                 keyHash,
+                                 start,
+                                 std::chrono::nanoseconds(0),
+                                 ErrorType::NoError});
+    }
+}
+
+void traceEnd(Operation operation, StatsBackend backend,
+              std::uint64_t keyHash,
+              std::chrono::steady_clock::time_point start,
+              std::chrono::steady_clock::duration latency,
+              ErrorType error) noexcept {
+    if (Tracer *active = tracer()) {
+        active->end(TraceEvent{
+            operation,
+            backend,
+            keyHash,
+            start,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency),
+            error});
+    }
+}
+#endif
+
+ChromeTraceExporter::ChromeTraceExporter(const std::string &path)
+    : _file(std::fopen(expandPath(path).c_str(), "w")) {
+    if (_file != nullptr) {
+        std::fputs("[\n", _file);
+        std::fflush(_file);
+    }
+}
+
+ChromeTraceExporter::~ChromeTraceExporter() { close(); }
+
+bool ChromeTraceExporter::isOpen() const noexcept {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _file != nullptr;
+}
+
+void ChromeTraceExporter::close() noexcept {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file != nullptr) {
+        std::fputs("\n]\n", _file);
+        std::fclose(_file);
+        _file = nullptr;
+    }
+}
+
+void ChromeTraceExporter::end(const TraceEvent &event) noexcept {
+    char line[512];
+    const int size = std::snprintf(
+        line,
+        sizeof(line),
+        "{\"name\":\"%s\",\"cat\":\"keychain\",\"ph\":\"X\",\"ts\":%.3f,"
+        "\"dur\":%.3f,\"pid\":%" PRIu64 ",\"tid\":%" PRIu64 ","
+        "\"args\":{\"backend\":\"%s\",\"key\":\"%016" PRIx64 "\","
+        "\"error\":\"%s\"}}",
+        operationName(event.operation),
+        microseconds(event.start.time_since_epoch()),
+        microseconds(event.duration),
+        processId(),
+        threadId(),
+        statsBackendName(event.backend),
+        event.keyHash,
+        errorTypeName(event.error));
+    if (size <= 0 || static_cast<std::size_t>(size) >= sizeof(line)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_file == nullptr) {
+        return;
+    } else if (!_first) {
+        std::fputs(",\n", _file);
+    }
+    _first = false;
+    std::fwrite(line, 1, static_cast<std::size_t>(size), _file);
+    std::fflush(_file);
+}
+
+} // namespace keychain
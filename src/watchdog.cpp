@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "watchdog.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace {
+
+//! \brief The number of operations that can be tracked at the same time
+constexpr std::size_t SlotCount = 256;
+
+/*! \brief An operation in flight, or a free slot
+ *
+ * Operations claim a free slot in watchBegin and release it in watchEnd,
+ * without taking a lock. `sequence` is odd while the slot is free or being
+ * filled, and even while it holds an operation; it is incremented twice for
+ * each operation, so the watchdog's thread can tell if the slot was reused
+ * while it read the fields (a seqlock).
+ */
+struct Slot {
+    std::atomic<bool> claimed{false};
+    std::atomic<std::uint64_t> sequence{1};
+    std::atomic<std::uint64_t> generation{0}; // of the watchdog tracking it
+
+    std::atomic<int> operation{0};
+    std::atomic<int> backend{0};
+    std::atomic<std::uint64_t> keyHash{0};
+    std::atomic<std::chrono::steady_clock::rep> start{0};
+    std::atomic<std::thread::id> thread{};
+};
+
+/*! \brief The operations in flight and the watchdog's thread
+ *
+ * Leaked, so operations ending during static destruction do not access a
+ * destroyed state.
+ */
+struct Watchdog {
+    std::array<Slot, SlotCount> slots;
+    std::atomic<std::size_t> nextSlot{0}; // where to look for a free slot
+
+    // the running watchdog's generation, zero while none is running
+    std::atomic<std::uint64_t> active{0};
+
+    std::mutex mutex; // guards the following
+    std::condition_variable wakeup;
+    std::uint64_t generation = 0; // incremented to stop the thread
+    std::thread thread;
+};
+
+Watchdog &watchdog() {
+    static Watchdog *state = new Watchdog();
+    return *state;
+}
+
+/*! \brief Read the operation in a slot
+ *
+ * \return false if the slot is free, was reused while reading, or belongs to
+ *         another watchdog
+ */
+bool read(const Slot &slot, std::uint64_t generation,
+          keychain::SlowOperation &operation,
+          std::chrono::steady_clock::time_point &start,
+          std::uint64_t &sequence) {
+    sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0) {
+        return false;
+    }
+
+    // acquiring the fields makes a reuse of the slot, which follows its
+    // release, visible to the second load of the sequence
+    const bool tracked =
+        slot.generation.load(std::memory_order_acquire) == generation;
+    operation.operation = static_cast<keychain::Operation>(
+        slot.operation.load(std::memory_order_acquire));
+    operation.backend = static_cast<keychain::StatsBackend>(
+        slot.backend.load(std::memory_order_acquire));
+    operation.keyHash = slot.keyHash.load(std::memory_order_acquire);
+    operation.thread = slot.thread.load(std::memory_order_acquire);
+    start = std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(
+            slot.start.load(std::memory_order_acquire)));
+
+    return tracked &&
+           slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+void watch(Watchdog &state, std::uint64_t generation,
+           std::chrono::steady_clock::duration threshold,
+           keychain::SlowOperationCallback callback) {
+    const auto interval = std::min<std::chrono::steady_clock::duration>(
+        std::max<std::chrono::steady_clock::duration>(
+            threshold / 4, std::chrono::milliseconds(1)),
+        std::chrono::seconds(1));
+
+    // the sequence of the operation last reported from each slot
+    std::vector<std::uint64_t> reported(SlotCount, 0);
+    std::vector<keychain::SlowOperation> slow;
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (!state.wakeup.wait_for(lock, interval, [&] {
+        return state.generation != generation;
+    })) {
+        lock.unlock();
+
+        const auto now = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < SlotCount; ++i) {
+            keychain::SlowOperation operation;
+            std::chrono::steady_clock::time_point start;
+            std::uint64_t sequence = 0;
+            if (read(state.slots[i], generation, operation, start, sequence) &&
+                reported[i] != sequence && now - start >= threshold) {
+                reported[i] = sequence;
+                operation.elapsed =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now - start);
+                slow.push_back(operation);
+            }
+        }
+
+        for (const auto &operation : slow) {
+            callback(operation);
+        }
+        slow.clear();
+
+        lock.lock();
+    }
+}
+
+//! \brief Wait for a thread replaced by a newer watchdog or stopped
+void retire(std::thread thread) {
+    if (!thread.joinable()) {
+        return;
+    } else if (thread.get_id() == std::this_thread::get_id()) {
+        thread.detach(); // called from the callback
+    } else {
+        thread.join();
+    }
+}
+
+} // namespace
+
+namespace keychain {
+
+void startWatchdog(std::chrono::steady_clock::duration threshold,
+                   SlowOperationCallback callback) {
+    Watchdog &state = watchdog();
+    std::thread previous;
+    {
+        // stopping the previous thread and starting the next one under the
+        // same lock keeps concurrent calls from assigning a joinable thread
+        std::lock_guard<std::mutex> lock(state.mutex);
+        const std::uint64_t generation = ++state.generation;
+        previous = std::move(state.thread);
+        state.thread = std::thread(&watch,
+                                   std::ref(state),
+                                   generation,
+                                   threshold,
+                                   std::move(callback));
+        state.active.store(generation, std::memory_order_release);
+    }
+    state.wakeup.notify_all();
+    retire(std::move(previous));
+}
+
+void stopWatchdog() {
+    Watchdog &state = watchdog();
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.active.store(0, std::memory_order_release);
+        ++state.generation;
+        thread = std::move(state.thread);
+    }
+    state.wakeup.notify_all();
+    retire(std::move(thread));
+}
+
+std::uint64_t watchBegin(Operation operation, StatsBackend backend,
+                         std::uint64_t keyHash,
+                         std::chrono::steady_clock::time_point start) noexcept {
+    Watchdog &state = watchdog();
+    const std::uint64_t generation =
+        state.active.load(std::memory_order_acquire);
+    if (generation == 0) {
+        return 0;
+    }
+
+    // operations in flight rarely fill many slots, so the first one tried is
+    // usually free
+    const std::size_t first =
+        state.nextSlot.fetch_add(1, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < SlotCount; ++i) {
+        const std::size_t index = (first + i) % SlotCount;
+        Slot &slot = state.slots[index];
+        bool expected = false;
+        if (slot.claimed.load(std::memory_order_relaxed) ||
+            !slot.claimed.compare_exchange_strong(
+                expected, true, std::memory_order_acquire)) {
+            continue;
+        }
+
+        // the sequence is odd, so readers ignore the fields written here
+        const std::uint64_t sequence =
+            slot.sequence.load(std::memory_order_relaxed);
+        slot.generation.store(generation, std::memory_order_release);
+        slot.operation.store(static_cast<int>(operation),
+                             std::memory_order_release);
+        slot.backend.store(static_cast<int>(backend),
+                           std::memory_order_release);
+        slot.keyHash.store(keyHash, std::memory_order_release);
+        slot.start.store(start.time_since_epoch().count(),
+                         std::memory_order_release);
+        slot.thread.store(std::this_thread::get_id(),
+                          std::memory_order_release);
+        slot.sequence.store(sequence + 1, std::memory_order_release);
+        return index + 1;
+    }
+
+    return 0; // all slots taken, not tracked rather than waiting
+}
+
+void watchEnd(std::uint64_t token) noexcept {
+    Slot &slot = watchdog().slots[token - 1];
+    slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_release);
+    slot.claimed.store(false, std::memory_order_release);
+}
+
+} // namespace keychain
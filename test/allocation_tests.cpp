@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* Allocation budgets for keychain's hot paths.
+ *
+ * This binary replaces the global operator new and, with glibc, interposes
+ * malloc, calloc and realloc, counting the allocations the current thread
+ * makes while a budget is measured. Operator new only sees the allocations
+ * of C++ code, i.e. of keychain's wrappers, caches and instrumentation, but
+ * not those of libsecret and GLib, which are C and differ between versions.
+ * Paths that never reach the backend are held to no allocations at all.
+ *
+ * Passwords are short enough for the small string optimization, so returning
+ * them does not allocate either.
+ */
+
+#include "catch_amalgamated.hpp"
+#include "keychain/basic_keychain.h"
+#include "keychain/keychain.h"
+#include "keychain/memory_cache.h"
+#include "keychain/snapshot.h"
+#include "keychain/stats.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+
+namespace {
+
+struct Allocations {
+    std::size_t news;    //!< calls of operator new
+    std::size_t mallocs; //!< calls of malloc and friends, including news
+};
+
+// trivially initialized, so that accessing them never allocates
+thread_local bool counting = false;
+thread_local Allocations counted = {0, 0};
+
+/*! \brief Count the allocations made by this thread while running f
+ *
+ * f must not use Catch's assertions, which allocate themselves.
+ */
+template <typename F> Allocations countAllocations(F f) {
+    counted = Allocations{0, 0};
+    counting = true;
+    f();
+    counting = false;
+    return counted;
+}
+
+void *allocate(std::size_t size) noexcept {
+    if (counting) {
+        ++counted.news;
+    }
+    return std::malloc(size != 0 ? size : 1);
+}
+
+} // namespace
+
+void *operator new(std::size_t size) {
+    if (void *ptr = allocate(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    std::free(ptr);
+}
+
+#ifdef __GLIBC__
+// glibc exports its allocator under these names as well, so it can be wrapped
+// without dlsym, which would allocate itself
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+void *malloc(std::size_t size) __THROW {
+    if (counting) {
+        ++counted.mallocs;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) __THROW {
+    if (counting) {
+        ++counted.mallocs;
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) __THROW {
+    if (counting) {
+        ++counted.mallocs;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+using namespace keychain;
+
+namespace {
+
+void check_no_error(const Error &ec) {
+    INFO("[" << ec.code << "] " << ec.message);
+    CHECK(!ec);
+}
+
+// hands out a constant password without touching any keychain
+struct ConstantBackend : OsBackend {
+    static std::string getPassword(const Key &, Error &err) {
+        err = Error{};
+        return "hunter2";
+    }
+};
+
+} // namespace
+
+TEST_CASE("Allocation budgets", "[allocations]") {
+    const std::string package = "com.example.keychain-allocation-tests";
+    const std::string service = "test_service";
+    const std::string user = "Admin";
+    const std::string password = "hunter2";
+    const Key key(package, service, user);
+
+    Error ec{};
+    std::string result;
+
+    SECTION("statistics add no allocations") {
+        BasicKeychain<ConstantBackend,
+                      NoCache,
+                      StatsInstrumentation<StatsBackend::Os>>
+            keychain;
+        keychain.getPassword(key, ec); // registers the recorders
+
+        const Allocations get =
+            countAllocations([&] { result = keychain.getPassword(key, ec); });
+        check_no_error(ec);
+        CHECK(result == password);
+        CHECK(get.news == 0);
+#ifdef __GLIBC__
+        CHECK(get.mallocs == 0);
+#endif
+    }
+
+    SECTION("cache hits do not allocate") {
+        setPassword(key, password, ec);
+        check_no_error(ec);
+
+        BasicKeychain<OsBackend, MemoryCache> cached{
+            OsBackend{}, MemoryCache(), NoInstrumentation{}};
+        cached.getPassword(key, ec); // fills the cache
+        check_no_error(ec);
+
+        const Allocations memoryHit =
+            countAllocations([&] { result = cached.getPassword(key, ec); });
+        check_no_error(ec);
+        CHECK(result == password);
+        CHECK(memoryHit.news == 0);
+#ifdef __GLIBC__
+        CHECK(memoryHit.mallocs == 0);
+#endif
+
+        auto snapshot = std::make_shared<Snapshot>(Snapshot::fetch({key}, ec));
+        check_no_error(ec);
+        SnapshotKeychain frozen{
+            SnapshotBackend{}, SnapshotCache(snapshot), NoInstrumentation{}};
+
+        const Allocations snapshotHit =
+            countAllocations([&] { result = frozen.getPassword(key, ec); });
+        check_no_error(ec);
+        CHECK(result == password);
+        CHECK(snapshotHit.news == 0);
+#ifdef __GLIBC__
+        CHECK(snapshotHit.mallocs == 0);
+#endif
+
+        deletePassword(key, ec);
+        check_no_error(ec);
+    }
+
+#ifdef KEYCHAIN_LINUX
+    SECTION("operations on a Key do not allocate outside of libsecret") {
+        // the first calls connect to the service
+        setPassword(key, password, ec);
+        check_no_error(ec);
+        getPassword(key, ec);
+        check_no_error(ec);
+
+        const Allocations set =
+            countAllocations([&] { setPassword(key, password, ec); });
+        check_no_error(ec);
+        CHECK(set.news == 0);
+
+        const Allocations get =
+            countAllocations([&] { result = getPassword(key, ec); });
+        check_no_error(ec);
+        CHECK(result == password);
+        CHECK(get.news == 0);
+
+        Result<std::string> found{std::string(), Error{}};
+        const Allocations getResult =
+            countAllocations([&] { found = getPassword(key); });
+        check_no_error(found.error());
+        CHECK(getResult.news == 0);
+
+        bool present = false;
+        const Allocations has =
+            countAllocations([&] { present = hasPassword(key, ec); });
+        check_no_error(ec);
+        CHECK(present);
+        CHECK(has.news == 0);
+
+        // the returned vector is the only allocation
+        const Allocations secret =
+            countAllocations([&] { getSecret(key, ec); });
+        check_no_error(ec);
+        CHECK(secret.news == 1);
+
+        const Allocations remove =
+            countAllocations([&] { deletePassword(key, ec); });
+        check_no_error(ec);
+        CHECK(remove.news == 0);
+
+        const Allocations notFound =
+            countAllocations([&] { getPassword(key, ec); });
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK(notFound.news == 0);
+
+        const Allocations removeNotFound =
+            countAllocations([&] { deletePassword(key, ec); });
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK(removeNotFound.news == 0);
+    }
+
+    SECTION("identifier overloads allocate only for their Key") {
+        const Allocations makeKey =
+            countAllocations([&] { const Key made(package, service, user); });
+
+        getPassword(package, service, user, ec); // connects to the service
+        const Allocations notFound =
+            countAllocations([&] { getPassword(package, service, user, ec); });
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK(notFound.news == makeKey.news);
+
+        const Allocations set = countAllocations(
+            [&] { setPassword(package, service, user, password, ec); });
+        check_no_error(ec);
+        CHECK(set.news == makeKey.news);
+
+        const Allocations get = countAllocations(
+            [&] { result = getPassword(package, service, user, ec); });
+        check_no_error(ec);
+        CHECK(result == password);
+        CHECK(get.news == makeKey.news);
+
+        deletePassword(key, ec);
+        check_no_error(ec);
+    }
+#endif
+}
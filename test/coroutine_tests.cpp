@@ -0,0 +1,86 @@
+// coroutine.h requires C++20, hence a binary of its own
+
+#include "catch_amalgamated.hpp"
+#include "keychain/coroutine.h"
+#include "keychain/keychain.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+using namespace keychain;
+
+namespace {
+
+// a coroutine that starts right away and is not awaited by anyone
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+Detached roundTrip(Key key, std::string password, std::string &retrieved,
+                   Error &result, std::atomic<bool> &done) {
+    result = co_await keychain::set(key, password);
+    if (!result) {
+        auto stored = co_await keychain::get(key);
+        retrieved = stored.value();
+        result = co_await keychain::remove(key);
+    }
+    done = true;
+}
+
+Detached lookup(Key key, Error &result, std::atomic<bool> &done) {
+    auto stored = co_await keychain::get(key);
+    result = stored.error();
+    done = true;
+}
+
+// wait up to ten seconds for a detached coroutine to finish
+void await(const std::atomic<bool> &done) {
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!done && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(done);
+}
+
+} // namespace
+
+TEST_CASE("Coroutines", "[keychain][coroutine]") {
+    const std::string package = "com.example.keychain-tests";
+    const std::string service = "test_service";
+    const std::string user = "Admin";
+    const std::string password = "hunter2";
+
+    SECTION("operations can be awaited in coroutines") {
+        std::string retrieved;
+        Error result{};
+        std::atomic<bool> done{false};
+        roundTrip(Key(package, service, user),
+                  password,
+                  retrieved,
+                  result,
+                  done);
+
+        await(done);
+        INFO(result.message);
+        CHECK(!result);
+        CHECK(retrieved == password);
+    }
+
+    SECTION("awaiting a missing password yields NotFound") {
+        Error result{};
+        std::atomic<bool> done{false};
+        lookup(Key(package, service, user), result, done);
+
+        await(done);
+        CHECK(result.type == ErrorType::NotFound);
+    }
+}
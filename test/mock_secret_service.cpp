@@ -0,0 +1,893 @@
+/*
+ * Copyright (c) 2019 Hannes Rantzsch, René Meusel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/* keychain-mock-secret-service is an in-memory implementation of the parts of
+ * the Secret Service API (org.freedesktop.secrets) that libsecret uses for
+ * keychain's operations. Unlike gnome-keyring it does no disk I/O and no
+ * cryptography, so its latency is stable across machines and versions, and
+ * it can inject latency, errors and hangs to exercise keychain's error and
+ * timeout handling.
+ *
+ * Only the "plain" session algorithm is supported. All items live in a single,
+ * always unlocked collection, which is also the "default" alias. Items are
+ * indexed by their attributes, so searches stay fast with millions of items.
+ *
+ * The mock prints "ready" to stdout once it owns org.freedesktop.secrets.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <gio/gio.h>
+
+namespace {
+
+const char *const BusName = "org.freedesktop.secrets";
+const char *const ServicePath = "/org/freedesktop/secrets";
+const char *const CollectionPath = "/org/freedesktop/secrets/collection/login";
+const char *const AliasPath = "/org/freedesktop/secrets/aliases/default";
+const char *const SessionsPath = "/org/freedesktop/secrets/session";
+
+const char *const ServiceInterface = "org.freedesktop.Secret.Service";
+const char *const CollectionInterface = "org.freedesktop.Secret.Collection";
+const char *const ItemInterface = "org.freedesktop.Secret.Item";
+const char *const SessionInterface = "org.freedesktop.Secret.Session";
+
+const char *const LabelProperty = "org.freedesktop.Secret.Item.Label";
+const char *const AttributesProperty = "org.freedesktop.Secret.Item.Attributes";
+
+const char *const Introspection = R"xml(
+<node>
+  <interface name="org.freedesktop.Secret.Service">
+    <method name="OpenSession">
+      <arg name="algorithm" type="s" direction="in"/>
+      <arg name="input" type="v" direction="in"/>
+      <arg name="output" type="v" direction="out"/>
+      <arg name="result" type="o" direction="out"/>
+    </method>
+    <method name="SearchItems">
+      <arg name="attributes" type="a{ss}" direction="in"/>
+      <arg name="unlocked" type="ao" direction="out"/>
+      <arg name="locked" type="ao" direction="out"/>
+    </method>
+    <method name="Unlock">
+      <arg name="objects" type="ao" direction="in"/>
+      <arg name="unlocked" type="ao" direction="out"/>
+      <arg name="prompt" type="o" direction="out"/>
+    </method>
+    <method name="GetSecrets">
+      <arg name="items" type="ao" direction="in"/>
+      <arg name="session" type="o" direction="in"/>
+      <arg name="secrets" type="a{o(oayays)}" direction="out"/>
+    </method>
+    <method name="ReadAlias">
+      <arg name="name" type="s" direction="in"/>
+      <arg name="collection" type="o" direction="out"/>
+    </method>
+    <property name="Collections" type="ao" access="read"/>
+  </interface>
+  <interface name="org.freedesktop.Secret.Collection">
+    <method name="SearchItems">
+      <arg name="attributes" type="a{ss}" direction="in"/>
+      <arg name="results" type="ao" direction="out"/>
+    </method>
+    <method name="CreateItem">
+      <arg name="properties" type="a{sv}" direction="in"/>
+      <arg name="secret" type="(oayays)" direction="in"/>
+      <arg name="replace" type="b" direction="in"/>
+      <arg name="item" type="o" direction="out"/>
+      <arg name="prompt" type="o" direction="out"/>
+    </method>
+    <property name="Items" type="ao" access="read"/>
+    <property name="Label" type="s" access="read"/>
+    <property name="Locked" type="b" access="read"/>
+    <property name="Created" type="t" access="read"/>
+    <property name="Modified" type="t" access="read"/>
+  </interface>
+  <interface name="org.freedesktop.Secret.Item">
+    <method name="Delete">
+      <arg name="prompt" type="o" direction="out"/>
+    </method>
+    <method name="GetSecret">
+      <arg name="session" type="o" direction="in"/>
+      <arg name="secret" type="(oayays)" direction="out"/>
+    </method>
+    <method name="SetSecret">
+      <arg name="secret" type="(oayays)" direction="in"/>
+    </method>
+    <property name="Locked" type="b" access="read"/>
+    <property name="Attributes" type="a{ss}" access="read"/>
+    <property name="Label" type="s" access="read"/>
+    <property name="Created" type="t" access="read"/>
+    <property name="Modified" type="t" access="read"/>
+  </interface>
+  <interface name="org.freedesktop.Secret.Session">
+    <method name="Close"/>
+  </interface>
+</node>
+)xml";
+
+//! \brief Attributes sorted by name
+using Attributes = std::vector<std::pair<std::string, std::string>>;
+
+struct Item {
+    Attributes attributes;
+    std::string label;
+    std::string secret;
+    std::string contentType;
+    guint64 created;
+    guint64 modified;
+};
+
+/*! \brief Items indexed by their attributes
+ *
+ * Each (name, value) pair maps to the ids of the items having it. Ids are
+ * never reused, so deleted items are dropped from these lists lazily.
+ */
+class Store {
+  public:
+    std::uint64_t add(Item item) {
+        const std::uint64_t id = _nextId++;
+        for (const auto &attribute : item.attributes) {
+            Posting &posting = _index[hashOf(attribute)];
+            posting.ids.push_back(id);
+            ++posting.live;
+        }
+        _items.emplace(id, std::move(item));
+        return id;
+    }
+
+    void remove(std::uint64_t id) {
+        auto it = _items.find(id);
+        if (it == _items.end()) {
+            return;
+        }
+        const Attributes attributes = std::move(it->second.attributes);
+        _items.erase(it);
+
+        for (const auto &attribute : attributes) {
+            const std::uint64_t hash = hashOf(attribute);
+            Posting &posting = _index[hash];
+            if (--posting.live == 0) {
+                _index.erase(hash);
+            } else if (posting.ids.size() > 2 * posting.live + 16) {
+                compact(posting, attribute);
+            }
+        }
+    }
+
+    Item *find(std::uint64_t id) {
+        auto it = _items.find(id);
+        return it != _items.end() ? &it->second : nullptr;
+    }
+
+    //! \brief Items having all of the query's attributes
+    std::vector<std::uint64_t> search(const Attributes &query) const {
+        std::vector<std::uint64_t> found;
+        if (query.empty()) {
+            for (const auto &item : _items) {
+                found.push_back(item.first);
+            }
+            return found;
+        }
+
+        // scan the shortest list of candidates
+        const Posting *shortest = nullptr;
+        for (const auto &attribute : query) {
+            auto it = _index.find(hashOf(attribute));
+            if (it == _index.end()) {
+                return found;
+            } else if (!shortest ||
+                       it->second.ids.size() < shortest->ids.size()) {
+                shortest = &it->second;
+            }
+        }
+
+        for (const std::uint64_t id : shortest->ids) {
+            auto it = _items.find(id);
+            if (it != _items.end() && matches(it->second.attributes, query)) {
+                found.push_back(id);
+            }
+        }
+        return found;
+    }
+
+    std::vector<std::uint64_t> all() const { return search(Attributes()); }
+
+  private:
+    struct Posting {
+        std::vector<std::uint64_t> ids;
+        std::size_t live = 0;
+    };
+
+    static std::uint64_t
+    hashOf(const std::pair<std::string, std::string> &attribute) {
+        // FNV-1a, with a separator that cannot occur in D-Bus strings
+        std::uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const std::string &str) {
+            for (const char c : str) {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 1099511628211ull;
+            }
+            hash *= 1099511628211ull;
+        };
+        mix(attribute.first);
+        mix(attribute.second);
+        return hash;
+    }
+
+    static bool matches(const Attributes &attributes, const Attributes &query) {
+        for (const auto &wanted : query) {
+            bool found = false;
+            for (const auto &attribute : attributes) {
+                if (attribute == wanted) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void compact(Posting &posting,
+                 const std::pair<std::string, std::string> &attribute) {
+        const Attributes query{attribute};
+        std::vector<std::uint64_t> ids;
+        ids.reserve(posting.live);
+        for (const std::uint64_t id : posting.ids) {
+            auto it = _items.find(id);
+            if (it != _items.end() && matches(it->second.attributes, query)) {
+                ids.push_back(id);
+            }
+        }
+        posting.ids.swap(ids);
+    }
+
+    std::unordered_map<std::uint64_t, Item> _items;
+    std::unordered_map<std::uint64_t, Posting> _index;
+    std::uint64_t _nextId = 1;
+};
+
+//! \brief Faults injected into calls of a method
+struct Fault {
+    guint latencyMs = 0;
+    double errorRate = 0;
+    double hangRate = 0;
+};
+
+struct Mock {
+    Store store;
+    std::unordered_set<std::uint64_t> sessions;
+    std::uint64_t nextSession = 1;
+    guint64 created = static_cast<guint64>(std::time(nullptr));
+    guint64 modified = created;
+
+    // by method name, "*" applying to all methods not listed
+    std::map<std::string, Fault> faults;
+    std::mt19937_64 random{1};
+    std::vector<GDBusMethodInvocation *> hung;
+
+    GDBusNodeInfo *introspection = nullptr;
+    GMainLoop *loop = nullptr;
+    bool acquired = false;
+};
+
+guint64 now() { return static_cast<guint64>(std::time(nullptr)); }
+
+std::string itemPath(std::uint64_t id) {
+    return std::string(CollectionPath) + "/" + std::to_string(id);
+}
+
+//! \brief Parse the id of a child of `parent`, 0 if path is none
+std::uint64_t childId(const char *path, const char *parent) {
+    const std::size_t length = std::strlen(parent);
+    if (!path || std::strncmp(path, parent, length) != 0 ||
+        path[length] != '/') {
+        return 0;
+    }
+    char *end = nullptr;
+    const auto id = std::strtoull(path + length + 1, &end, 10);
+    return *end == '\0' ? id : 0;
+}
+
+Attributes parseAttributes(GVariant *dict) {
+    Attributes attributes;
+    GVariantIter iter;
+    g_variant_iter_init(&iter, dict);
+    const gchar *name = nullptr;
+    const gchar *value = nullptr;
+    while (g_variant_iter_next(&iter, "{&s&s}", &name, &value)) {
+        attributes.emplace_back(name, value);
+    }
+    std::sort(attributes.begin(), attributes.end());
+    return attributes;
+}
+
+GVariant *buildAttributes(const Attributes &attributes) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
+    for (const auto &attribute : attributes) {
+        g_variant_builder_add(&builder,
+                              "{ss}",
+                              attribute.first.c_str(),
+                              attribute.second.c_str());
+    }
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *buildPaths(const std::vector<std::uint64_t> &ids) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("ao"));
+    for (const std::uint64_t id : ids) {
+        g_variant_builder_add(&builder, "o", itemPath(id).c_str());
+    }
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *buildBytes(const std::string &bytes) {
+    return g_variant_new_fixed_array(
+        G_VARIANT_TYPE_BYTE, bytes.data(), bytes.size(), 1);
+}
+
+//! \brief A secret as (session, parameters, value, content type)
+GVariant *buildSecret(const char *session, const Item &item) {
+    return g_variant_new("(o@ay@ays)",
+                         session,
+                         buildBytes(std::string()),
+                         buildBytes(item.secret),
+                         item.contentType.c_str());
+}
+
+void returnError(GDBusMethodInvocation *invocation, const char *name,
+                 const char *message) {
+    g_dbus_method_invocation_return_dbus_error(invocation, name, message);
+}
+
+void returnNoSuchObject(GDBusMethodInvocation *invocation) {
+    returnError(invocation,
+                "org.freedesktop.Secret.Error.NoSuchObject",
+                "No such item.");
+}
+
+void openSession(Mock &mock, GVariant *parameters,
+                 GDBusMethodInvocation *invocation) {
+    const gchar *algorithm = nullptr;
+    GVariant *input = nullptr;
+    g_variant_get(parameters, "(&sv)", &algorithm, &input);
+    g_variant_unref(input);
+
+    // makes libsecret fall back to "plain"
+    if (std::strcmp(algorithm, "plain") != 0) {
+        returnError(invocation,
+                    "org.freedesktop.DBus.Error.NotSupported",
+                    "Only the plain algorithm is supported.");
+        return;
+    }
+
+    const std::uint64_t id = mock.nextSession++;
+    mock.sessions.insert(id);
+    const std::string path =
+        std::string(SessionsPath) + "/" + std::to_string(id);
+    g_dbus_method_invocation_return_value(
+        invocation,
+        g_variant_new("(vo)", g_variant_new_string(""), path.c_str()));
+}
+
+void getSecrets(Mock &mock, GVariant *parameters,
+                GDBusMethodInvocation *invocation) {
+    GVariantIter *items = nullptr;
+    const gchar *session = nullptr;
+    g_variant_get(parameters, "(ao&o)", &items, &session);
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{o(oayays)}"));
+    const gchar *path = nullptr;
+    while (g_variant_iter_next(items, "&o", &path)) {
+        if (const Item *item = mock.store.find(childId(path, CollectionPath))) {
+            g_variant_builder_add(
+                &builder, "{o@(oayays)}", path, buildSecret(session, *item));
+        }
+    }
+    g_variant_iter_free(items);
+
+    g_dbus_method_invocation_return_value(
+        invocation,
+        g_variant_new("(@a{o(oayays)})", g_variant_builder_end(&builder)));
+}
+
+void createItem(Mock &mock, GVariant *parameters,
+                GDBusMethodInvocation *invocation) {
+    GVariant *properties = nullptr;
+    GVariant *secret = nullptr;
+    gboolean replace = FALSE;
+    g_variant_get(parameters, "(@a{sv}@(oayays)b)", &properties, &secret,
+                  &replace);
+
+    Item item;
+    const gchar *label = nullptr;
+    if (g_variant_lookup(properties, LabelProperty, "&s", &label)) {
+        item.label = label;
+    }
+    if (GVariant *attributes = g_variant_lookup_value(
+            properties, AttributesProperty, G_VARIANT_TYPE("a{ss}"))) {
+        item.attributes = parseAttributes(attributes);
+        g_variant_unref(attributes);
+    }
+    g_variant_unref(properties);
+
+    GVariant *value = nullptr;
+    const gchar *contentType = nullptr;
+    g_variant_get(secret, "(&o@ay@ay&s)", nullptr, nullptr, &value,
+                  &contentType);
+    gsize size = 0;
+    const auto *data =
+        static_cast<const char *>(g_variant_get_fixed_array(value, &size, 1));
+    item.secret.assign(data ? data : "", size);
+    item.contentType = contentType;
+    g_variant_unref(value);
+    g_variant_unref(secret);
+
+    item.created = item.modified = now();
+    mock.modified = item.modified;
+
+    std::uint64_t id = 0;
+    if (replace) {
+        for (const std::uint64_t candidate :
+             mock.store.search(item.attributes)) {
+            Item *existing = mock.store.find(candidate);
+            if (existing->attributes == item.attributes) {
+                existing->label = std::move(item.label);
+                existing->secret = std::move(item.secret);
+                existing->contentType = std::move(item.contentType);
+                existing->modified = item.modified;
+                id = candidate;
+                break;
+            }
+        }
+    }
+    if (id == 0) {
+        id = mock.store.add(std::move(item));
+    }
+
+    g_dbus_method_invocation_return_value(
+        invocation, g_variant_new("(oo)", itemPath(id).c_str(), "/"));
+}
+
+void callService(Mock &mock, const char *method, GVariant *parameters,
+                 GDBusMethodInvocation *invocation) {
+    if (std::strcmp(method, "OpenSession") == 0) {
+        openSession(mock, parameters, invocation);
+    } else if (std::strcmp(method, "SearchItems") == 0) {
+        GVariant *attributes = nullptr;
+        g_variant_get(parameters, "(@a{ss})", &attributes);
+        const auto found = mock.store.search(parseAttributes(attributes));
+        g_variant_unref(attributes);
+
+        // nothing is ever locked
+        g_dbus_method_invocation_return_value(
+            invocation,
+            g_variant_new("(@ao@ao)",
+                          buildPaths(found),
+                          buildPaths(std::vector<std::uint64_t>())));
+    } else if (std::strcmp(method, "Unlock") == 0) {
+        GVariant *objects = nullptr;
+        g_variant_get(parameters, "(@ao)", &objects);
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(@aoo)", objects, "/"));
+        g_variant_unref(objects);
+    } else if (std::strcmp(method, "GetSecrets") == 0) {
+        getSecrets(mock, parameters, invocation);
+    } else if (std::strcmp(method, "ReadAlias") == 0) {
+        const gchar *name = nullptr;
+        g_variant_get(parameters, "(&s)", &name);
+        g_dbus_method_invocation_return_value(
+            invocation,
+            g_variant_new("(o)",
+                          std::strcmp(name, "default") == 0 ? CollectionPath
+                                                            : "/"));
+    }
+}
+
+void callCollection(Mock &mock, const char *method, GVariant *parameters,
+                    GDBusMethodInvocation *invocation) {
+    if (std::strcmp(method, "SearchItems") == 0) {
+        GVariant *attributes = nullptr;
+        g_variant_get(parameters, "(@a{ss})", &attributes);
+        const auto found = mock.store.search(parseAttributes(attributes));
+        g_variant_unref(attributes);
+        g_dbus_method_invocation_return_value(
+            invocation, g_variant_new("(@ao)", buildPaths(found)));
+    } else if (std::strcmp(method, "CreateItem") == 0) {
+        createItem(mock, parameters, invocation);
+    }
+}
+
+void callItem(Mock &mock, const char *path, const char *method,
+              GVariant *parameters, GDBusMethodInvocation *invocation) {
+    const std::uint64_t id = childId(path, CollectionPath);
+    Item *item = mock.store.find(id);
+    if (!item) {
+        returnNoSuchObject(invocation);
+    } else if (std::strcmp(method, "Delete") == 0) {
+        mock.store.remove(id);
+        mock.modified = now();
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(o)", "/"));
+    } else if (std::strcmp(method, "GetSecret") == 0) {
+        const gchar *session = nullptr;
+        g_variant_get(parameters, "(&o)", &session);
+        g_dbus_method_invocation_return_value(
+            invocation,
+            g_variant_new("(@(oayays))", buildSecret(session, *item)));
+    } else if (std::strcmp(method, "SetSecret") == 0) {
+        GVariant *value = nullptr;
+        const gchar *contentType = nullptr;
+        g_variant_get(parameters, "((&o@ay@ay&s))", nullptr, nullptr, &value,
+                      &contentType);
+        gsize size = 0;
+        const auto *data = static_cast<const char *>(
+            g_variant_get_fixed_array(value, &size, 1));
+        item->secret.assign(data ? data : "", size);
+        item->contentType = contentType;
+        item->modified = now();
+        g_variant_unref(value);
+        g_dbus_method_invocation_return_value(invocation, nullptr);
+    }
+}
+
+//! \brief Answer a call, after any injected latency
+void reply(Mock &mock, GDBusMethodInvocation *invocation) {
+    const gchar *path = g_dbus_method_invocation_get_object_path(invocation);
+    const gchar *interface =
+        g_dbus_method_invocation_get_interface_name(invocation);
+    const gchar *method = g_dbus_method_invocation_get_method_name(invocation);
+    GVariant *parameters = g_dbus_method_invocation_get_parameters(invocation);
+
+    if (std::strcmp(interface, ServiceInterface) == 0) {
+        callService(mock, method, parameters, invocation);
+    } else if (std::strcmp(interface, CollectionInterface) == 0) {
+        callCollection(mock, method, parameters, invocation);
+    } else if (std::strcmp(interface, ItemInterface) == 0) {
+        callItem(mock, path, method, parameters, invocation);
+    } else if (std::strcmp(interface, SessionInterface) == 0) {
+        mock.sessions.erase(childId(path, SessionsPath));
+        g_dbus_method_invocation_return_value(invocation, nullptr);
+    }
+}
+
+struct DelayedReply {
+    Mock *mock;
+    GDBusMethodInvocation *invocation;
+};
+
+gboolean replyDelayed(gpointer data) {
+    auto *delayed = static_cast<DelayedReply *>(data);
+    reply(*delayed->mock, delayed->invocation);
+    delete delayed;
+    return G_SOURCE_REMOVE;
+}
+
+const Fault &faultFor(const Mock &mock, const char *method) {
+    static const Fault none;
+    auto it = mock.faults.find(method);
+    if (it == mock.faults.end()) {
+        it = mock.faults.find("*");
+    }
+    return it != mock.faults.end() ? it->second : none;
+}
+
+void handleMethodCall(GDBusConnection *, const gchar *, const gchar *,
+                      const gchar *, const gchar *method, GVariant *,
+                      GDBusMethodInvocation *invocation, gpointer data) {
+    Mock &mock = *static_cast<Mock *>(data);
+    const Fault &fault = faultFor(mock, method);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    if (fault.hangRate > 0 && uniform(mock.random) < fault.hangRate) {
+        mock.hung.push_back(invocation); // never answered
+    } else if (fault.errorRate > 0 && uniform(mock.random) < fault.errorRate) {
+        returnError(invocation,
+                    "org.freedesktop.DBus.Error.Failed",
+                    "Injected failure.");
+    } else if (fault.latencyMs > 0) {
+        g_timeout_add(fault.latencyMs,
+                      &replyDelayed,
+                      new DelayedReply{&mock, invocation});
+    } else {
+        reply(mock, invocation);
+    }
+}
+
+GVariant *getProperty(GDBusConnection *, const gchar *, const gchar *path,
+                      const gchar *interface, const gchar *property,
+                      GError **error, gpointer data) {
+    Mock &mock = *static_cast<Mock *>(data);
+
+    if (std::strcmp(interface, ServiceInterface) == 0) {
+        const gchar *const collections[] = {CollectionPath};
+        return g_variant_new_objv(collections, 1);
+    } else if (std::strcmp(interface, CollectionInterface) == 0) {
+        if (std::strcmp(property, "Items") == 0) {
+            return buildPaths(mock.store.all());
+        } else if (std::strcmp(property, "Label") == 0) {
+            return g_variant_new_string("Login");
+        } else if (std::strcmp(property, "Locked") == 0) {
+            return g_variant_new_boolean(FALSE);
+        }
+        return g_variant_new_uint64(std::strcmp(property, "Created") == 0
+                                        ? mock.created
+                                        : mock.modified);
+    }
+
+    const Item *item = mock.store.find(childId(path, CollectionPath));
+    if (!item) {
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED, "No such item.");
+        return nullptr;
+    } else if (std::strcmp(property, "Attributes") == 0) {
+        return buildAttributes(item->attributes);
+    } else if (std::strcmp(property, "Label") == 0) {
+        return g_variant_new_string(item->label.c_str());
+    } else if (std::strcmp(property, "Locked") == 0) {
+        return g_variant_new_boolean(FALSE);
+    }
+    return g_variant_new_uint64(std::strcmp(property, "Created") == 0
+                                    ? item->created
+                                    : item->modified);
+}
+
+const GDBusInterfaceVTable InterfaceVTable = {
+    &handleMethodCall, &getProperty, nullptr, {nullptr}};
+
+//! \brief Nodes are not enumerated, there may be millions of them
+gchar **enumerateNodes(GDBusConnection *, const gchar *, const gchar *,
+                       gpointer) {
+    return g_new0(gchar *, 1);
+}
+
+GDBusInterfaceInfo **introspectNode(GDBusConnection *, const gchar *,
+                                    const gchar *path, const gchar *node,
+                                    gpointer data) {
+    Mock &mock = *static_cast<Mock *>(data);
+    const char *interface = nullptr;
+
+    if (std::strncmp(path, SessionsPath, std::strlen(SessionsPath)) == 0) {
+        if (node && mock.sessions.count(std::strtoull(node, nullptr, 10))) {
+            interface = SessionInterface;
+        }
+    } else if (!node) {
+        interface = CollectionInterface;
+    } else if (mock.store.find(std::strtoull(node, nullptr, 10))) {
+        interface = ItemInterface;
+    }
+
+    if (!interface) {
+        return nullptr;
+    }
+    GDBusInterfaceInfo **infos = g_new0(GDBusInterfaceInfo *, 2);
+    infos[0] = g_dbus_interface_info_ref(
+        g_dbus_node_info_lookup_interface(mock.introspection, interface));
+    return infos;
+}
+
+const GDBusInterfaceVTable *dispatchNode(GDBusConnection *, const gchar *,
+                                         const gchar *, const gchar *,
+                                         const gchar *, gpointer *userData,
+                                         gpointer data) {
+    *userData = data;
+    return &InterfaceVTable;
+}
+
+const GDBusSubtreeVTable SubtreeVTable = {
+    &enumerateNodes, &introspectNode, &dispatchNode, {nullptr}};
+
+void onNameAcquired(GDBusConnection *, const gchar *, gpointer data) {
+    static_cast<Mock *>(data)->acquired = true;
+    std::printf("ready\n");
+    std::fflush(stdout);
+}
+
+void onNameLost(GDBusConnection *, const gchar *, gpointer data) {
+    Mock &mock = *static_cast<Mock *>(data);
+    std::fprintf(stderr,
+                 mock.acquired ? "Lost %s\n" : "Cannot own %s\n",
+                 BusName);
+    g_main_loop_quit(mock.loop);
+}
+
+bool registerObjects(Mock &mock, GDBusConnection *connection,
+                     GError **error) {
+    auto interfaceOf = [&mock](const char *name) {
+        return g_dbus_node_info_lookup_interface(mock.introspection, name);
+    };
+    return g_dbus_connection_register_object(connection,
+                                             ServicePath,
+                                             interfaceOf(ServiceInterface),
+                                             &InterfaceVTable,
+                                             &mock,
+                                             nullptr,
+                                             error) != 0 &&
+           g_dbus_connection_register_object(connection,
+                                             AliasPath,
+                                             interfaceOf(CollectionInterface),
+                                             &InterfaceVTable,
+                                             &mock,
+                                             nullptr,
+                                             error) != 0 &&
+           g_dbus_connection_register_subtree(
+               connection,
+               CollectionPath,
+               &SubtreeVTable,
+               G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+               &mock,
+               nullptr,
+               error) != 0 &&
+           g_dbus_connection_register_subtree(
+               connection,
+               SessionsPath,
+               &SubtreeVTable,
+               G_DBUS_SUBTREE_FLAGS_DISPATCH_TO_UNENUMERATED_NODES,
+               &mock,
+               nullptr,
+               error) != 0;
+}
+
+void populate(Mock &mock, std::uint64_t count) {
+    for (std::uint64_t i = 0; i < count; ++i) {
+        Item item;
+        item.attributes = {{"id", std::to_string(i)},
+                           {"xdg:schema", "com.example.mock-filler"}};
+        item.label = "Filler " + std::to_string(i);
+        item.secret = "filler";
+        item.contentType = "text/plain";
+        item.created = item.modified = mock.created;
+        mock.store.add(std::move(item));
+    }
+}
+
+//! \brief Parse METHOD=VALUE into the fault of METHOD
+template <typename Value>
+bool parseFault(Mock &mock, const char *arg, Value Fault::*field) {
+    const char *separator = std::strchr(arg, '=');
+    if (!separator) {
+        return false;
+    }
+    char *end = nullptr;
+    const double value = std::strtod(separator + 1, &end);
+    if (*end != '\0' || value < 0) {
+        return false;
+    }
+    mock.faults[std::string(arg, separator)].*field =
+        static_cast<Value>(value);
+    return true;
+}
+
+void printUsage(const char *program) {
+    std::fprintf(
+        stderr,
+        "Usage: %s [options]\n"
+        "\n"
+        "  --address ADDRESS       connect to the bus at ADDRESS instead of "
+        "the session bus\n"
+        "  --items N               start with N filler items\n"
+        "  --latency METHOD=MS     delay replies to METHOD by MS "
+        "milliseconds\n"
+        "  --error METHOD=RATE     fail this fraction of calls to METHOD\n"
+        "  --hang METHOD=RATE      never reply to this fraction of calls to "
+        "METHOD\n"
+        "  --seed N                seed of the fault injection (default 1)\n"
+        "\n"
+        "METHOD is a D-Bus method name, e.g. GetSecrets, or * for all "
+        "methods.\n"
+        "Options may be repeated.\n",
+        program);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Mock mock;
+    std::string address;
+    std::uint64_t items = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const char *value = i + 1 < argc ? argv[++i] : nullptr;
+        bool valid = value != nullptr;
+        if (!valid) {
+        } else if (arg == "--address") {
+            address = value;
+        } else if (arg == "--items") {
+            items = std::strtoull(value, nullptr, 10);
+        } else if (arg == "--latency") {
+            valid = parseFault(mock, value, &Fault::latencyMs);
+        } else if (arg == "--error") {
+            valid = parseFault(mock, value, &Fault::errorRate);
+        } else if (arg == "--hang") {
+            valid = parseFault(mock, value, &Fault::hangRate);
+        } else if (arg == "--seed") {
+            mock.random.seed(std::strtoull(value, nullptr, 10));
+        } else {
+            valid = false;
+        }
+
+        if (!valid) {
+            printUsage(argv[0]);
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    GError *error = nullptr;
+    GDBusConnection *connection =
+        address.empty()
+            ? g_bus_get_sync(G_BUS_TYPE_SESSION, nullptr, &error)
+            : g_dbus_connection_new_for_address_sync(
+                  address.c_str(),
+                  static_cast<GDBusConnectionFlags>(
+                      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                      G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION),
+                  nullptr,
+                  nullptr,
+                  &error);
+    if (!connection) {
+        std::fprintf(stderr, "Cannot connect to the bus: %s\n",
+                     error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+
+    mock.introspection = g_dbus_node_info_new_for_xml(Introspection, &error);
+    if (!mock.introspection || !registerObjects(mock, connection, &error)) {
+        std::fprintf(stderr, "Cannot export objects: %s\n", error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+    populate(mock, items);
+
+    mock.loop = g_main_loop_new(nullptr, FALSE);
+    g_bus_own_name_on_connection(connection,
+                                 BusName,
+                                 G_BUS_NAME_OWNER_FLAGS_NONE,
+                                 &onNameAcquired,
+                                 &onNameLost,
+                                 &mock,
+                                 nullptr);
+    g_main_loop_run(mock.loop);
+
+    // only returns if the name was lost
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Runs a command against keychain-mock-secret-service on the current session
+# bus, e.g. within dbus-run-session:
+#
+#   dbus-run-session -- test/run_with_mock.sh MOCK [MOCK OPTIONS] -- COMMAND...
+set -e
+
+mock="$1"
+shift
+mock_args=""
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    mock_args="$mock_args $1"
+    shift
+done
+[ "$1" = "--" ] && shift
+
+fifo="$(mktemp -u)"
+mkfifo "$fifo"
+# shellcheck disable=SC2086 # split the mock's options
+"$mock" $mock_args > "$fifo" &
+mock_pid=$!
+trap 'kill $mock_pid 2>/dev/null; rm -f "$fifo"' EXIT
+
+# the mock prints "ready" once it owns org.freedesktop.secrets
+read -r ready < "$fifo"
+[ "$ready" = "ready" ]
+
+"$@"
@@ -1,5 +1,39 @@
 #include "catch_amalgamated.hpp"
+#include "keychain/basic_keychain.h"
+#include "keychain/chunked.h"
+#include "keychain/completion_queue.h"
 #include "keychain/keychain.h"
+#include "keychain/memory_cache.h"
+#include "keychain/secure_string.h"
+#include "keychain/snapshot.h"
+#include "keychain/stats.h"
+#include "keychain/tracing.h"
+#include "keychain/watchdog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifndef KEYCHAIN_WINDOWS
+#include "keychain/agent.h"
+
+#include <poll.h>
+#endif
+
+#ifdef KEYCHAIN_LINUX
+#include "keychain/keyring_cache.h"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace keychain;
 
@@ -21,6 +55,59 @@ void check_no_error(const Error &ec) {
     CHECK(!ec);
 }
 
+// wait for the queue's handle and drain it until no operation is pending
+void drainAll(CompletionQueue &queue) {
+    while (queue.pending() > 0) {
+#ifdef KEYCHAIN_WINDOWS
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#else
+        pollfd pfd{queue.fd(), POLLIN, 0};
+        REQUIRE(poll(&pfd, 1, 10000) == 1);
+#endif
+        queue.drain();
+    }
+}
+
+// a CachePolicy counting its hits
+struct MapCache {
+    static constexpr bool enabled = true;
+
+    bool lookup(const Key &key, std::string &password) {
+        auto it = passwords.find(key.hash());
+        if (it == passwords.end()) {
+            return false;
+        }
+        ++hits;
+        password = it->second;
+        return true;
+    }
+    void store(const Key &key, const std::string &password) {
+        passwords[key.hash()] = password;
+    }
+    void invalidate(const Key &key) { passwords.erase(key.hash()); }
+
+    std::map<std::uint64_t, std::string> passwords;
+    int hits = 0;
+};
+
+// an Instrumentation counting the operations that began and ended
+struct CountingInstrumentation {
+    using Span = Operation;
+
+    Span begin(Operation operation, const Key *) {
+        ++begun[operation];
+        return operation;
+    }
+    void end(const Span &operation, const Error &err) {
+        ++ended[operation];
+        failed += err ? 1 : 0;
+    }
+
+    std::map<Operation, int> begun;
+    std::map<Operation, int> ended;
+    int failed = 0;
+};
+
 TEST_CASE("Keychain", "[keychain]") {
     auto crud = [](const std::string &package,
                    const std::string &service,
@@ -98,6 +185,800 @@ TEST_CASE("Keychain", "[keychain]") {
         CHECK(ec.type == ErrorType::NotFound);
     }
 
+    SECTION("hasPassword reports existence without an error") {
+        Error ec{};
+        CHECK_FALSE(hasPassword(package, service, user, ec));
+        check_no_error(ec);
+
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+
+        CHECK(hasPassword(package, service, user, ec));
+        check_no_error(ec);
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+
+        CHECK_FALSE(hasPassword(package, service, user, ec));
+        check_no_error(ec);
+    }
+
+    SECTION("Key overloads") {
+        const Key key(package, service, user);
+        CHECK(key.hash() == Key(package, service, user).hash());
+        CHECK(key.hash() != Key(package, service + user, "").hash());
+
+        Error ec{};
+        getPassword(key, ec);
+        REQUIRE(ec.type == ErrorType::NotFound);
+
+        setPassword(key, password, ec);
+        check_no_error(ec);
+        CHECK(hasPassword(key, ec));
+        CHECK(getPassword(key, ec) == password);
+        check_no_error(ec);
+
+        // interchangeable with the plain identifiers
+        CHECK(getPassword(package, service, user, ec) == password);
+        check_no_error(ec);
+
+        deletePassword(key, ec);
+        check_no_error(ec);
+        CHECK_FALSE(hasPassword(key, ec));
+    }
+
+    SECTION("BasicKeychain consults its cache and instrumentation") {
+        BasicKeychain<OsBackend, MapCache, CountingInstrumentation> keychain;
+        const Key key(package, service, user);
+
+        Error ec{};
+        keychain.getPassword(key, ec);
+        REQUIRE(ec.type == ErrorType::NotFound);
+        CHECK(keychain.instrumentation().failed == 1);
+
+        keychain.setPassword(key, password, ec);
+        check_no_error(ec);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+        CHECK(keychain.cache().hits == 0);
+
+        // answered from the cache, even where the backend would disagree
+        deletePassword(key, ec);
+        check_no_error(ec);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+        CHECK(keychain.hasPassword(key, ec));
+        CHECK(keychain.cache().hits == 2);
+
+        // writes invalidate the cache
+        keychain.setPassword(key, "swordfish", ec);
+        check_no_error(ec);
+        std::string viewed;
+        keychain.withPassword(
+            key,
+            [&](const char *data, std::size_t size) {
+                viewed.assign(data, size);
+            },
+            ec);
+        check_no_error(ec);
+        CHECK(viewed == "swordfish");
+        CHECK(keychain.cache().passwords.size() == 1);
+
+        keychain.deletePassword(key, ec);
+        check_no_error(ec);
+        CHECK_FALSE(keychain.hasPassword(key, ec));
+        CHECK(keychain.cache().passwords.empty());
+
+        const auto &instrumentation = keychain.instrumentation();
+        CHECK(instrumentation.begun == instrumentation.ended);
+        CHECK(instrumentation.begun.at(Operation::GetPassword) == 3);
+        CHECK(instrumentation.failed == 1);
+    }
+
+    SECTION("free functions record their latencies in the stats") {
+        resetStats();
+
+        Error ec{};
+        getPassword(package, service, user, ec);
+        REQUIRE(ec.type == ErrorType::NotFound);
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+        getPassword(package, service, user, ec);
+        check_no_error(ec);
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+
+        const Stats snapshot = stats(true);
+        CHECK(snapshot.operations.size() == 4);
+        const auto *notFound = snapshot.latency(
+            Operation::GetPassword, StatsBackend::Os, Outcome::NotFound);
+        REQUIRE(notFound != nullptr);
+        CHECK(notFound->count() == 1);
+        CHECK(notFound->percentile(100) >= notFound->mean());
+        const auto *found = snapshot.latency(
+            Operation::GetPassword, StatsBackend::Os, Outcome::Success);
+        REQUIRE(found != nullptr);
+        CHECK(found->count() == 1);
+        CHECK(snapshot.latency(Operation::DeletePassword,
+                               StatsBackend::Os,
+                               Outcome::Error) == nullptr);
+
+        CHECK(stats().operations.empty());
+    }
+
+    SECTION("backends and caches count their work") {
+        BasicKeychain<OsBackend, MemoryCache> keychain{
+            OsBackend{}, MemoryCache(), NoInstrumentation{}};
+        const Key key(package, service, user);
+
+        Error ec{};
+        setPassword(key, password, ec);
+        check_no_error(ec);
+        resetStats();
+        CHECK(keychain.getPassword(key, ec) == password);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+        deletePassword(key, ec);
+        check_no_error(ec);
+
+        const Stats snapshot = stats();
+        CHECK(snapshot.counter(Counter::MemoryCacheMisses) == 1);
+        CHECK(snapshot.counter(Counter::MemoryCacheHits) == 1);
+#ifdef KEYCHAIN_LINUX
+        CHECK(snapshot.counter(Counter::RoundTrips) >= 2);
+        CHECK(snapshot.counter(Counter::SecretBytesRead) == password.size());
+#endif
+
+        const std::string text = toPrometheusText(snapshot);
+        CHECK(text.find("# TYPE keychain_cache_hits_total counter\n") !=
+              std::string::npos);
+        CHECK(text.find("keychain_cache_hits_total{cache=\"memory\"} 1\n") !=
+              std::string::npos);
+        CHECK(text.find("keychain_operation_duration_seconds_count{"
+                        "operation=\"deletePassword\",backend=\"os\","
+                        "outcome=\"success\"} 1\n") != std::string::npos);
+    }
+
+#ifdef KEYCHAIN_TRACING
+    SECTION("a registered Tracer sees each operation") {
+        struct RecordingTracer : Tracer {
+            std::vector<TraceEvent> begun;
+            std::vector<TraceEvent> ended;
+
+            void begin(const TraceEvent &event) noexcept override {
+                begun.push_back(event);
+            }
+            void end(const TraceEvent &event) noexcept override {
+                ended.push_back(event);
+            }
+        } recording;
+
+        const Key key(package, service, user);
+        Error ec{};
+        setTracer(&recording);
+        getPassword(key, ec);
+        isAvailable(ec);
+        setTracer(nullptr);
+
+        REQUIRE(recording.begun.size() == 2);
+        REQUIRE(recording.ended.size() == 2);
+        CHECK(recording.ended[0].operation == Operation::GetPassword);
+        CHECK(recording.ended[0].backend == StatsBackend::Os);
+        CHECK(recording.ended[0].keyHash == key.hash());
+        CHECK(recording.ended[0].start == recording.begun[0].start);
+        CHECK(recording.ended[0].error == ErrorType::NotFound);
+        CHECK(recording.ended[1].operation == Operation::IsAvailable);
+        CHECK(recording.ended[1].keyHash == 0);
+
+        const std::string path = "keychain-tests-trace.json";
+        {
+            ChromeTraceExporter exporter(path);
+            REQUIRE(exporter.isOpen());
+            setTracer(&exporter);
+            getPassword(key, ec);
+            setTracer(nullptr);
+        }
+        std::ifstream file(path);
+        const std::string trace((std::istreambuf_iterator<char>(file)),
+                                std::istreambuf_iterator<char>());
+        file.close();
+        std::remove(path.c_str());
+        CHECK(trace.find("\"name\":\"getPassword\"") != std::string::npos);
+        CHECK(trace.find("\"error\":\"NotFound\"") != std::string::npos);
+        CHECK(trace.back() == '\n');
+    }
+#endif
+
+    SECTION("the watchdog reports operations while they are running") {
+        // an OsBackend taking its time to look up a password
+        struct SlowBackend : OsBackend {
+            static std::string getPassword(const Key &key, Error &err) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                return OsBackend::getPassword(key, err);
+            }
+        };
+        BasicKeychain<SlowBackend,
+                      NoCache,
+                      StatsInstrumentation<StatsBackend::Os>>
+            keychain;
+        const Key key(package, service, user);
+
+        std::atomic<bool> returned{false};
+        std::mutex mutex;
+        std::vector<SlowOperation> reported;
+        std::vector<bool> whileRunning;
+        startWatchdog(std::chrono::milliseconds(20),
+                      [&](const SlowOperation &operation) {
+                          std::lock_guard<std::mutex> lock(mutex);
+                          reported.push_back(operation);
+                          whileRunning.push_back(!returned);
+                      });
+
+        Error ec{};
+        keychain.getPassword(key, ec);
+        returned = true;
+        stopWatchdog();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        REQUIRE(reported.size() == 1);
+        CHECK(whileRunning[0]);
+        CHECK(reported[0].operation == Operation::GetPassword);
+        CHECK(reported[0].keyHash == key.hash());
+        CHECK(reported[0].elapsed >= std::chrono::milliseconds(20));
+        CHECK(reported[0].thread == std::this_thread::get_id());
+    }
+
+    SECTION("LatencyHistogram buckets are accurate to 1/16") {
+        using std::chrono::nanoseconds;
+        for (std::int64_t ns = 1; ns < (std::int64_t(1) << 36); ns *= 3) {
+            const auto bucket = LatencyHistogram::bucketOf(nanoseconds(ns));
+            const auto limit = LatencyHistogram::bucketLimit(bucket);
+            CHECK(limit.count() >= ns);
+            CHECK(limit.count() - ns <= ns / 16);
+            CHECK(LatencyHistogram::bucketOf(limit) == bucket);
+        }
+
+        LatencyHistogram histogram;
+        for (int ms = 1; ms <= 100; ++ms) {
+            histogram.record(std::chrono::milliseconds(ms));
+        }
+        CHECK(histogram.count() == 100);
+        CHECK(histogram.mean() == std::chrono::microseconds(50500));
+        CHECK(histogram.percentile(50) >= std::chrono::milliseconds(50));
+        CHECK(histogram.percentile(50) < std::chrono::milliseconds(54));
+        CHECK(histogram.percentile(100) >= std::chrono::milliseconds(100));
+    }
+
+    SECTION("CompletionQueue completes operations into a pollable handle") {
+        Error ec{};
+        CompletionQueue queue(ec);
+        check_no_error(ec);
+        const Key key(package, service, user);
+
+        Error result{};
+        std::string retrieved;
+        auto onPassword = [&](std::string password, const Error &err) {
+            retrieved = std::move(password);
+            result = err;
+        };
+        auto onDone = [&](const Error &err) { result = err; };
+
+        queue.setPassword(key, password, onDone);
+        CHECK(queue.pending() == 1);
+        drainAll(queue);
+        check_no_error(result);
+
+        queue.getPassword(key, onPassword);
+        drainAll(queue);
+        check_no_error(result);
+        CHECK(retrieved == password);
+
+        queue.deletePassword(key, onDone);
+        drainAll(queue);
+        check_no_error(result);
+
+        queue.getPassword(key, onPassword);
+        drainAll(queue);
+        CHECK(result.type == ErrorType::NotFound);
+        CHECK(queue.drain() == 0);
+    }
+
+    SECTION("asynchronous operations are recorded like blocking ones") {
+        Error ec{};
+        CompletionQueue queue(ec);
+        check_no_error(ec);
+        const Key key(package, service, user);
+
+        resetStats();
+        Error result{};
+        queue.deletePassword(key, [&](const Error &err) { result = err; });
+        drainAll(queue);
+        CHECK(result.type == ErrorType::NotFound);
+
+        const Stats snapshot = stats();
+        const auto *notFound = snapshot.latency(
+            Operation::DeletePassword, StatsBackend::Os, Outcome::NotFound);
+        REQUIRE(notFound != nullptr);
+        CHECK(notFound->count() == 1);
+    }
+
+    SECTION("asynchronous lookups of binary secrets fail like blocking ones") {
+        Error ec{};
+        CompletionQueue queue(ec);
+        check_no_error(ec);
+        const Key key(package, service, user);
+        const unsigned char binary[] = {0x00, 0xff, 0x01};
+        setSecret(key, binary, sizeof(binary), ec);
+        check_no_error(ec);
+
+        Error blocking{};
+        getPassword(key, blocking);
+
+        Error result{};
+        queue.getPassword(key, [&](const std::string &, const Error &err) {
+            result = err;
+        });
+        drainAll(queue);
+        CHECK(result.type == blocking.type);
+#ifdef KEYCHAIN_LINUX
+        CHECK(result.type == ErrorType::GenericError);
+#endif
+
+        deletePassword(key, ec);
+        check_no_error(ec);
+    }
+
+#ifdef KEYCHAIN_LINUX
+    SECTION("children forked after connecting fail right away") {
+        const Key key(package, service, user);
+        Error ec{};
+        setPassword(key, password, ec);
+        check_no_error(ec);
+
+        const pid_t pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            // GIO's D-Bus thread is gone, so calls would otherwise hang
+            alarm(10);
+            Error childEc{};
+            getPassword(key, childEc);
+            const bool failed = childEc.type == ErrorType::Unavailable;
+            _exit(failed && !isAvailable(childEc) ? 0 : 1);
+        }
+
+        int status = 0;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status));
+        CHECK(WEXITSTATUS(status) == 0);
+
+        // the parent is not affected
+        CHECK(getPassword(key, ec) == password);
+        check_no_error(ec);
+        deletePassword(key, ec);
+        check_no_error(ec);
+    }
+#endif
+
+    SECTION("Snapshot serves frozen passwords") {
+        const Key first(package, service, user);
+        const Key second(package, service, "other user");
+        const Key missing(package, service, "missing user");
+
+        Error ec{};
+        setPassword(first, password, ec);
+        check_no_error(ec);
+        setPassword(second, "swordfish", ec);
+        check_no_error(ec);
+
+        auto snapshot = std::make_shared<Snapshot>(
+            Snapshot::fetch({first, second, missing}, ec));
+        check_no_error(ec);
+        CHECK(snapshot->size() == 2);
+        CHECK(snapshot->bytes() > 0);
+
+        // the backend is no longer consulted for frozen passwords
+        deletePassword(first, ec);
+        check_no_error(ec);
+
+        SnapshotKeychain keychain{
+            SnapshotBackend{}, SnapshotCache(snapshot), NoInstrumentation{}};
+        CHECK(keychain.getPassword(first, ec) == password);
+        check_no_error(ec);
+        keychain.getPassword(missing, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+
+        // writes through the keychain invalidate the snapshot
+        keychain.deletePassword(second, ec);
+        check_no_error(ec);
+        keychain.getPassword(second, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+    }
+
+#ifdef KEYCHAIN_LINUX
+    SECTION("forked workers read a Snapshot fetched by their parent") {
+        const Key frozen(package, service, user);
+        const Key missing(package, service, "missing user");
+        Error ec{};
+        setPassword(frozen, password, ec);
+        check_no_error(ec);
+        auto snapshot =
+            std::make_shared<Snapshot>(Snapshot::fetch({frozen}, ec));
+        check_no_error(ec);
+
+        const pid_t pid = fork();
+        REQUIRE(pid >= 0);
+        if (pid == 0) {
+            alarm(10);
+            // no agent is listening, so misses fall back to OsBackend
+            SnapshotKeychain keychain{
+                AgentBackend("/nonexistent/keychain-agent.sock"),
+                SnapshotCache(snapshot),
+                NoInstrumentation{}};
+            Error hitEc{};
+            const bool hit = keychain.getPassword(frozen, hitEc) == password;
+            Error missEc{};
+            keychain.getPassword(missing, missEc);
+            const bool failed = missEc.type == ErrorType::Unavailable;
+            _exit(hit && !hitEc && failed ? 0 : 1);
+        }
+
+        int status = 0;
+        REQUIRE(waitpid(pid, &status, 0) == pid);
+        CHECK(WIFEXITED(status));
+        CHECK(WEXITSTATUS(status) == 0);
+
+        deletePassword(frozen, ec);
+        check_no_error(ec);
+    }
+#endif
+
+    SECTION("MemoryCache keeps passwords until they expire") {
+        BasicKeychain<OsBackend, MemoryCache> keychain{
+            OsBackend{},
+            MemoryCache(std::chrono::milliseconds(50)),
+            NoInstrumentation{}};
+        const Key key(package, service, user);
+
+        Error ec{};
+        keychain.setPassword(key, password, ec);
+        check_no_error(ec);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+        CHECK(keychain.cache().size() == 1);
+
+        deletePassword(key, ec);
+        check_no_error(ec);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        keychain.getPassword(key, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK(keychain.cache().size() == 0);
+    }
+
+#ifndef KEYCHAIN_WINDOWS
+    SECTION("AgentKeychain falls back to OsBackend without an agent") {
+        AgentKeychain keychain{AgentBackend("/nonexistent/keychain-agent.sock"),
+                               NoCache{},
+                               StatsInstrumentation<StatsBackend::Agent>{}};
+        const Key key(package, service, user);
+
+        Error ec{};
+        keychain.setPassword(key, password, ec);
+        check_no_error(ec);
+        CHECK(getPassword(key, ec) == password);
+        check_no_error(ec);
+        CHECK(keychain.getPassword(key, ec) == password);
+        check_no_error(ec);
+        CHECK(keychain.hasPassword(key, ec));
+
+        keychain.deletePassword(key, ec);
+        check_no_error(ec);
+        CHECK_FALSE(keychain.hasPassword(key, ec));
+        check_no_error(ec);
+    }
+#endif
+
+#ifdef KEYCHAIN_LINUX
+    SECTION("the user keyring is shared between caches") {
+        // a tombstone left by a previous run would keep it from caching
+        const Key key(package, service, "pid " + std::to_string(getpid()));
+        KeyringCache probe;
+        std::string cached;
+        probe.store(key, password);
+        if (!probe.lookup(key, cached)) {
+            WARN("the user keyring is not accessible, e.g. due to seccomp");
+        } else {
+            // written by another program, bypassing the keyring
+            Error ec{};
+            OsBackend::setPassword(key, password, ec);
+            check_no_error(ec);
+            KeyringCachedKeychain keychain;
+            CHECK(keychain.getPassword(key, ec) == password);
+            check_no_error(ec);
+
+            // another process would find it in L2
+            OsBackend::deletePassword(key, ec);
+            check_no_error(ec);
+            KeyringCachedKeychain other;
+            CHECK(other.getPassword(key, ec) == password);
+            check_no_error(ec);
+            CHECK(other.cache().l1().size() == 1);
+
+            // writes through the free functions invalidate L2
+            OsBackend::setPassword(key, password, ec);
+            check_no_error(ec);
+            deletePassword(key, ec);
+            check_no_error(ec);
+            KeyringCachedKeychain third;
+            third.getPassword(key, ec);
+            CHECK(ec.type == ErrorType::NotFound);
+            CHECK_FALSE(third.cache().l2().lookup(key, cached));
+
+            // and keep reads that overlapped them from caching
+            probe.store(key, password);
+            CHECK_FALSE(probe.lookup(key, cached));
+        }
+    }
+#endif
+
+    SECTION("Result overloads") {
+        auto result = getPassword(package, service, user);
+        CHECK_FALSE(result);
+        CHECK(result.error().type == ErrorType::NotFound);
+        CHECK_FALSE(result.error().message.empty());
+
+        Error ec{};
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+
+        result = getPassword(Key(package, service, user));
+        REQUIRE(result);
+        check_no_error(result.error());
+        CHECK(*result == password);
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+    }
+
+    SECTION("error messages convert to std::string") {
+        Error ec{};
+        ec.message = ErrorMessage::literal("literal");
+        CHECK(std::string(ec.message) == "literal");
+
+        ec.message = ErrorMessage::deferred(
+            [](int code) { return std::to_string(code); }, 42);
+        CHECK(ec.message == "42");
+
+        ec.message = std::string("dynamic");
+        CHECK(ec.message.find("nam") == 2);
+
+        // the read-only interface of std::string
+        ec.message = ErrorMessage::literal("not found");
+        const std::string &bound = ec.message;
+        CHECK(bound == "not found");
+        CHECK(ec.message.size() == 9);
+        CHECK(ec.message.substr(4) == "found");
+        CHECK(ec.message + "!" == "not found!");
+        CHECK("Error: " + ec.message == "Error: not found");
+        CHECK(std::string("[") + ec.message + ']' == "[not found]");
+        CHECK(ec.message != "found");
+        ec.message += " at all";
+        CHECK(ec.message == "not found at all");
+    }
+
+    SECTION("deferred error messages own their native error") {
+        static const ErrorMessage::NativeError native = {
+            [](const void *error) {
+                return *static_cast<const std::string *>(error);
+            },
+            [](const void *error) -> void * {
+                return new std::string(
+                    *static_cast<const std::string *>(error));
+            },
+            [](void *error) { delete static_cast<std::string *>(error); }};
+
+        Error ec{};
+        ec.message =
+            ErrorMessage::deferred(native, new std::string("native error"));
+        const Error copy = ec;
+        ec = Error{};
+        CHECK(copy.message == "native error");
+
+        // formatting on first access is safe from several threads
+        const Error shared = copy;
+        std::vector<std::thread> readers;
+        std::vector<std::size_t> sizes(4);
+        for (std::size_t i = 0; i < sizes.size(); ++i) {
+            readers.emplace_back(
+                [&, i] { sizes[i] = shared.message.str().size(); });
+        }
+        for (auto &reader : readers) {
+            reader.join();
+        }
+        CHECK(std::all_of(sizes.begin(), sizes.end(), [](std::size_t size) {
+            return size == 12;
+        }));
+    }
+
+    SECTION("withPassword provides a view of the password") {
+        Error ec{};
+        bool called = false;
+        withPassword(
+            package,
+            service,
+            user,
+            [&](const char *, std::size_t) { called = true; },
+            ec);
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK_FALSE(called);
+
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+
+        std::string viewed;
+        withPassword(
+            package,
+            service,
+            user,
+            [&](const char *data, std::size_t size) {
+                viewed.assign(data, size);
+            },
+            ec);
+        check_no_error(ec);
+        CHECK(viewed == password);
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+    }
+
+    SECTION("getPassword into SecureString uses the secure pool") {
+        Error ec{};
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+
+        const auto before = securePoolStats();
+        {
+            SecureString secure;
+            getPassword(package, service, user, secure, ec);
+            check_no_error(ec);
+            CHECK(std::string(secure.c_str()) == password);
+            CHECK(securePoolStats().allocations == before.allocations + 1);
+        }
+        CHECK(securePoolStats().allocations == before.allocations);
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+
+        SecureString secure("stale", 5);
+        getPassword(package, service, user, secure, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+        CHECK(secure.empty());
+    }
+
+    SECTION("binary secrets keep embedded NUL characters") {
+        const std::vector<unsigned char> secret_in = {
+            0x30, 0x82, 0x00, 0x01, 0x00, 0xff, 0x00};
+
+        Error ec{};
+        getSecret(package, service, user, ec);
+        REQUIRE(ec.type == ErrorType::NotFound);
+
+        setSecret(package,
+                  service,
+                  user,
+                  secret_in.data(),
+                  secret_in.size(),
+                  ec);
+        check_no_error(ec);
+
+        const auto secret = getSecret(package, service, user, ec);
+        check_no_error(ec);
+        CHECK(secret == secret_in);
+
+#ifdef KEYCHAIN_LINUX
+        // the item exists, so it must not be reported as NotFound
+        getPassword(package, service, user, ec);
+        CHECK(ec.type == ErrorType::GenericError);
+#endif
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+        getSecret(package, service, user, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+    }
+
+    SECTION("chunked secrets are split and reassembled") {
+        std::vector<unsigned char> secret_in(5 * DefaultChunkSize + 123);
+        for (std::size_t i = 0; i < secret_in.size(); ++i) {
+            secret_in[i] = static_cast<unsigned char>(i * 31);
+        }
+
+        Error ec{};
+        setChunkedSecret(
+            package, service, user, secret_in.data(), secret_in.size(), ec);
+        check_no_error(ec);
+
+        std::vector<unsigned char> secret;
+        std::size_t chunks = 0;
+        readChunkedSecret(
+            package,
+            service,
+            user,
+            [&](const unsigned char *data, std::size_t size) {
+                CHECK(size <= DefaultChunkSize);
+                secret.insert(secret.end(), data, data + size);
+                ++chunks;
+            },
+            ec);
+        check_no_error(ec);
+        CHECK(chunks == 6);
+        CHECK(secret == secret_in);
+
+        // the chunks are listed by their manifest only
+        const auto all = getAllMetadata(package, ec);
+        check_no_error(ec);
+        CHECK(std::count_if(all.begin(), all.end(), [&](const Metadata &m) {
+                  return m.service.compare(0, service.size(), service) == 0;
+              }) == 1);
+
+        // the manifest names the generation of the chunks
+        const auto firstChunk = [&]() {
+            const auto manifest = getSecret(package, service, user, ec);
+            std::istringstream stream(
+                std::string(manifest.begin(), manifest.end()));
+            std::string magic;
+            unsigned long long generation = 0;
+            stream >> magic >> generation;
+            return service + "#chunk." + std::to_string(generation) + ".0";
+        };
+        const auto previous = firstChunk();
+        CHECK(hasPassword(package, previous, user, ec));
+
+        // a new generation replaces the chunks of the previous one
+        setChunkedSecret(
+            package, service, user, secret_in.data(), secret_in.size(), ec);
+        check_no_error(ec);
+        const auto current = firstChunk();
+        CHECK(current != previous);
+        CHECK_FALSE(hasPassword(package, previous, user, ec));
+        CHECK(hasPassword(package, current, user, ec));
+
+        deleteChunkedSecret(package, service, user, ec);
+        check_no_error(ec);
+        CHECK_FALSE(hasPassword(package, current, user, ec));
+        deleteChunkedSecret(package, service, user, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+    }
+
+    SECTION("metadata is available without retrieving the password") {
+        Error ec{};
+        getMetadata(package, service, user, ec);
+        CHECK(ec.type == ErrorType::NotFound);
+
+        const auto before = std::chrono::system_clock::now();
+        setPassword(package, service, user, password, ec);
+        check_no_error(ec);
+
+        const auto metadata = getMetadata(package, service, user, ec);
+        check_no_error(ec);
+        CHECK(metadata.service == service);
+        CHECK(metadata.user == user);
+        CHECK(metadata.modified >= before - std::chrono::seconds(2));
+
+        const auto all = getAllMetadata(package, ec);
+        check_no_error(ec);
+        const auto found = std::find_if(
+            all.begin(), all.end(), [&](const Metadata &m) {
+                return m.service == service && m.user == user;
+            });
+        CHECK(found != all.end());
+
+        deletePassword(package, service, user, ec);
+        check_no_error(ec);
+    }
+
     SECTION("successful function call overrides previous Error to success") {
         Error ec{};
         ec.type = ErrorType::GenericError;